@@ -415,6 +415,7 @@ void message_edit(char *text, int msglen, char view, char builtin)
 	    tty_gotoxy(0, lines - 1);
 	    tty_putc('\n');
 	}
+	split_reset();
 
 	if (i == -1)
 	    errmsg("waitpid");
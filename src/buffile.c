@@ -0,0 +1,45 @@
+/*
+ *  buffile.c  --  check the #buffile, the circular buffer of #setvar buffer
+ *                 kept in a file. Used by powwow and by powwow-bufdump.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ */
+
+#include <string.h>
+
+#include "buffile.h"
+
+/*
+ * is h, len bytes long, a buffer written by this powwow?
+ */
+int buf_valid(const bufhdr *h, long len)
+{
+    if (len < BUF_HDRLEN || memcmp(h->magic, BUF_MAGIC, 8) ||
+	h->entrysize != sizeof(bufentry) ||
+	h->datasize <= 0 || h->logsize <= 0 ||
+	len != BUF_FILELEN(h->datasize, h->logsize))
+	return 0;
+    return h->datastart >= 0 && h->datastart < h->datasize &&
+	h->dataend >= 0 && h->dataend < h->datasize &&
+	h->logstart >= 0 && h->logstart < h->logsize &&
+	h->logend >= 0 && h->logend < h->logsize;
+}
+
+/*
+ * the text of entry i, or NULL if it does not make sense
+ * (powwow was killed while writing it)
+ */
+const char *buf_line(const bufhdr *h, int i)
+{
+    const bufentry *e = BUF_ENTRIES(h) + i;
+    const char *data = BUF_DATA(h);
+
+    if (e->line < 0 || e->line >= h->datasize ||
+	!memchr(data + e->line, '\0', h->datasize - e->line))
+	return NULL;
+    return data + e->line;
+}
@@ -0,0 +1,42 @@
+/* layout of the #buffile, shared by powwow and powwow-bufdump */
+
+#ifndef _BUFFILE_H_
+#define _BUFFILE_H_
+
+/*
+ * The circular buffer of #setvar buffer, mapped in memory from a file:
+ * a bufhdr, logsize bufentry and datasize bytes of text, each line
+ * followed by a '\0'. The lines in use are the entries from logstart
+ * to logend (excluded), oldest first.
+ * Numbers are in the native format: the file is meant to be read
+ * on the machine that wrote it, after powwow died.
+ */
+#define BUF_MAGIC	"PWBUF01\n"
+#define BUF_HDRLEN	64	/* bytes before the first entry */
+
+typedef struct bufhdr {
+    char magic[8];
+    int entrysize;		/* sizeof(bufentry) */
+    int datasize, logsize;
+    int datastart;		/* index to first string start */
+    int dataend;		/* index one past last string end */
+    int logstart;		/* index to first entry used */
+    int logend;			/* index one past last entry used */
+} bufhdr;
+
+typedef struct bufentry {
+    int kind;			/* enum linetype, in log.h */
+    int line;			/* index of the string in the text */
+    long msecs;			/* millisecs since the previous line */
+    long long time;		/* millisecs since the epoch */
+} bufentry;
+
+#define BUF_ENTRIES(h)	((bufentry *)((char *)(h) + BUF_HDRLEN))
+#define BUF_DATA(h)	((char *)(h) + BUF_HDRLEN + (h)->logsize * (long)sizeof(bufentry))
+#define BUF_FILELEN(datasize, logsize) \
+	(BUF_HDRLEN + (logsize) * (long)sizeof(bufentry) + (datasize))
+
+int buf_valid(const bufhdr *h, long len);
+const char *buf_line(const bufhdr *h, int i);
+
+#endif /* _BUFFILE_H_ */
@@ -44,24 +44,28 @@
 #include "tty.h"
 #include "eval.h"
 #include "log.h"
+#include "history.h"
+#include "logfile.h"
+#include "movie.h"
+#include "scrollback.h"
 
 /*           local function declarations            */
 #define F(name) cmd_ ## name(char *arg)
 
 static void F(help), F(shell), F(action), F(add),
-  F(addstatic), F(alias), F(at), F(beep), F(bind),
+  F(addstatic), F(alias), F(at), F(beep), F(bind), F(buffile),
   F(cancel), F(capture), F(clear), F(connect), F(cpu),
   F(do), F(delim), F(edit), F(emulate), F(exe),
-  F(file), F(for), F(hilite), F(history), F(host),
+  F(file), F(for), F(hilite), F(histfile), F(history), F(host),
   F(identify), F(if), F(in), F(init), F(isprompt),
   F(key), F(keyedit),
   F(load), F(map), F(mark), F(movie),
   F(net), F(nice), F(option),
   F(prefix), F(print), F(prompt), F(put),
-  F(qui), F(quit), F(quote),
+  F(qui), F(queue), F(quit), F(quote),
   F(rawsend), F(rawprint), F(rebind), F(rebindall), F(rebindALL),
   F(record), F(request), F(reset), F(retrace),
-  F(save), F(send), F(setvar), F(snoop), F(spawn), F(stop),
+  F(save), F(search), F(send), F(setvar), F(snoop), F(spawn), F(status), F(stop),
   F(substitute), F(time), F(var), F(ver), F(while), F(write),
   F(eval), F(zap), F(module), F(group), F(speedwalk), F(groupdelim);
 
@@ -103,10 +107,12 @@ cmdstruct default_commands[] =
     C("bind",       cmd_bind,
       "[edit|name [seq][=[command]]]\n"
       "\t\t\t\tdelete/list/define key bindings"),
+    C("buffile",    cmd_buffile,
+      "[file]\t\t\tkeep the #setvar buffer in file"),
     C("cancel",     cmd_cancel,
-      "[number]\t\tcancel editing session"),
+      "[number|send]\t\tcancel editing session or #send <file"),
     C("capture",    cmd_capture,
-      "[filename]\t\tbegin/end of capture to file"),
+      "[@[from][,to]|##id] [file]\tbegin/end of capture to file"),
     C("clear",      cmd_clear,
       "\t\t\tclear input line (use from spawned programs)"),
 #ifdef BUG_TELNET
@@ -140,6 +146,8 @@ cmdstruct default_commands[] =
       "[delimiter]\tchange delimiter for action/alias groups"),
     C("hilite",     cmd_hilite,
       "[attr]\t\t\thighlight your input line"),
+    C("histfile",   cmd_histfile,
+      "[file]\t\t\tkeep command history in file"),
     C("history",    cmd_history,
       "[{number|(expr)}]\tlist/execute commands in history"),
     C("host",       cmd_host,
@@ -171,7 +179,7 @@ cmdstruct default_commands[] =
       "[name]\t\t\tload shared library extension"),
 #endif
     C("movie",      cmd_movie,
-      "[filename]\t\tbegin/end of movie record to file"),
+      "[##id] [filename]\tbegin/end of movie record to file"),
     C("net",        cmd_net,
       "\t\t\t\tprint amount of data received from/sent to host"),
     C("nice",       cmd_nice,
@@ -193,6 +201,8 @@ cmdstruct default_commands[] =
       "{text|(expr)}\t\tput text/result of expression in history"),
     C("qui",        cmd_qui,
       "\t\t\t\tdo nothing"),
+    C("queue",      cmd_queue,
+      "[number|flush|clear]\tset/show commands sent before waiting a prompt"),
     C("quit",       cmd_quit,
       "\t\t\t\tquit powwow"),
     C("quote",      cmd_quote,
@@ -217,6 +227,8 @@ cmdstruct default_commands[] =
       "[number]\t\tretrace the last number steps"),
     C("save",       cmd_save,
       "[filename]\t\tsave powwow settings to file"),
+    C("search",     cmd_search,
+      "[-i][-e][-N][-m max][##id] text\tfind text in #setvar scrollback"),
     C("send",       cmd_send,
       "[<|!]{text|(expr)}\teval expression, sending result to the MUD"),
     C("setvar",     cmd_setvar,
@@ -227,6 +239,8 @@ cmdstruct default_commands[] =
       "connect-id command\ttalk with a shell command"),
     C("speedwalk",  cmd_speedwalk,
       "[speedwalk sequence]\texecute a speedwalk sequence explicitly"),
+    C("status",     cmd_status,
+      "[number [attr]=[(expr)]]\tdelete/list/define status lines"),
     C("substitute",       cmd_substitute,
       "[string[=[text]]]\tdelete/list/define substitutions"),
     C("stop",       cmd_stop,
@@ -585,6 +599,7 @@ static void cmd_shell(char *arg)
         tty_start();
         tty_gotoxy(col0 = 0, line0 = lines -1);
         tty_puts(tty_clreoln);
+        split_reset();
     }
 }
 #endif
@@ -732,6 +747,52 @@ static void cmd_hilite(char *arg)
     }
 }
 
+static void cmd_histfile(char *arg)
+{
+    char *name;
+
+    arg = skipspace(arg);
+    if (!*arg) {
+	if ((name = history_file())) {
+	    if (opt_info) {
+		PRINTF("#end of history file \"%s\".\n", name);
+	    }
+	    history_close();
+	} else {
+	    PRINTF("#histfile: which file?\n");
+	}
+    } else if (history_open(arg) < 0) {
+	PRINTF("#error opening file \"%s\": %s\n", arg, strerror(errno));
+    } else if (opt_info) {
+	PRINTF("#history file \"%s\" active, %d lines.\n", arg,
+	       history_count());
+    }
+}
+
+static void cmd_buffile(char *arg)
+{
+    char *name;
+
+    arg = skipspace(arg);
+    if (!*arg) {
+	if ((name = log_file())) {
+	    if (opt_info) {
+		PRINTF("#end of buffer file \"%s\".\n", name);
+	    }
+	    log_setfile(NULL);
+	} else {
+	    PRINTF("#buffile: which file?\n");
+	}
+    } else if (log_setfile(arg) < 0) {
+	if (errno == EINVAL)
+	    PRINTF("#buffile: set its size first with #setvar buffer\n");
+	else
+	    PRINTF("#error opening file \"%s\": %s\n", arg, strerror(errno));
+    } else if (opt_info) {
+	PRINTF("#buffer file \"%s\" active, %d bytes.\n", arg, log_getsize());
+    }
+}
+
 static void cmd_history(char *arg)
 {
     int num = 0;
@@ -1043,6 +1104,10 @@ static void cmd_init(char *arg)
 
 static void cmd_isprompt(char *arg)
 {
+    /* hosts that mark prompts with IAC GA already acknowledged this one */
+    if (tcp_fd != -1 && !(CONN_LIST(tcp_fd).flags & PROMPTMARK))
+	tcp_sendq_ack(tcp_fd);
+
     if (tcp_fd == tcp_main_fd) {
 	int i;
 	long l;
@@ -1178,6 +1243,39 @@ static void cmd_prefix(char *arg)
     }
 }
 
+static void cmd_queue(char *arg)
+{
+    int n;
+
+    arg = skipspace(arg);
+    if (!*arg) {
+	tcp_sendq_show();
+	return;
+    }
+    if (tcp_fd == -1) {
+	PRINTF("#not connected to a MUD!\n");
+	return;
+    }
+    if (!strcmp(arg, "flush"))
+	tcp_sendq_flush(tcp_fd);
+    else if (!strcmp(arg, "clear"))
+	tcp_sendq_clear(tcp_fd);
+    else if (isdigit(*arg)) {
+	if ((n = atoi(arg)) == 0)
+	    tcp_sendq_flush(tcp_fd);
+	CONN_LIST(tcp_fd).sendq_max = n;
+	if (opt_info) {
+	    if (n)
+		PRINTF("#queue on \"%s\": at most %d command%s waiting a prompt.\n",
+		       CONN_LIST(tcp_fd).id, n, n == 1 ? "" : "s");
+	    else
+		PRINTF("#queue on \"%s\" is now off.\n", CONN_LIST(tcp_fd).id);
+	}
+    } else {
+	PRINTF("#syntax: #queue [number|flush|clear]\n");
+    }
+}
+
 static void cmd_quote(char *arg)
 {
     arg = skipspace(arg);
@@ -1290,20 +1388,21 @@ static void cmd_reset(char *arg)
 	    return;
     }
     if (all || !strcmp(arg, "var")) {
-        int n;
+        int n, i;
 	varnode **first;
 
 	for (n = 0; n < MAX_HASH; n++) {
-	    while (named_vars[0][n])
-		delete_varnode(&named_vars[0][n], 0);
-	    first = &named_vars[1][n];
-	    while (*first) {
-		if (is_permanent_variable(*first))
-		    first = &(*first)->next;
-		else
-		    delete_varnode(first, 1);
+	    for (i = 0; i < 2; i++) {
+		first = &named_vars[i][n];
+		while (*first) {
+		    if (is_permanent_variable(*first))
+			first = &(*first)->next;
+		    else
+			delete_varnode(first, i);
+		}
 	    }
 	}
+	statusline_forget();
 
 	for (n = 0; n < NUMVAR; n++) {
 	    *var[n].num = 0;
@@ -1323,6 +1422,79 @@ static void cmd_snoop(char *arg)
 	tcp_togglesnoop(arg);
 }
 
+static void cmd_status(char *arg)
+{
+    char *expr, *s;
+    int n = 0, attr = NOATTRCODE;
+
+    arg = skipspace(arg);
+    if (!*arg) {
+	PRINTF("#%s status lines defined%c\n", status_rows
+	       ? "the following" : "no", status_rows ? ':' : '.');
+	for (n = 1; n <= status_rows; n++)
+	    if ((s = statusline_get(n, &attr)))
+		tty_printf("#status %d%s%s=%s\n", n,
+			   attr == NOATTRCODE ? "" : " ",
+			   attr == NOATTRCODE ? "" : attr_name(attr), s);
+	return;
+    }
+    while (isdigit(*arg))
+	n = n * 10 + *arg++ - '0';
+    if (n < 1 || n > MAX_STATUS || (*arg && *arg != ' ' && *arg != '=')) {
+	PRINTF("#status: line number must be 1 to %d.\n", MAX_STATUS);
+	return;
+    }
+
+    expr = first_regular(arg, '=');
+    if (!*expr) {
+	/* no = : show the definition */
+	if (!(s = statusline_get(n, &attr))) {
+	    PRINTF("#status line %d is not defined.\n", n);
+	    return;
+	}
+	sprintf(inserted_next, "#status %d%s%.*s=%.*s", n,
+		attr == NOATTRCODE ? "" : " ", 80,
+		attr == NOATTRCODE ? "" : attr_name(attr), BUFSIZE - 100, s);
+	return;
+    }
+    *expr++ = '\0';
+    expr = skipspace(expr);
+
+    if (!*expr) {
+	if (statusline_get(n, NULL)) {
+	    statusline_define(n, NOATTRCODE, NULL);
+	    if (opt_info) {
+		PRINTF("#deleted status line %d.\n", n);
+	    }
+	} else {
+	    PRINTF("#status line %d is not defined.\n", n);
+	}
+	return;
+    }
+    if (*expr != '(') {
+	PRINTF("#status: ");
+	print_error(error=MISSING_PAREN_ERROR);
+	return;
+    }
+    arg = skipspace(arg);
+    if (*arg && (attr = parse_attributes(arg)) == -1) {
+	PRINTF("#attribute syntax error.\n");
+	if (opt_info)
+	    show_attr_syntax();
+	return;
+    }
+    if (statusline_define(n, attr, expr) < 0)
+	return;
+    if (!opt_split) {
+	opt_split = 1;
+	if (opt_info) {
+	    PRINTF("#option split is now on.\n");
+	}
+    } else if (opt_info) {
+	PRINTF("#status line %d defined.\n", n);
+    }
+}
+
 static void cmd_stop(char *arg)
 {
     delaynode *dying;
@@ -1391,8 +1563,11 @@ static void cmd_emulate(char *arg)
 	}
 	status(-1); /* we're pretending we got something from the MUD */
 	while (!error && (!start || i<=end) && fgets(buf, BUFSIZE, fp))
-	    if (!start || i++>=start)
+	    if (!start || i++>=start) {
+		flood_check(fileno(fp));
 		process_remote_input(buf, strlen(buf));
+	    }
+	flood_check(-1);
 
 	if (kind == '!') pclose(fp); else fclose(fp);
     } else {
@@ -1509,9 +1684,8 @@ static void cmd_print(char *arg)
 
 static void cmd_send(char *arg)
 {
-    char *newline, kind;
-    long start, end, i = 1;
-    FILE *fp;
+    char kind;
+    long start, end;
     ptr pbuf = (ptr)0;
 
     arg = redirect(arg, &pbuf, &kind, "send", 0, &start, &end);
@@ -1519,26 +1693,13 @@ static void cmd_send(char *arg)
 	return;
 
     if (kind) {
-	char buf[BUFSIZE];
-	fp = (kind == '!') ? popen(arg, "r") : fopen(arg, "r");
-	if (!fp) {
+	/* the file is sent a few lines at time from the main loop */
+	if (tcp_fd == -1) {
+	    PRINTF("#not connected to a MUD!\n");
+	} else if (tcp_stream_open(tcp_fd, arg, kind == '!', start, end) < 0) {
 	    PRINTF("#send: #error opening \"%s\"\n", arg);
 	    error = SYNTAX_ERROR;
-	    ptrdel(pbuf);
-	    return;
-	}
-	while (!error && (!start || i<=end) && fgets(buf, BUFSIZE, fp)) {
-	    if ((newline = strchr(buf, '\n')))
-		*newline = '\0';
-
-	    if (!start || i++>=start) {
-		if (opt_echo) {
-		    PRINTF("[%s]\n", buf);
-		}
-		tcp_write(tcp_fd, buf);
-	    }
 	}
-	if (kind == '!') pclose(fp); else fclose(fp);
     } else {
 	if (opt_echo) {
 	    PRINTF("[%s]\n", arg);
@@ -1820,6 +1981,7 @@ static void cmd_var(char *arg)
 		PRINTF("#cannot delete variable: \"%s\"\n", arg - 1);
 	    } else {
 		delete_varnode(p_named_var, kind);
+		statusline_forget();
 		if (opt_info) {
 		    PRINTF("#deleted variable: \"%s\"\n", arg - 1);
 		}
@@ -1918,11 +2080,13 @@ static void cmd_var(char *arg)
 	    print_error(error=NO_NUM_VALUE_ERROR);
 	}
 	*VAR[idx].num = len * type;
+	STATUSLINE_VAR(0, idx);
     }
     else {
 	*VAR[idx].str = ptrmcpy(*VAR[idx].str, arg, strlen(arg));
 	if (MEM_ERROR)
 	    print_error(error);
+	STATUSLINE_VAR(1, idx);
     }
     ptrdel(pbuf);
 }
@@ -2001,10 +2165,121 @@ static void cmd_setvar(char *arg)
 	    sprintf(inserted_next, "#setvar buffer=%d", log_getsize());
 	else
 	    log_resize(buf);
+    }
+    else if (i && !strncmp(name, "scrollback", i)) {
+	if (func == 0)
+	    sprintf(inserted_next, "#setvar scrollback=%d", scrollback_size);
+	else {
+	    if (buf == 0 || buf >= 4 * SB_BLOCK)
+		scrollback_resize(buf <= INT_MAX ? (int)buf : INT_MAX);
+	    else
+		PRINTF("#scrollback size must be 0 (zero) or >= %d\n", 4 * SB_BLOCK);
+	    if (opt_info) {
+		PRINTF("#setvar: scrollback=%d%s\n", scrollback_size,
+		       scrollback_size ? "" : " (none)");
+	    }
+	}
+    }
+    else if (i && !strncmp(name, "logsync", i)) {
+	if (func == 0)
+	    sprintf(inserted_next, "#setvar logsync=%d", log_sync);
+	else {
+	    if (buf >= 0)
+		log_sync = buf <= INT_MAX ? (int)buf : INT_MAX;
+	    if (opt_info) {
+		PRINTF("#setvar: logsync=%d%s\n", log_sync,
+		       log_sync ? "" : " (never)");
+	    }
+	}
+    }
+    else if (i && !strncmp(name, "logsize", i)) {
+	if (func == 0)
+	    sprintf(inserted_next, "#setvar logsize=%d", log_size);
+	else {
+	    if (buf == 0 || buf >= LOG_RING)
+		log_size = buf <= INT_MAX ? (int)buf : INT_MAX;
+	    else
+		PRINTF("#logsize must be 0 (zero) or >= %d\n", LOG_RING);
+	    if (opt_info) {
+		PRINTF("#setvar: logsize=%d%s\n", log_size,
+		       log_size ? "" : " (no limit)");
+	    }
+	}
+    }
+    else if (i && !strncmp(name, "logtime", i)) {
+	if (func == 0)
+	    sprintf(inserted_next, "#setvar logtime=%d", log_time);
+	else {
+	    if (buf >= 0)
+		log_time = buf <= INT_MAX ? (int)buf : INT_MAX;
+	    if (opt_info) {
+		PRINTF("#setvar: logtime=%d%s\n", log_time,
+		       log_time ? "" : " (no limit)");
+	    }
+	}
+    }
+    else if (i && !strncmp(name, "logzip", i)) {
+	if (func == 0)
+	    sprintf(inserted_next, "#setvar logzip=%d", log_zip);
+	else {
+	    log_zip = buf != 0;
+	    if (opt_info) {
+		PRINTF("#setvar: logzip=%d%s\n", log_zip,
+		       log_zip ? "" : " (no compression)");
+	    }
+	}
+    }
+    else if (i && !strncmp(name, "sendrate", i)) {
+	if (func == 0)
+	    sprintf(inserted_next, "#setvar sendrate=%d", send_rate);
+	else {
+	    if (buf >= 0)
+		send_rate = buf <= INT_MAX ? (int)buf : INT_MAX;
+	    if (opt_info) {
+		PRINTF("#setvar: sendrate=%d%s\n", send_rate,
+		       send_rate ? "" : " (unlimited)");
+	    }
+	}
+    }
+    else if (i && !strncmp(name, "maxline", i)) {
+	if (func == 0)
+	    sprintf(inserted_next, "#setvar maxline=%d", max_line);
+	else {
+	    if (buf == 0 || buf >= BUFSIZE)
+		max_line = buf <= INT_MAX ? (int)buf : INT_MAX;
+	    if (opt_info) {
+		PRINTF("#setvar: maxline=%d%s\n", max_line,
+		       max_line ? "" : " (unlimited)");
+	    }
+	}
+    }
+    else if (i && !strncmp(name, "flood", i)) {
+	if (func == 0)
+	    sprintf(inserted_next, "#setvar flood=%d", flood_limit);
+	else {
+	    if (buf >= 0)
+		flood_limit = buf <= INT_MAX ? (int)buf : INT_MAX;
+	    if (opt_info) {
+		PRINTF("#setvar: flood=%d%s\n", flood_limit,
+		       flood_limit ? "" : " (never)");
+	    }
+	}
+    }
+    else if (i && !strncmp(name, "partial", i)) {
+	if (func == 0)
+	    sprintf(inserted_next, "#setvar partial=%d", partial_timeout);
+	else {
+	    if (buf >= 0)
+		partial_timeout = buf <= INT_MAX ? (int)buf : INT_MAX;
+	    if (opt_info) {
+		PRINTF("#setvar: partial=%d%s\n", partial_timeout,
+		       partial_timeout ? "" : " (no wait)");
+	    }
+	}
     } else {
 	update_now();
-	PRINTF("#setvar buffer=%d\n#setvar lines=%d\n#setvar mem=%d\n#setvar timer=%ld\n",
-	       log_getsize(), lines, limit_mem, diff_vtime(&now, &ref_time));
+	PRINTF("#setvar buffer=%d\n#setvar flood=%d\n#setvar lines=%d\n#setvar logsize=%d\n#setvar logsync=%d\n#setvar logtime=%d\n#setvar logzip=%d\n#setvar maxline=%d\n#setvar mem=%d\n#setvar partial=%d\n#setvar scrollback=%d\n#setvar sendrate=%d\n#setvar timer=%ld\n",
+	       log_getsize(), flood_limit, lines, log_size, log_sync, log_time, log_zip, max_line, limit_mem, partial_timeout, scrollback_size, send_rate, diff_vtime(&now, &ref_time));
     }
 }
 
@@ -2152,15 +2427,171 @@ static void cmd_while(char *arg)
 	pop_params();
 }
 
+/*
+ * "#capture flush" and friends: write everything to disk now
+ */
+static void log_flushfile(char *cmd, logfile *lf)
+{
+    unsigned long dropped;
+
+    log_flush();
+    logfile_flush();
+    if (opt_info) {
+	dropped = logfile_dropped(lf);
+	PRINTF("#%s to \"%s\" written", cmd, logfile_name(lf));
+	if (dropped)
+	    PRINTF(", %lu record%s dropped", dropped, dropped == 1 ? "" : "s");
+	PRINTF(".\n");
+    }
+}
+
+/* close a #capture, #movie or #record file */
+static void log_closefile(char *cmd, logfile **lf)
+{
+    unsigned long dropped = logfile_dropped(*lf);
+
+    logfile_close(*lf);
+    *lf = NULL;
+    if (dropped) {
+	PRINTF("#%s: %lu record%s dropped, the disk was too slow.\n",
+	       cmd, dropped, dropped == 1 ? "" : "s");
+    }
+}
+
+/*
+ * parse [[hours:]minutes:]seconds into millisecs, -1 if not valid
+ */
+static long long parse_ago(char **arg)
+{
+    long long t = 0;
+    char *p = *arg;
+
+    for (;;) {
+	if (!isdigit((unsigned char)*p))
+	    return -1;
+	t = t * 60 + strtol(p, &p, 10);
+	if (*p != ':')
+	    break;
+	p++;
+    }
+    *arg = p;
+    return t * 1000;
+}
+
+/*
+ * "#capture @[from][,to] [>]file": write the lines in the #setvar buffer
+ * received from `from' to `to' ago in file, once
+ */
+static void capture_range(char *arg)
+{
+    long long from = -1, to = 0;
+    logfile *lf;
+    int append = 0, n;
+
+    if (*arg && *arg != ',' && *arg != ' ' && (from = parse_ago(&arg)) < 0) {
+	PRINTF("#capture: bad time, use @[[hours:]minutes:]seconds\n");
+	return;
+    }
+    if (*arg == ',' && (arg++, (to = parse_ago(&arg)) < 0)) {
+	PRINTF("#capture: bad time, use @from,to\n");
+	return;
+    }
+    if (from < 0)
+	from = LLONG_MAX;
+    arg = skipspace(arg);
+    if (!*arg) {
+	PRINTF("#capture to what file?\n");
+	return;
+    }
+    if (!log_getsize()) {
+	PRINTF("#capture: no buffer to write, see #setvar buffer\n");
+	return;
+    }
+    if (*arg == '>') {
+	arg++;
+	append = 1;
+    }
+    if ((lf = logfile_open(arg, append)) == NULL) {
+	PRINTF("#error writing file \"%s\"\n", arg);
+	return;
+    }
+    n = log_dump(lf, from, to);
+    logfile_close(lf);
+    if (opt_info) {
+	PRINTF("#capture: %d line%s written to \"%s\".\n",
+	       n, n == 1 ? "" : "s", arg);
+    }
+}
+
+/*
+ * "#capture ##id [[>]file|flush]" and "#movie ##id [file|flush]":
+ * what connection id receives and is sent, alone in its own file
+ */
+static void conn_logfile(char *cmd, char *arg, int movie)
+{
+    char id[BUFSIZE];
+    logstream *s;
+    logfile **lf;
+    int fd, append = 0;
+
+    arg = skipspace(split_first_word(id, BUFSIZE, arg + 2));
+    if ((fd = tcp_find(id)) < 0) {
+	PRINTF("#no connection named \"%s\"\n", id);
+	return;
+    }
+    if (!(s = log_conn(fd)))
+	return;
+    lf = movie ? &s->movie : &s->capture;
+
+    if (!*arg) {
+	if (*lf) {
+	    if (movie)
+		log_conn_movie_end(s);
+	    log_closefile(cmd, lf);
+	    if (opt_info) {
+		PRINTF("#end of %s of \"%s\" to file.\n", cmd, id);
+	    }
+	} else
+	    PRINTF("#%s of \"%s\" to what file?\n", cmd, id);
+    } else if (*lf) {
+	if (!strcmp(arg, "flush"))
+	    log_flushfile(cmd, *lf);
+	else
+	    PRINTF("#%s of \"%s\" already active.\n", cmd, id);
+    } else {
+	if (!movie && *arg == '>') {
+	    arg++;
+	    append = 1;
+	}
+	if ((*lf = logfile_open(arg, append)) == NULL) {
+	    PRINTF("#error writing file \"%s\"\n", arg);
+	    return;
+	}
+	if (movie)
+	    log_conn_movie_begin(s, movie_binary_name(arg));
+	if (opt_info) {
+	    PRINTF("#%s of \"%s\" to \"%s\" active, \"#%s ##%s\" ends.\n",
+		   cmd, id, arg, cmd, id);
+	}
+    }
+}
+
 static void cmd_capture(char *arg)
 {
     arg = skipspace(arg);
 
+    if (*arg == '@') {
+	capture_range(arg + 1);
+	return;
+    }
+    if (arg[0] == '#' && arg[1] == '#') {
+	conn_logfile("capture", arg, 0);
+	return;
+    }
     if (!*arg) {
         if (capturefile) {
 	    log_flush();
-            fclose(capturefile);
-            capturefile = NULL;
+	    log_closefile("capture", &capturefile);
             if (opt_info) {
 		PRINTF("#end of capture to file.\n");
             }
@@ -2169,7 +2600,10 @@ static void cmd_capture(char *arg)
         }
     } else {
         if (capturefile) {
-            PRINTF("#capture already active.\n");
+	    if (!strcmp(arg, "flush"))
+		log_flushfile("capture", capturefile);
+	    else
+		PRINTF("#capture already active.\n");
         } else {
 	    short append = 0;
 	    /* Append to log file, if the name starts with '>' */
@@ -2177,7 +2611,7 @@ static void cmd_capture(char *arg)
 		    arg++;
 		    append = 1;
 	    }
-            if ((capturefile = fopen(arg, (append) ? "a" : "w")) == NULL) {
+            if ((capturefile = logfile_open(arg, append)) == NULL) {
                 PRINTF("#error writing file \"%s\"\n", arg);
             } else if (opt_info) {
                 PRINTF("#capture to \"%s\" active, \"#capture\" ends.\n", arg);
@@ -2186,15 +2620,63 @@ static void cmd_capture(char *arg)
     }
 }
 
+/*
+ * "#search [-i] [-e] [-N] [-m max] [##id] text": show the last lines
+ * received containing text, ignoring case with -i, with N lines
+ * of context around them, or process them again with -e
+ */
+static void cmd_search(char *arg)
+{
+    char *id = NULL;
+    int icase = 0, emulate = 0, context = 0, max = SB_MATCHES;
+
+    for (arg = skipspace(arg); *arg == '-' && arg[1] && arg[1] != ' '; arg = skipspace(arg)) {
+	if (arg[1] == 'i')
+	    icase = 1, arg += 2;
+	else if (arg[1] == 'e')
+	    emulate = 1, arg += 2;
+	else if (isdigit(arg[1]))
+	    context = (int)strtol(arg + 1, &arg, 10);
+	else if (arg[1] == 'm' && (arg = skipspace(arg + 2), isdigit(*arg)))
+	    max = (int)strtol(arg, &arg, 10);
+	else
+	    break;
+	if (*arg && *arg != ' ') {
+	    PRINTF("#search: bad option, use [-i][-e][-N][-m max][##id] text\n");
+	    return;
+	}
+    }
+    if (arg[0] == '#' && arg[1] == '#' && arg[2]) {
+	id = arg += 2;
+	while (*arg && *arg != ' ')
+	    arg++;
+	if (*arg)
+	    *arg++ = '\0';
+	arg = skipspace(arg);
+    }
+    if (!*arg) {
+	PRINTF("#search what?\n");
+	return;
+    }
+    if (max <= 0)
+	max = 1;
+    scrollback_search(arg, id, icase, context, max, emulate);
+}
+
 static void cmd_movie(char *arg)
 {
     arg = skipspace(arg);
 
+    if (arg[0] == '#' && arg[1] == '#') {
+	conn_logfile("movie", arg, 1);
+	return;
+    }
+
     if (!*arg) {
         if (moviefile) {
 	    log_flush();
-            fclose(moviefile);
-            moviefile = NULL;
+	    log_movie_end();
+	    log_closefile("movie", &moviefile);
             if (opt_info) {
 		PRINTF("#end of movie to file.\n");
             }
@@ -2203,11 +2685,15 @@ static void cmd_movie(char *arg)
         }
     } else {
         if (moviefile) {
-            PRINTF("#movie already active.\n");
+	    if (!strcmp(arg, "flush"))
+		log_flushfile("movie", moviefile);
+	    else
+		PRINTF("#movie already active.\n");
         } else {
-            if ((moviefile = fopen(arg, "w")) == NULL) {
+            if ((moviefile = logfile_open(arg, 0)) == NULL) {
                 PRINTF("#error writing file \"%s\"\n", arg);
             } else {
+		log_movie_begin(movie_binary_name(arg));
 		if (opt_info) {
 		    PRINTF("#movie to \"%s\" active, \"#movie\" ends.\n", arg);
 		}
@@ -2225,8 +2711,7 @@ static void cmd_record(char *arg)
 
     if (!*arg) {
         if (recordfile) {
-            fclose(recordfile);
-            recordfile = NULL;
+	    log_closefile("record", &recordfile);
             if (opt_info) {
 		PRINTF("#end of record to file.\n");
             }
@@ -2235,9 +2720,12 @@ static void cmd_record(char *arg)
         }
     } else {
         if (recordfile) {
-            PRINTF("#record already active.\n");
+	    if (!strcmp(arg, "flush"))
+		log_flushfile("record", recordfile);
+	    else
+		PRINTF("#record already active.\n");
         } else {
-            if ((recordfile = fopen(arg, "w")) == NULL) {
+            if ((recordfile = logfile_open(arg, 0)) == NULL) {
                 PRINTF("#error writing file \"%s\"\n", arg);
             } else if (opt_info) {
                 PRINTF("#record to \"%s\" active, \"#record\" ends.\n", arg);
@@ -2263,7 +2751,11 @@ static void cmd_cancel(char *arg)
 {
     editsess *sp;
 
-    if (!edit_sess) {
+    if (!strcmp(arg = skipspace(arg), "send")) {
+	if (tcp_fd == -1 || !tcp_stream_cancel(tcp_fd)) {
+	    PRINTF("#no #send in progress.\n");
+	}
+    } else if (!edit_sess) {
         PRINTF("#no editing sessions to cancel.\n");
     } else {
         if (*arg) {
@@ -2469,12 +2961,20 @@ static const struct {
       "print information about command effects" },
     { "keyecho",   &opt_keyecho,
       "print command bound to key when executed" },
+    { "mudwords",  &opt_mudwords,
+      "complete also words seen in MUD output" },
+    { "paste",     &opt_paste,
+      "insert pasted text at once (bracketed paste)" },
     { "reprint",   &opt_reprint,
       "reprint sent commands when getting new prompt" },
+    { "sendpaste", &opt_sendpaste,
+      "send pasted lines through the send queue" },
     { "sendsize",  &opt_sendsize,
       "send terminal size when opening connection" },
     { "speedwalk", &opt_speedwalk,
       "enable speed walking (ness3ew...)" },
+    { "split",     &opt_split,
+      "keep prompt and input line below a scroll region" },
     { "words",     &opt_words,
       "also save word history" },
     { "wrap",      &opt_wrap,
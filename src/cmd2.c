@@ -865,6 +865,8 @@ char *attr_name(int attrcode)
 
     if (!*name)
 	strcpy(name, "none");
+    else if (name[strlen(name) - 1] == ' ')
+	name[strlen(name) - 1] = '\0';
 
     return name;
 }
@@ -1524,6 +1526,7 @@ void parse_rebind(char *arg)
 	free(*old);
     *old = (char *)malloc((*kp)->seqlen = seqlen);
     memmove(*old, seq, seqlen);
+    keytrie_gen++;
 
     if (opt_info)
 	show_single_bind("redefined key:", *kp);
@@ -61,6 +61,9 @@
 #define SPECIAL_CHARS	"{}();\"=" /* specials chars needing escape */
 #define MPI		"~$#E"	/* MUME protocol introducer */
 #define MPILEN		4	/* strlen(MPI) */
+#define PASTE_BEGIN	"\033[200~" /* sent by terminal before pasted text */
+#define PASTE_END	"\033[201~" /* ... and after it */
+#define PASTE_LEN	6	/* strlen(PASTE_BEGIN) */
 
 #ifdef NR_OPEN
 # define MAX_FDSCAN	NR_OPEN
@@ -75,7 +78,10 @@
 #define PARAMLEN	99	/* initial length of text strings */
 #define MAX_MAPLEN	1000	/* maximum length of automapped path */
 #define MIN_WORDLEN	3	/* the minimum length for history words */
-#define MAX_WORDS	4096	/* number of words kept for TAB-completion */
+#define MAX_WORDS	4096	/* number of words typed and of words seen
+				 * in MUD output kept for TAB-completion */
+#define MAX_SEENLEN	32	/* longest word taken from MUD output */
+#define WORD_HASH	8192	/* hash size of completion words, power of 2 */
 #define MAX_HIST	2048	/* number of history lines kept */
 #define LOG_MAX_HASH	7
 #define MAX_HASH	(1<<LOG_MAX_HASH) /* max hash value, must be a power of 2 */
@@ -83,11 +89,33 @@
 				 * (hardcoded, don't change) */
 #define NUMVAR		50	/* number of global unnamed variables */
 #define NUMTOT		(NUMVAR+NUMPARAM)
+#define MAX_PERMANENT_VARS 16	/* max number of variables that cannot
+				 * be deleted ($prompt, @queue_depth...) */
+#define MAX_STATUS	4	/* max number of #status lines */
+#define MAX_STATUS_DEPS	8	/* variables tracked for each #status line */
 #define MAX_SUBOPT	256	/* max length of suboption string */
 #define MAX_ARGS	16	/* max number of arguments to editor */
 #define FLASHDELAY	500	/* time of parentheses flash in millisecs */
 #define KBD_TIMEOUT	100	/* timeout for keyboard read in millisecs;
 				 * hope it's enough also for very slow lines */
+#define PARTIAL_TIMEOUT	50	/* default millisecs to wait for the rest of
+				 * an incomplete line before processing it */
+#define MAX_LINE_LEN	(4*1024*1024) /* default longest line kept in one piece */
+#define PARTIAL_KEEP	(16*BUFSIZE) /* free bigger line buffers when empty */
+#define FLOOD_TAIL	64	/* max lines kept to show at the end of a flood */
+#define FLOOD_SHOW	1000	/* millisecs between snapshots during a flood */
+#define STREAM_CHUNK	256	/* max lines sent by #send <file each time
+				 * through the main loop */
+#define LOG_RING	(1<<20)	/* bytes of #capture, #movie or #record output
+				 * waiting to be written, must be a power of 2 */
+#define LOG_ZBLOCK	65536	/* max bytes of compressed output lost if
+				 * powwow crashes */
+#define LOG_ZIDLE	1000	/* millisecs of quiet before compressed
+				 * output is flushed anyway */
+#define SB_BLOCK	65536	/* bytes of #setvar scrollback compressed
+				 * together */
+#define SB_BLOOM	32768	/* bits of trigram filter per block */
+#define SB_MATCHES	100	/* default max lines shown by #search */
 
 #define MAX_STACK	100	/* maximum number of nested
                                  * action, alias, #for or #while */
@@ -299,6 +327,9 @@ typedef struct {		/* pointers to all variables */
     ptr  *str;
 } vars;
 
+/* a #capture, #movie or #record file, see logfile.c */
+typedef struct logfile logfile;
+
 /* editing session control */
 typedef struct editsess {
     struct editsess *next;
@@ -29,17 +29,31 @@
 #include "tty.h"
 #include "eval.h"
 #include "log.h"
+#include "list.h"
+#include "cmd2.h"
+#include "history.h"
+#include "logfile.h"
 
 static void insert_string(char *arg);
+static void search_type(char *s, int n);
+static void search_erase(void);
 
 /* history buffer */
 char *hist[MAX_HIST];	/* saved history lines */
 int curline = 0;	/* current history line */
 int pickline = 0;	/* line to pick history from */
+char pasting = 0;	/* 1 while reading a bracketed paste */
+static ptr paste_buf;	/* the paste read so far */
 
 /* word completion list */
-wordnode words[MAX_WORDS];
-int wordindex = 0;
+wordnode *words;
+int word_last[2] = { -1, -1 };	/* least recent typed and seen word */
+static int word_first[2] = { -1, -1 }, word_count[2];
+static int word_size, word_free = -1;
+static unsigned word_stamp;
+static int whash[WORD_HASH];	/* chains of words with the same hash */
+static int *wsorted;		/* all words, sorted ignoring case */
+static int wsorted_count, wsorted_size;
 
 edit_function internal_functions[] = {
     {(char *)0, (function_str)0, },
@@ -69,6 +83,8 @@ edit_function internal_functions[] = {
     {"&downcase-word", downcase_word, },
     {"&next-word", next_word, },
     {"&insert-string", insert_string, },
+    {"&reverse-search", reverse_search, },
+    {"&cancel-search", cancel_search, },
     {(char *)0, (function_str)0 }
 };
 
@@ -108,6 +124,20 @@ int lookup_edit_function(function_str funct)
     return 0;
 }
 
+/*
+ * What the input line looks like on screen after clear_input_lazy():
+ * the text is still there, so draw_input_line() can rewrite
+ * only the cells that changed instead of erasing and redrawing everything.
+ */
+static struct {
+    char pending;		/* 1 if the text below is still on screen */
+    char text[BUFSIZE];		/* input line as shown on screen */
+    int len;			/* its length */
+    int pos;			/* cursor position in it */
+    int col0, line0;		/* where it starts */
+    int lines, cols;		/* screen size when it was drawn */
+} shown;
+
 /* return pointer to any unterminated escape code at the end of s */
 static char *find_partial_esc(char *s)
 {
@@ -123,6 +153,85 @@ static char *find_partial_esc(char *s)
     return NULL;
 }
 
+/*
+ * Split screen (#option split): MUD output scrolls in a terminal scroll
+ * region, prompt and input line live on the split_rows lines below it.
+ * Output is printed by jumping into the region (see split_to_output())
+ * and back, so what is below the region is redrawn only when it changes,
+ * and then only from the first cell that changed (see draw_row_diff()).
+ */
+int split_rows;			/* lines below the scroll region, 0 if none */
+static char split_out;		/* 1 if the cursor is in the scroll region */
+static char split_prompt;	/* 1 if a prompt is shown below it */
+static int split_col0;		/* where the input line starts there,
+				 * -1 to force a full redraw */
+static ptr split_pstr;		/* copy of the prompt shown there */
+static ptr split_pmarked;	/* and the text printed for it */
+
+/*
+ * Status lines (#status): the first status_shown of the split_rows lines
+ * below the scroll region show the result of an expression each.
+ * A line is evaluated again only when a named variable used in it
+ * changes (see statusline_var()), and redrawn only if its text changed.
+ */
+typedef struct {
+    char *expr;			/* "(expression)", NULL if not defined */
+    int attrcode;
+    char dirty;			/* 1 if it must be evaluated again */
+    char drawn;			/* 1 if text is what is on screen */
+    int ndeps;			/* variables in deps[], -1 if not looked up,
+				 * > MAX_STATUS_DEPS if any change counts */
+    int deps[MAX_STATUS_DEPS];	/* 2 * index, plus 1 for $variables */
+    ptr text;			/* last result */
+    ptr shown;			/* what of it was printed last time */
+    char kept;			/* 1 if shown is still on screen */
+} statusline;
+
+static statusline stlines[MAX_STATUS];
+int status_rows;		/* number of the last defined status line */
+static int status_shown;	/* status lines below the scroll region */
+static char status_dirty;	/* 1 if some status line is dirty */
+
+static void erase_input_line(int deleteprompt);
+static void split_to_output(int deleteprompt);
+static void split_resize(int rows);
+static int  status_fit(void);
+static void statusline_eval(void);
+static int  statusline_draw(void);
+static int  draw_row_diff(char *old, int olen, char *new, int nlen, int line,
+			  char *begin, char *end, int clear);
+
+/* print marked_prompt, without any unterminated escape code at its end */
+static void put_marked_prompt(void)
+{
+    char *pstr = ptrdata(marked_prompt), *esc = find_partial_esc(pstr);
+
+    if (esc)
+	*esc = 0;
+    tty_puts(pstr);
+    col0 = printstrlen(pstr);
+    if (esc)
+	*esc = '\033';
+}
+
+/*
+ * remember the prompt just printed below the scroll region
+ */
+static void split_keep_prompt(void)
+{
+    char *esc;
+
+    split_pstr = ptrcpy(split_pstr, prompt->str);
+    split_pmarked = ptrcpy(split_pmarked, marked_prompt);
+    if (MEM_ERROR) { errmsg("malloc(prompt)"); split_col0 = -1; }
+    else {
+	split_col0 = col0;
+	if ((esc = find_partial_esc(ptrdata(split_pmarked))))
+	    ptrtrunc(split_pmarked, esc - ptrdata(split_pmarked));
+    }
+    split_prompt = 1;
+}
+
 /*
  * redisplay the prompt
  * assume cursor is at beginning of line
@@ -130,23 +239,15 @@ static char *find_partial_esc(char *s)
 void draw_prompt(void)
 {
     if (promptlen && prompt_status == 1) {
-        char *esc, *pstr;
 	int e = error;
 	error = 0;
 	marked_prompt = ptraddsubst_and_marks(marked_prompt, prompt->str);
 	if (MEM_ERROR) { promptzero(); errmsg("malloc(prompt)"); return; }
 
-        /* if prompt ends in unterminated escape code, do not print
-         * that part */
-        pstr = ptrdata(marked_prompt);
-        esc = find_partial_esc(pstr);
-        if (esc)
-            *esc = 0;
-        tty_puts(pstr);
-	col0 = printstrlen(pstr);
-        if (esc)
-            *esc = '\033';
+	put_marked_prompt();
 
+	if (split_rows && !split_out)
+	    split_keep_prompt();
 	error = e;
     }
     prompt_status = 0;
@@ -160,14 +261,29 @@ void draw_prompt(void)
  * do not print edattrbeg now.
  */
 void clear_input_line(int deleteprompt)
+{
+    if (split_rows)
+	split_to_output(deleteprompt);
+    else
+	erase_input_line(deleteprompt);
+}
+
+/*
+ * really erase the input line from screen, see clear_input_line()
+ */
+static void erase_input_line(int deleteprompt)
 {
     /*
      * be careful: if prompt and/or input line have been erased from screen,
      * pos will be different from the actual cursor position
      */
-    if ((edlen && line_status == 0) || (promptlen && prompt_status == 0 && deleteprompt)) {
+    int lazy = line_status != 0 && shown.pending;
+
+    shown.pending = 0;
+    if ((edlen && line_status == 0) || lazy || (promptlen && prompt_status == 0 && deleteprompt)) {
 	int newcol = deleteprompt ? 0 : col0;
-	int realpos = line_status == 0 ? pos : (prompt_status == 0 ? 0 : -col0);
+	int realpos = line_status == 0 ? pos : lazy ? shown.pos :
+	    (prompt_status == 0 ? 0 : -col0);
 
 	tty_gotoxy_opt(CURCOL(realpos), CURLINE(realpos), newcol, line0);
 	tty_puts(edattrend);
@@ -185,6 +301,81 @@ void clear_input_line(int deleteprompt)
 	line_status = 1;
 }
 
+/*
+ * like clear_input_line(0), used when the input line is about to be
+ * replaced: leave it on screen until draw_input_line(),
+ * which will then overwrite only the cells that changed
+ */
+static void clear_input_lazy(void)
+{
+    if (line_status != 0 || (linemode & LM_NOECHO)) {
+	clear_input_line(0);
+	return;
+    }
+    memcpy(shown.text, edbuf, edlen);
+    shown.len = edlen;
+    shown.pos = pos;
+    shown.col0 = col0;
+    shown.line0 = line0;
+    shown.lines = lines;
+    shown.cols = cols;
+    shown.pending = 1;
+    line_status = 1;
+}
+
+/*
+ * redraw the input line over the old one still on screen
+ * (see clear_input_lazy), emitting only the cells that changed.
+ * return 0 if not possible.
+ */
+static int draw_input_diff(void)
+{
+    int d, e, i, n, col, line;
+
+    if (!shown.pending || shown.col0 != col0 || shown.line0 != line0 ||
+	shown.lines != lines || shown.cols != cols ||
+	CURLINE(edlen) > lines - 1)
+	return 0;	/* moved, or would need to scroll */
+#ifdef BUG_ANSI
+    if (edattrbg)
+	return 0;
+#endif
+    shown.pending = 0;
+
+    /* skip common head, and common tail if length is unchanged */
+    for (d = 0; d < shown.len && d < edlen && shown.text[d] == edbuf[d]; d++)
+	;
+    e = edlen;
+    if (shown.len == edlen)
+	while (e > d && shown.text[e - 1] == edbuf[e - 1])
+	    e--;
+
+    /* the cursor is where it was left */
+    col = CURCOL(shown.pos);
+    line = CURLINE(shown.pos);
+
+    tty_puts(edattrbeg);
+    for (i = d; i < e; i += n) {
+	if ((n = cols_1 - CURCOL(i)) > e - i)
+	    n = e - i;
+	tty_gotoxy_opt(col, line, CURCOL(i), CURLINE(i));
+	tty_putsn(edbuf + i, n);
+	col = CURCOL(i) + n;
+	line = CURLINE(i);
+    }
+    if (shown.len > edlen) {
+	tty_gotoxy_opt(col, line, CURCOL(edlen), CURLINE(edlen));
+	col = CURCOL(edlen);
+	line = CURLINE(edlen);
+	tty_printf("%s%s%s", edattrend,
+		   CURLINE(shown.len) > line ? tty_clreoscr : tty_clreoln,
+		   edattrbeg);
+    }
+    tty_gotoxy_opt(col, line, CURCOL(pos), CURLINE(pos));
+    line_status = 0;
+    return 1;
+}
+
 /*
  * clear input line, but do nothing else
  */
@@ -192,7 +383,7 @@ void clear_line(char *dummy)
 {
     if (!edlen)
 	return;
-    clear_input_line(0);
+    clear_input_lazy();
     pickline = curline;
     *edbuf = '\0';
     pos = edlen = 0;
@@ -209,6 +400,13 @@ void draw_input_line(void)
     if (line_status == 0 || linemode & LM_NOECHO)
 	return;
 
+    if (draw_input_diff())
+	return;
+    if (shown.pending)
+	erase_input_line(0);
+    if (split_rows)
+	split_fit();
+
     tty_puts(edattrbeg);
 
     if (edlen) {
@@ -238,11 +436,668 @@ void draw_input_line(void)
     line_status = 0;
 }
 
+/*
+ * move the cursor into the scroll region, leaving prompt and input line
+ * where they are. Like clear_input_line() without split screen,
+ * the prompt is copied there unless deleteprompt != 0.
+ */
+static void split_to_output(int deleteprompt)
+{
+    if (!split_out) {
+	if (line_status == 0 && !(linemode & LM_NOECHO))
+	    clear_input_lazy();
+	tty_puts(edattrend);
+	tty_restore_cursor(0);
+	split_out = 1;
+	if (!deleteprompt && split_prompt && prompt_status == 0 &&
+	    col0 == split_col0)
+	    put_marked_prompt();
+	else
+	    col0 = 0;
+    } else
+	tty_puts(edattrend);
+
+    if (deleteprompt) {
+	col0 = 0;
+	status(1);
+    } else
+	line_status = 1;
+}
+
+/*
+ * if the input line does not fit below the scroll region, shrink the region.
+ * The cursor is left at the beginning of the input line.
+ * Return 1 if the region was changed.
+ */
+int split_fit(void)
+{
+    int rows = status_shown + (col0 + edlen) / cols_1 + 1;
+
+    if (rows <= split_rows || split_rows >= lines - 1)
+	return 0;
+    split_resize(rows);
+    tty_gotoxy(col0, line0);
+    return 1;
+}
+
+/*
+ * leave rows lines below the scroll region. The cursor position is lost.
+ */
+static void split_resize(int rows)
+{
+    int n;
+
+    if (rows > lines - 1)
+	rows = lines - 1;
+    if (rows < status_shown + 1)
+	rows = status_shown + 1;
+    if (!(n = rows - split_rows))
+	return;
+
+    tty_puts(edattrend);
+    if (n > 0) {
+	/* scroll everything up, what is below the region moves with it */
+	tty_set_region(0);
+	tty_gotoxy(0, lines - 1);
+	for (; n; n--)
+	    tty_putc('\n');
+	n = rows - split_rows;
+    } else {
+	/* the region gets some blank lines at its bottom */
+	tty_gotoxy(0, lines - split_rows);
+	tty_puts(tty_clreoscr);
+	for (n = 0; n < status_shown; n++)
+	    stlines[n].drawn = stlines[n].kept = 0;
+	n = 0;
+    }
+    split_rows = rows;
+    line0 = lines - rows + status_shown;
+    tty_set_region(lines - rows);
+    tty_restore_cursor(n);
+    tty_save_cursor();
+}
+
+/*
+ * a new prompt replaces the one below the scroll region: rewrite only
+ * the cells that changed, and the input line only if it moved.
+ * Return 0 if it must all be drawn again.
+ */
+static int split_prompt_diff(void)
+{
+    char *pstr, *esc;
+    int len, w, col, e = error;
+
+    error = 0;
+    marked_prompt = ptraddsubst_and_marks(marked_prompt, prompt->str);
+    if (MEM_ERROR) { promptzero(); errmsg("malloc(prompt)"); error = e; return 0; }
+    error = e;
+    pstr = ptrdata(marked_prompt);
+    len = (esc = find_partial_esc(pstr)) ? esc - pstr : ptrlen(marked_prompt);
+    w = printstrlen(pstr);
+    if (w >= cols_1 || split_col0 >= cols_1 ||
+	(w + edlen) / cols_1 + 1 != split_rows - status_shown)
+	return 0;	/* wraps, or the region must be resized */
+
+    statusline_draw();
+    col = draw_row_diff(ptrdata(split_pmarked), ptrlen(split_pmarked),
+			pstr, len, line0, "", "", 0);
+    col0 = w;
+    if (w == split_col0 && shown.pending) {
+	if (col < 0)
+	    tty_gotoxy(CURCOL(shown.pos), CURLINE(shown.pos));
+	else
+	    tty_gotoxy_opt(col, line0, CURCOL(shown.pos), CURLINE(shown.pos));
+    } else {
+	/* the input line moves with the end of the prompt */
+	if (col != w)
+	    tty_gotoxy(col0, line0);
+	tty_puts(tty_clreoscr);
+	shown.pending = 0;
+    }
+    split_keep_prompt();
+    prompt_status = 0;
+    return 1;
+}
+
+/*
+ * move the cursor back from the scroll region to the input line,
+ * redrawing what is below the region if needed.
+ */
+static void split_to_input(void)
+{
+    int i, keep, same, fit = status_fit();
+
+    tty_save_cursor();
+    split_out = 0;
+    line0 = lines - split_rows + status_shown;
+
+    if (prompt_status == 1) {
+	keep = promptlen > 0;
+	same = keep ? split_prompt && !strcmp(ptrdata(prompt->str), ptrdata(split_pstr))
+	    : !split_prompt;
+    } else if (prompt_status == 0) {
+	same = col0 == split_col0;
+	keep = split_prompt && same;
+    } else
+	keep = 0, same = !split_prompt;
+
+    if (same && split_col0 >= 0 && status_shown == fit &&
+	(split_col0 + edlen) / cols_1 + 1 >= split_rows - status_shown) {
+	/* prompt is unchanged, update only the input line */
+	statusline_draw();
+	if (prompt_status == 1)
+	    prompt_status = 0;
+	col0 = split_col0;
+	if (shown.pending)
+	    tty_gotoxy(CURCOL(shown.pos), CURLINE(shown.pos));
+	else {
+	    tty_gotoxy(col0, line0);
+	    tty_puts(tty_clreoscr);
+	}
+	line_status = 1;
+	return;
+    }
+    if (keep && prompt_status == 1 && split_prompt && split_pmarked &&
+	split_col0 >= 0 && status_shown == fit && split_prompt_diff()) {
+	line_status = 1;
+	return;
+    }
+
+    col0 = keep ? printstrlen(ptrdata(prompt->str)) : 0;
+    if (status_shown != fit) {
+	/* status lines move, draw them again */
+	if (fit < status_shown) {
+	    tty_gotoxy(0, lines - split_rows);
+	    tty_puts(tty_clreoscr);
+	}
+	status_shown = fit;
+	line0 = lines - split_rows + fit;
+	for (i = 0; i < fit; i++)
+	    stlines[i].drawn = stlines[i].kept = 0;
+    }
+    split_resize(status_shown + (col0 + edlen) / cols_1 + 1);
+    statusline_draw();
+    tty_gotoxy(0, line0);
+    tty_puts(tty_clreoscr);
+    shown.pending = split_prompt = 0;
+    split_col0 = col0 = 0;
+    if (keep)
+	prompt_status = 1;
+    line_status = 1;
+}
+
+/*
+ * start split screen: the input line moves to the bottom of the screen,
+ * all the lines above it become the scroll region.
+ */
+static void split_start(void)
+{
+    erase_input_line(1);
+    if (line0 > lines - 2) {
+	tty_putc('\n');
+	line0 = lines - 2;
+    }
+    if (lines < 3 || !tty_set_region(lines - 1)) {
+	opt_split = 0;
+	PRINTF("#option split: this terminal cannot set a scroll region.\n");
+	if (line0 < lines - 1)
+	    line0++;
+	return;
+    }
+    tty_gotoxy(0, line0);
+    tty_save_cursor();
+    split_rows = 1;
+    split_out = split_prompt = 0;
+    split_col0 = 0;
+    status_shown = 0;
+    tty_gotoxy(col0 = 0, line0 = lines - 1);
+}
+
+/*
+ * stop split screen, the input line stays at the bottom of the screen
+ */
+static void split_stop(void)
+{
+    tty_puts(edattrend);
+    tty_gotoxy(0, line0 = lines - split_rows);
+    tty_puts(tty_clreoscr);
+    tty_set_region(0);
+    split_rows = 0;
+    split_out = 0;
+    status_shown = 0;
+    shown.pending = 0;
+    tty_gotoxy(col0 = 0, line0);
+    status(1);
+}
+
+/*
+ * set up the scroll region again after the screen was resized or
+ * messed up by someone else. The input line must be redrawn.
+ */
+void split_reset(void)
+{
+    int i, rows = split_rows;
+
+    if (!rows)
+	return;
+    status_shown = status_fit();
+    for (i = 0; i < status_shown; i++)
+	stlines[i].drawn = stlines[i].kept = 0;
+    if (rows > lines - 1)
+	rows = lines - 1;
+    if (rows < status_shown + 1)
+	rows = status_shown + 1;
+    tty_puts(edattrend);
+    tty_set_region(0);
+    tty_gotoxy(0, lines - rows);
+    tty_puts(tty_clreoscr);
+    tty_set_region(lines - rows);
+    /* start the output on a blank line */
+    tty_gotoxy(0, lines - rows - 1);
+    tty_putc('\n');
+    tty_save_cursor();
+    split_rows = rows;
+    split_out = split_prompt = 0;
+    shown.pending = 0;
+    split_col0 = 0;
+    tty_gotoxy(col0 = 0, line0 = lines - rows + status_shown);
+    status(1);
+}
+
+/*
+ * called before redrawing prompt and input line:
+ * follow #option split, and if output was printed in the scroll region
+ * move back below it.
+ */
+void split_update(void)
+{
+    if (opt_split && !split_rows)
+	split_start();
+    else if (!opt_split && split_rows)
+	split_stop();
+    if (!split_rows)
+	return;
+    if (status_shown != status_fit()) {
+	/* status lines added or removed: redraw everything below the region */
+	split_col0 = -1;
+	clear_input_line(1);
+    }
+    if (status_dirty)
+	statusline_eval();
+    if (split_out)
+	split_to_input();
+    else if (statusline_draw()) {
+	/* put the cursor back where erase_input_line() expects it */
+	int realpos = line_status == 0 ? pos : shown.pending ? shown.pos :
+	    (prompt_status == 0 ? 0 : -col0);
+	tty_gotoxy(CURCOL(realpos), CURLINE(realpos));
+	if (line_status == 0)
+	    tty_puts(edattrbeg);
+    }
+}
+
+/*
+ * how many status lines fit below the scroll region
+ */
+static int status_fit(void)
+{
+    return status_rows < lines - 2 ? status_rows : lines > 2 ? lines - 2 : 0;
+}
+
+/*
+ * find the variables used by a status line, once it has been evaluated
+ * so that its named variables exist. Strings are skipped; numbered
+ * variables, or names not found, make the line depend on any change.
+ */
+static void statusline_deps(statusline *sl)
+{
+    char *p = sl->expr, *end, c;
+    varnode *v;
+    int kind, n = 0;
+
+    while (n <= MAX_STATUS_DEPS && (p = strpbrk(p, "\"@$"))) {
+	if (*p == '\"') {
+	    p = first_valid(p + 1, '\"');
+	    if (*p)
+		p++;
+	    continue;
+	}
+	kind = *p++ == '$';
+	if (isdigit(*p) || *p == '-') {
+	    n = MAX_STATUS_DEPS + 1;
+	    break;
+	}
+	if (!isalpha(*p) && *p != '_')
+	    continue;
+	for (end = p + 1; isalnum(*end) || *end == '_'; end++)
+	    ;
+	c = *end; *end = '\0';
+	v = *lookup_varnode(p, kind);
+	*end = c;
+	p = end;
+	if (!v || n == MAX_STATUS_DEPS) {
+	    n = MAX_STATUS_DEPS + 1;
+	    break;
+	}
+	sl->deps[n++] = 2 * v->index + kind;
+    }
+    sl->ndeps = n;
+}
+
+/*
+ * evaluate again the dirty status lines. An expression may print
+ * nothing here, errors are shown in the status line itself.
+ */
+static void statusline_eval(void)
+{
+    statusline *sl;
+    ptr buf;
+    char *p, dbg = opt_debug;
+    int i, e = error;
+
+    opt_debug = 0;
+    status_dirty = 0;
+    for (i = 0, sl = stlines; i < status_rows; i++, sl++) {
+	if (!sl->dirty)
+	    continue;
+	if (!sl->expr) {
+	    buf = (ptr)0;
+	    sl->dirty = 0;
+	} else {
+	    error = 0;
+	    buf = (ptr)0;
+	    p = sl->expr + 1;
+	    (void)evalp(&buf, &p);
+	    if (sl->ndeps < 0)
+		statusline_deps(sl);
+	    if (!REAL_ERROR && *p != ')')
+		error = MISSING_PAREN_ERROR;
+	    if (REAL_ERROR) {
+		buf = ptrmcpy(buf, "#error: ", 8);
+		buf = ptrmcat(buf, error_msg[error], strlen(error_msg[error]));
+	    }
+	    /* if the expression changed its own variables, do not loop */
+	    sl->dirty = 0;
+	}
+	if (ptrcmp(buf, sl->text)) {
+	    sl->text = ptrcpy(sl->text, buf);
+	    sl->drawn = 0;
+	}
+	ptrdel(buf);
+    }
+    error = e;
+    opt_debug = dbg;
+}
+
+/*
+ * length of the attribute sequence "\033[...m" at s, 0 if s is not one
+ * or it does not end before end
+ */
+static int attr_seq_len(char *s, char *end)
+{
+    char *p = s + 2;
+
+    if (p > end || s[0] != '\033' || s[1] != '[')
+	return 0;
+    while (p < end && !isalpha(*p))
+	p++;
+    return p < end && *p == 'm' ? p + 1 - s : 0;
+}
+
+/*
+ * width of the len chars of a row at s, -1 if it has chars other than
+ * plain ASCII and attribute sequences, whose width may be unsure
+ */
+static int row_width(char *s, int len)
+{
+    char *end = s + len;
+    int n, w = 0;
+
+    while (s < end) {
+	if ((n = attr_seq_len(s, end)))
+	    s += n;
+	else if (*s < ' ' || *s > '~')
+	    return -1;
+	else
+	    s++, w++;
+    }
+    return w;
+}
+
+/* where the last attribute sequence in s[from] ... s[len - 1] ends */
+static int attr_end(char *s, int from, int len)
+{
+    int i, n, last = from;
+
+    for (i = from; i < len; i += n)
+	if ((n = attr_seq_len(s + i, s + len)))
+	    last = i + n;
+	else
+	    n = 1;
+    return last;
+}
+
+/*
+ * 1 if the attribute sequences in the len chars at a and b are the same
+ */
+static int row_attrs_same(char *a, int alen, char *b, int blen)
+{
+    char *aend = a + alen, *bend = b + blen;
+    int n = 0, m = 0;
+
+    for (;;) {
+	while (a < aend && !(n = attr_seq_len(a, aend)))
+	    a++;
+	while (b < bend && !(m = attr_seq_len(b, bend)))
+	    b++;
+	if (a == aend || b == bend)
+	    return a == aend && b == bend;
+	if (n != m || memcmp(a, b, n))
+	    return 0;
+	a += n;
+	b += m;
+    }
+}
+
+/*
+ * the screen line `line' shows old (olen chars, colors included) from
+ * column 0: make it show new instead. Print only from the first cell
+ * that changed, up to the last one if the width did not change.
+ * begin and end are the attributes around the whole text. If clear is set,
+ * what remains of a longer old text is erased. Return the cursor column,
+ * counted as printstrlen() does, or -1 if nothing was printed.
+ */
+static int draw_row_diff(char *old, int olen, char *new, int nlen, int line,
+			  char *begin, char *end, int clear)
+{
+    int d, e, i, n, col = 0, ow, nw;
+
+    /* common head, cut before the first char of unsure width */
+    for (d = 0; d < olen && d < nlen && old[d] == new[d]; d++)
+	;
+    for (i = 0; i < d; ) {
+	if ((n = attr_seq_len(new + i, new + d)))
+	    i += n;
+	else if (new[i] < ' ' || new[i] > '~')
+	    break;
+	else
+	    i++, col++;
+    }
+    d = i;
+
+    /* common tail, if widths are the same and attributes do not change */
+    e = nlen;
+    ow = row_width(old + d, olen - d);
+    nw = row_width(new + d, nlen - d);
+    if (ow >= 0 && ow == nw) {
+	/* n = how many chars the tail can have: no attributes in it */
+	n = MIN2(nlen - attr_end(new, d, nlen), olen - attr_end(old, d, olen));
+	for (i = 0; i < n && old[olen - 1 - i] == new[nlen - 1 - i]; i++)
+	    ;
+	if (row_attrs_same(old + d, olen - i - d, new + d, nlen - i - d))
+	    e = nlen - i;
+    }
+    if (d == e && (!clear || (ow >= 0 && ow <= nw)))
+	return -1;
+
+    tty_gotoxy(col, line);
+    tty_puts(begin);
+    /* the attributes in effect at column col */
+    for (i = 0; i < d; i += n)
+	if ((n = attr_seq_len(new + i, new + d)))
+	    tty_putsn(new + i, n);
+	else
+	    n = 1;
+    tty_putsn(new + d, e - d);
+    tty_puts(end);
+    if (clear && e == nlen && (ow < 0 || ow > nw))
+	tty_puts(tty_clreoln);
+    /* where printstrlen() expects the cursor to be */
+    for (i = d; i < e; i++)
+	if (new[i] == '\033') {
+	    if (++i < e && new[i] == '[')
+		while (++i < e && !isalpha(new[i]))
+		    ;
+	} else if ((new[i] & 0x80) || new[i] >= ' ')
+	    col++;
+    return col;
+}
+
+/*
+ * print the status lines not yet on screen, truncated to the screen width.
+ * A line whose old text is still there is only patched where it changed.
+ * Return 1 if the cursor was moved.
+ */
+static int statusline_draw(void)
+{
+    statusline *sl;
+    char begin[CAPLEN], end[CAPLEN], *s;
+    int i, len, w, moved = 0;
+
+    for (i = 0, sl = stlines; i < status_shown; i++, sl++) {
+	if (sl->drawn)
+	    continue;
+	if (!moved)
+	    tty_puts(edattrend);
+	moved = 1;
+	s = "";
+	len = 0;
+	if (sl->text && ptrlen(sl->text)) {
+	    s = ptrdata(sl->text);
+	    /* stop at cols_1 printable chars or at a control char */
+	    for (w = 0; s[len] && w < cols_1; len++) {
+		if (s[len] == '\033') {
+		    if (s[len + 1] == '[') {
+			for (len += 2; s[len] && !isalpha(s[len]); len++)
+			    ;
+			if (!s[len])
+			    break;
+		    }
+		} else if ((s[len] & 0x80) || s[len] >= ' ')
+		    w++;
+		else
+		    break;
+	    }
+	}
+	attr_string(sl->attrcode, begin, end);
+	if (sl->kept && sl->shown)
+	    draw_row_diff(ptrdata(sl->shown), ptrlen(sl->shown), s, len,
+			  lines - split_rows + i, begin, end, 1);
+	else {
+	    tty_gotoxy(0, lines - split_rows + i);
+	    if (len)
+		tty_printf("%s%.*s%s", begin, len, s, end);
+	    tty_puts(tty_clreoln);
+	}
+	sl->shown = ptrmcpy(sl->shown, s, len);
+	sl->kept = !MEM_ERROR;
+	sl->drawn = 1;
+    }
+    return moved;
+}
+
+/*
+ * a variable was assigned: mark dirty the status lines using it.
+ * kind is 1 for $variables, 0 for @variables.
+ */
+void statusline_var(int kind, int idx)
+{
+    statusline *sl;
+    int i, j, key = 2 * idx + kind;
+
+    for (i = 0, sl = stlines; i < status_rows; i++, sl++) {
+	if (!sl->expr || sl->dirty)
+	    continue;
+	if (sl->ndeps > MAX_STATUS_DEPS)
+	    j = -1;
+	else
+	    for (j = sl->ndeps - 1; j >= 0 && sl->deps[j] != key; j--)
+		;
+	if (j >= 0 || sl->ndeps > MAX_STATUS_DEPS)
+	    sl->dirty = status_dirty = 1;
+    }
+}
+
+/*
+ * a variable was deleted: the indexes of the others may have changed
+ */
+void statusline_forget(void)
+{
+    int i;
+
+    for (i = 0; i < status_rows; i++)
+	if (stlines[i].expr) {
+	    stlines[i].ndeps = -1;
+	    stlines[i].dirty = status_dirty = 1;
+	}
+}
+
+/*
+ * define status line n (1 ... MAX_STATUS), or delete it if expr is NULL.
+ * expr must be a parenthesized expression.
+ */
+int statusline_define(int n, int attrcode, char *expr)
+{
+    statusline *sl = stlines + n - 1;
+    char *s = NULL;
+
+    if (expr && !(s = my_strdup(expr))) {
+	errmsg("malloc");
+	return -1;
+    }
+    if (sl->expr)
+	free(sl->expr);
+    sl->expr = s;
+    sl->attrcode = attrcode;
+    sl->ndeps = -1;
+    sl->drawn = sl->kept = 0;
+    sl->dirty = status_dirty = 1;
+
+    for (status_rows = MAX_STATUS; status_rows && !stlines[status_rows - 1].expr; )
+	status_rows--;
+    return 0;
+}
+
+/*
+ * return the expression of status line n and its attributes,
+ * NULL if the line is not defined
+ */
+char *statusline_get(int n, int *attrcode)
+{
+    statusline *sl = stlines + n - 1;
+
+    if (attrcode)
+	*attrcode = sl->attrcode;
+    return sl->expr;
+}
+
 /*
  * redraw the input line
  */
 void redraw_line(char *dummy)
 {
+    if (split_rows)
+	split_col0 = -1;
     clear_input_line(1);
 }
 
@@ -387,6 +1242,10 @@ void del_char_right(char *dummy)
  */
 void del_char_left(char *dummy)
 {
+    if (searching) {
+	search_erase();
+	return;
+    }
     if (pos) {
 	input_moveto(pos-1);
 	input_delete_nofollow_chars(1);
@@ -400,7 +1259,7 @@ void to_history(char *dummy)
 {
     if (!edlen)
 	return;
-    clear_input_line(0);
+    clear_input_lazy();
     put_history(edbuf);
     pickline = curline;
     *edbuf = '\0';
@@ -414,6 +1273,7 @@ void to_history(char *dummy)
 void put_history(char *str)
 {
     char *p;
+    history_add(str);
     if (hist[curline]) free(hist[curline]);
     if (!(hist[curline] = my_strdup(str))) {
 	errmsg("malloc");
@@ -432,42 +1292,217 @@ void put_history(char *str)
     }
 }
 
+#define WORD_CHAR(c) (isalnum((unsigned char)(c)) || ((c) & 0x80) || (c) == '_')
+
+/* words differing only in case are the same word: hash them alike */
+static int word_hash(char *s)
+{
+    unsigned h = 0;
+
+    while (*s)
+	h = h * 31 + tolower((unsigned char)*s++);
+    return h & (WORD_HASH - 1);
+}
+
 /*
- * move a node before wordindex, i.e. make it the last word
+ * compare the first len chars of a and b ignoring case,
+ * a shorter a comes first. If len < 0 compare all.
  */
-static void demote_word(int i)
+static int word_cmp(char *a, char *b, int len)
 {
-    words[words[i].prev].next = words[i].next;
-    words[words[i].next].prev = words[i].prev;
-    words[i].prev = words[words[i].next = wordindex].prev;
-    words[wordindex].prev = words[words[wordindex].prev].next = i;
+    int i, c;
+
+    for (i = 0; len < 0 || i < len; i++) {
+	c = tolower((unsigned char)a[i]) - tolower((unsigned char)b[i]);
+	if (c || !a[i])
+	    return c;
+    }
+    return 0;
 }
 
-static struct {
-    int size, used;
-    char **words;
-} static_words;
+/* position of s in wsorted[], or where it would go */
+static int word_sorted_pos(char *s, int len)
+{
+    int lo = 0, hi = wsorted_count, mid;
+
+    while (lo < hi) {
+	mid = (lo + hi) / 2;
+	if (word_cmp(words[wsorted[mid]].word, s, len) < 0)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return lo;
+}
 
-static int compl_next_word(int i)
+/* link word i as the most recent of its kind */
+static void word_link(int i, int kind)
 {
-    if (i < 0) {
-    go_static:
-        --i;
-        if (-i - 1 >= static_words.used)
-            i = wordindex;
-    } else {
-        i = words[i].next;
-        if (i == wordindex || words[i].word == NULL) {
-            i = 0;
-            goto go_static;
-        }
+    words[i].kind = kind;
+    words[i].stamp = ++word_stamp;
+    words[i].prev = -1;
+    if ((words[i].next = word_first[kind]) != -1)
+	words[word_first[kind]].prev = i;
+    else
+	word_last[kind] = i;
+    word_first[kind] = i;
+    word_count[kind]++;
+}
+
+static void word_unlink(int i)
+{
+    int kind = words[i].kind;
+
+    if (kind == WORD_STATIC)
+	return;
+    if (words[i].prev != -1)
+	words[words[i].prev].next = words[i].next;
+    else
+	word_first[kind] = words[i].next;
+    if (words[i].next != -1)
+	words[words[i].next].prev = words[i].prev;
+    else
+	word_last[kind] = words[i].prev;
+    word_count[kind]--;
+    words[i].kind = WORD_STATIC;
+}
+
+/* forget word i, unless it is also static */
+static void word_drop(int i)
+{
+    int *p, n;
+
+    word_unlink(i);
+    if (words[i].is_static)
+	return;
+    for (p = &whash[word_hash(words[i].word)]; *p != i; p = &words[*p].hnext)
+	;
+    *p = words[i].hnext;
+    n = word_sorted_pos(words[i].word, -1);
+    memmove(wsorted + n, wsorted + n + 1, (--wsorted_count - n) * sizeof(int));
+    free(words[i].word);
+    words[i].word = NULL;
+    words[i].hnext = word_free;
+    word_free = i;
+}
+
+/*
+ * add a word of the given kind, or make it the most recent one
+ * if it is already there, ignoring case: the most recent spelling
+ * is kept. Typed words are not demoted to seen ones.
+ */
+static void word_add(char *s, int kind)
+{
+    int h = word_hash(s), i, n;
+    char *w;
+
+    for (i = whash[h]; i != -1 && strcasecmp(words[i].word, s); i = words[i].hnext)
+	;
+    if (i != -1) {
+	if (kind == WORD_STATIC)
+	    words[i].is_static = 1;
+	else if (kind == WORD_TYPED || words[i].kind != WORD_TYPED) {
+	    if (strcmp(words[i].word, s) && (w = my_strdup(s))) {
+		free(words[i].word);
+		words[i].word = w;
+	    }
+	    word_unlink(i);
+	    word_link(i, kind);
+	}
+	return;
+    }
+
+    if (word_free == -1 || wsorted_count == wsorted_size) {
+	n = word_size ? word_size * 2 : 2 * MAX_WORDS + 256;
+	if (word_free == -1) {
+	    wordnode *w = (wordnode *)realloc(words, n * sizeof(wordnode));
+	    if (!w) {
+		errmsg("malloc");
+		return;
+	    }
+	    words = w;
+	    for (i = n; i-- > word_size; ) {
+		words[i].word = NULL;
+		words[i].hnext = word_free;
+		word_free = i;
+	    }
+	    word_size = n;
+	}
+	if (wsorted_count == wsorted_size) {
+	    int *p = (int *)realloc(wsorted, word_size * sizeof(int));
+	    if (!p) {
+		errmsg("malloc");
+		return;
+	    }
+	    wsorted = p;
+	    wsorted_size = word_size;
+	}
+    }
+    i = word_free;
+    if (!(words[i].word = my_strdup(s))) {
+	errmsg("malloc");
+	return;
+    }
+    word_free = words[i].hnext;
+    words[i].hnext = whash[h];
+    whash[h] = i;
+    n = word_sorted_pos(s, -1);
+    memmove(wsorted + n + 1, wsorted + n, (wsorted_count++ - n) * sizeof(int));
+    wsorted[n] = i;
+
+    words[i].is_static = kind == WORD_STATIC;
+    words[i].kind = WORD_STATIC;
+    if (kind == WORD_STATIC)
+	words[i].stamp = ++word_stamp;
+    else {
+	word_link(i, kind);
+	if (word_count[kind] > MAX_WORDS)
+	    word_drop(word_last[kind]);
     }
-    return i;
 }
 
-static char *compl_get_word(int i)
+/* typed words first, then seen, then static; the most recent first */
+static int word_order(const void *a, const void *b)
 {
-    return i < 0 ? static_words.words[-i - 1] : words[i].word;
+    wordnode *x = words + *(int *)a, *y = words + *(int *)b;
+
+    if (x->kind != y->kind)
+	return x->kind - y->kind;
+    if (x->kind == WORD_STATIC)
+	return x->stamp < y->stamp ? -1 : x->stamp > y->stamp;
+    return x->stamp > y->stamp ? -1 : x->stamp < y->stamp;
+}
+
+/*
+ * find the words starting with the first len chars of s, ignoring case,
+ * in the order they are offered. Return how many they are.
+ */
+static int word_complete(char *s, int len, int **list)
+{
+    static int *cand, cand_size;
+    int lo = word_sorted_pos(s, len), hi = wsorted_count, l = lo, mid;
+
+    while (l < hi) {
+	mid = (l + hi) / 2;
+	if (word_cmp(words[wsorted[mid]].word, s, len) > 0)
+	    hi = mid;
+	else
+	    l = mid + 1;
+    }
+
+    if (hi - lo > cand_size) {
+	int *p = (int *)realloc(cand, (hi - lo) * sizeof(int));
+	if (!p) {
+	    errmsg("malloc");
+	    return 0;
+	}
+	cand = p;
+	cand_size = hi - lo;
+    }
+    memcpy(cand, wsorted + lo, (hi - lo) * sizeof(int));
+    qsort(cand, hi - lo, sizeof(int), word_order);
+    *list = cand;
+    return hi - lo;
 }
 
 /*
@@ -479,14 +1514,14 @@ void complete_word(char *dummy)
      * GH: rewritten to allow circulating through history with
      * repetitive command
      *     code stolen from cancan 2.6.3a
-     *        curr_word:   index into words[]
+     *        list, count: the matching words, curr the one shown
      *        comp_len     length of current completition
      *        root_len     length of the root word (before the completition)
      *        root         start of the root word
      */
 
-    static int curr_word, comp_len = 0, root_len = 0;
-    char *root, *p;
+    static int *list, count, curr, comp_len = 0, root_len = 0;
+    char *root, *p = NULL;
     int k, n;
 
     /* find word start */
@@ -498,16 +1533,18 @@ void complete_word(char *dummy)
 	for (n = pos; n > 0 && !IS_DELIM(edbuf[n - 1]); n--)
 	    ;
 	k = 0;
-	curr_word = wordindex;
 	root_len = pos - n;
+	count = word_complete(edbuf + n, root_len, &list);
+	curr = -1;
     }
     root = edbuf + n; comp_len = 0;
 
     /* k = chars to delete,  n = position of starting word */
 
-    /* scan word list for next match */
-    while ((p = compl_get_word(curr_word = compl_next_word(curr_word)))) {
-	if (!strncasecmp(p, root, root_len) &&
+    /* next match. Words may have been dropped meanwhile, check them */
+    while (++curr < count) {
+	p = words[list[curr]].word;
+	if (p && !word_cmp(p, root, root_len) &&
 	    *(p += root_len) &&
 	    (n = strlen(p)) + edlen < BUFSIZE) {
 	    comp_len = n;
@@ -520,62 +1557,173 @@ void complete_word(char *dummy)
     }
     if (k > 0)
 	input_delete_nofollow_chars(k);
-
-    /* delete duplicate instances of the word */
-    if (p && curr_word >= 0
-        && !(words[k = curr_word].flags & WORD_UNIQUE)) {
-	words[k].flags |= WORD_UNIQUE;
-	p = words[k].word;
-	n = words[k].next;
-	while (words[k = n].word) {
-	    n = words[k].next;
-	    if (!strcmp(p, words[k].word)) {
-		demote_word(k);
-		free(words[k].word);
-		words[k].word = 0;
-		words[curr_word].flags |= words[k].flags;	/* move retain flag */
-		if ((words[k].flags &= WORD_UNIQUE))
-		    break;
-	    }
-	}
-    }
 }
 
 /*
  * match and complete entire lines backwards in history
  * GH: made repeated complete_line cycle through history
+ * (each different line once, newest first, then back to what was typed)
  */
 void complete_line(char *dummy)
 {
-    static int curr_line = MAX_HIST-1, root_len = 0, first_line = 0;
-    int i;
+    static int *list, count, curr, root_len;
+    char *s;
+    int len;
 
     if (last_edit_cmd != (function_any)complete_line) {
 	root_len = edlen;
-	first_line = curr_line = curline;
+	count = history_complete(edbuf, edlen, &list);
+	curr = -1;
     }
+    if (!count)
+	return;
 
-    for (i = curr_line - 1; i != curr_line; i--) {
-	if (i < 0) i = MAX_HIST - 1;
-	if (i == first_line)
-	    break;
-	if (hist[i] && !strncmp(edbuf, hist[i], root_len))
+    clear_input_lazy();
+    if (++curr < count) {
+	history_line(list[curr], &len);
+	if (len == root_len)
+	    curr++;	/* the same as what was typed, skip it */
+    }
+    if (curr >= count) {
+	edlen = root_len;
+	curr = -1;
+    } else {
+	s = history_line(list[curr], &len);
+	edlen = MIN2(len, BUFSIZE - 2);
+	memcpy(edbuf, s, edlen);
+    }
+    edbuf[pos = edlen] = '\0';
+}
+
+/*
+ * reverse incremental search in history (C-r): while it is active
+ * the input line shows the search string and the newest line containing it,
+ * typed chars are added to the search string and Backspace removes them.
+ * Any other key picks the line shown and then does its usual job.
+ */
+char searching = 0;		/* 1 during a reverse search */
+static char search_str[BUFSIZE / 2];
+static int search_len, search_last;	/* ... and the length of the last one */
+static int search_at, search_off;	/* line shown, offset of match in it */
+static int search_fail;
+static char search_save[BUFSIZE];	/* input line before searching */
+static int search_save_pos;
+
+static void search_show(void)
+{
+    char *s = search_save;
+    int n, len = strlen(search_save), at = search_save_pos;
+
+    if (search_at >= 0) {
+	s = history_line(search_at, &len);
+	at = search_off;
+    }
+    clear_input_lazy();
+    n = sprintf(edbuf, "(%sreverse-i-search)`%.*s': ",
+		search_fail ? "failed " : "", search_len, search_str);
+    len = MIN2(len, BUFSIZE - 2 - n);
+    memcpy(edbuf + n, s, len);
+    edbuf[edlen = n + len] = '\0';
+    pos = n + MIN2(at, len);
+}
+
+/*
+ * look for the search string in lines older than from,
+ * skipping those equal to the one shown if next != 0
+ */
+static void search_find(int from, int next)
+{
+    char *s = NULL, *t;
+    int len = 0, tlen, at, off;
+
+    if (!search_len) {
+	search_at = -1;
+	search_fail = 0;
+	return;
+    }
+    if (next && search_at >= 0)
+	s = history_line(search_at, &len);
+    while ((at = history_search(search_str, search_len, from, &off)) >= 0) {
+	t = history_line(at, &tlen);
+	if (!s || tlen != len || memcmp(s, t, len))
 	    break;
+	from = at;	/* the line shown again, skip it */
     }
-    if (i != curr_line) {
-	clear_input_line(0);
-	if (i == first_line) {
-	    edbuf[root_len] = 0;
-	    edlen = root_len;
-	} else {
-	    strcpy(edbuf, hist[i]);
-	    edlen = strlen(edbuf);
-	}
-	pos = edlen;
-	curr_line = i;
+    if ((search_fail = at < 0))
+	return;		/* keep showing the last match */
+    search_at = at;
+    search_off = off;
+}
+
+static void search_type(char *s, int n)
+{
+    if (n > (int)sizeof(search_str) - search_len)
+	n = sizeof(search_str) - search_len;
+    memcpy(search_str + search_len, s, n);
+    search_len += n;
+    /* the line shown may still match */
+    search_find(search_at >= 0 ? search_at + 1 : history_count(), 0);
+    search_show();
+}
+
+/* Backspace during a reverse search */
+static void search_erase(void)
+{
+    if (search_len) {
+	search_len--;
+	search_find(history_count(), 0);
+	search_show();
     }
 }
 
+void reverse_search(char *dummy)
+{
+    if (!searching) {
+	memcpy(search_save, edbuf, edlen + 1);
+	search_save_pos = pos;
+	search_last = search_len;
+	search_len = search_fail = 0;
+	search_at = -1;
+	searching = 1;
+    } else if (!search_len && search_last) {
+	/* C-r C-r searches again the last string */
+	search_len = search_last;
+	search_find(history_count(), 0);
+    } else if (!search_fail)
+	search_find(search_at >= 0 ? search_at : history_count(), 1);
+    search_show();
+}
+
+/*
+ * leave reverse search, keeping the line found if accept != 0
+ */
+void search_end(int accept)
+{
+    char *s;
+    int len;
+
+    if (!searching)
+	return;
+    searching = 0;
+    clear_input_lazy();
+    if (accept && search_at >= 0) {
+	s = history_line(search_at, &len);
+	edlen = MIN2(len, BUFSIZE - 2);
+	memcpy(edbuf, s, edlen);
+	edbuf[edlen] = '\0';
+	pos = MIN2(search_off, edlen);
+    } else {
+	strcpy(edbuf, search_save);
+	edlen = strlen(edbuf);
+	pos = search_save_pos;
+    }
+}
+
+void cancel_search(char *dummy)
+{
+    search_end(0);
+}
+
 /*
  * GH: word history handling stolen from cancan 2.6.3a
  */
@@ -585,55 +1733,59 @@ static void default_completions(void)
     char buf[BUFSIZE];
     cmdstruct *p;
     int i;
+    for (i = 0; i < WORD_HASH; i++)
+	whash[i] = -1;
     /* TODO: add some way to handle new commands going in the default
      * completions list */
-    for (i = 0, buf[0] = '#', p = commands; p != NULL; p = p -> next)
+    for (buf[0] = '#', p = commands; p != NULL; p = p -> next)
 	if (p->funct) {
 	    strcpy(buf + 1, p->name);
             put_static_word(buf);
 	}
-    /* init 'words' double-linked list */
-    for (i = MAX_WORDS; i--; words[i].prev = i - 1, words[i].next = i + 1)
-	;
-    words[0].prev = MAX_WORDS - 1;
-    words[MAX_WORDS - 1].next = 0;
 }
 
 void put_static_word(char *s)
 {
-    if (static_words.used >= static_words.size) {
-        do {
-            static_words.size = static_words.size ? static_words.size * 2 : 16;
-        } while (static_words.used >= static_words.size);
-        static_words.words = realloc(static_words.words,
-                                     sizeof static_words.words[0]
-                                     * static_words.size);
-    }
-
-    if ((s = my_strdup(s)) == NULL) {
-        errmsg("malloc");
-        return;
-    }
-    static_words.words[static_words.used++] = s;
+    word_add(s, WORD_STATIC);
 }
 
 /*
- * put word in word completion ring
+ * put word in word completion list
  */
 void put_word(char *s)
 {
-    int r = wordindex;
-    if (!(words[r].word = my_strdup(s))) {
-	errmsg("malloc");
+    word_add(s, WORD_TYPED);
+}
+
+/*
+ * put in word completion list the words of a line printed from the MUD.
+ * Only letters, digits and '_' make words here, attributes are skipped.
+ */
+void put_seen_words(char *line)
+{
+    char buf[MAX_SEENLEN + 1], *p = line, *s;
+    int len;
+
+    if (!opt_mudwords)
 	return;
-    }
-    words[r].flags = 0;
-    r = words[r].prev;
-    demote_word(r);
-    wordindex = r;
-    if (words[r].word) {
-	free(words[r].word);
-	words[r].word = 0;
+    while (*p) {
+	if (*p == '\033') {
+	    if (*++p == '[')
+		while (*++p && (*p < '@' || *p > '~'))
+		    ;
+	    if (*p)
+		p++;
+	    continue;
+	}
+	for (s = p; WORD_CHAR(*p); p++)
+	    ;
+	if (p == s)
+	    p++;
+	else if ((len = p - s) >= MIN_WORDLEN && len <= MAX_SEENLEN) {
+	    memcpy(buf, s, len);
+	    buf[len] = '\0';
+	    word_add(buf, WORD_SEEN);
+	}
     }
 }
 
@@ -660,7 +1812,12 @@ void enter_line(char *dummy)
 {
     char *p;
 
-    if (line_status == 0)
+    if (split_rows) {
+	/* leave prompt and input line in the scroll region */
+	split_to_output(0);
+	if (!(linemode & LM_NOECHO))
+	    tty_printf("%s%s", edattrbeg, edbuf);
+    } else if (line_status == 0)
 	input_moveto(edlen);
     else {
 	if (prompt_status != 0)
@@ -673,9 +1830,11 @@ void enter_line(char *dummy)
     if (line0 < lines - 1) line0++;
 
     if (recordfile)
-	fprintf(recordfile, "%s\n", edbuf);
+	logfile_printf(recordfile, "%s\n", edbuf);
 
     col0 = error = pos = line_status = 0;
+    if (split_rows)
+	line_status = 1;	/* below the scroll region it is still there */
 
     if (!*edbuf || (verbatim && *edbuf != '#'))
 	tcp_write(tcp_fd, edbuf);
@@ -816,7 +1975,7 @@ void prev_line(char *dummy)
 	    }
 	}
 	pickline = i;
-	clear_input_line(0);
+	clear_input_lazy();
 	strcpy(edbuf, hist[pickline]);
 	pos = edlen = strlen(edbuf);
     }
@@ -841,7 +2000,7 @@ void next_line(char *dummy)
 	    }
 	}
 	pickline = i;
-	clear_input_line(0);
+	clear_input_lazy();
 	strcpy(edbuf, hist[pickline]);
 	edlen = pos = strlen(edbuf);
     }
@@ -906,7 +2065,9 @@ void putbackcursor(void)
  */
 void insert_char(char c)
 {
-    if (((c & 0x80) || (c >= ' ' && c <= '~')) && edlen < BUFSIZE - 2) {
+    if (((c & 0x80) || (c >= ' ' && c <= '~')) && searching)
+	search_type(&c, 1);
+    else if (((c & 0x80) || (c >= ' ' && c <= '~')) && edlen < BUFSIZE - 2) {
 	if (flashback) putbackcursor();
 	input_insert_follow_chars(&c, 1);
 	if (ISRPAREN(c))
@@ -914,6 +2075,133 @@ void insert_char(char c)
     }
 }
 
+/*
+ * insert n printable chars at once (a paste, usually)
+ */
+void insert_chars(char *s, int n)
+{
+    if (searching) {
+	search_type(s, n);
+	return;
+    }
+    if (n > BUFSIZE - 2 - edlen)
+	n = BUFSIZE - 2 - edlen;
+    if (n <= 1) {
+	if (n == 1)
+	    insert_char(*s);
+	return;
+    }
+    if (flashback) putbackcursor();
+    input_insert_follow_chars(s, n);
+    if (ISRPAREN(s[n - 1]))
+	flashparen(s[n - 1]);
+}
+
+/*
+ * insert a pasted text. Each newline in it works as enter-line,
+ * unless #option sendpaste is on and the paste has more than one line:
+ * then the complete lines are sent through the send queue like #send <file
+ * and only what follows the last newline stays in the input line.
+ */
+static void paste_text(char *s, int len)
+{
+    char *end = s + len, *p, *d, *last = NULL, c;
+    int lines = 0, n;
+    ptr text = (ptr)0;
+
+    /* keep printable chars and newlines. \r\n and \r are newlines too */
+    for (p = d = s; p < end; p++) {
+	c = *p;
+	if (c == '\r') {
+	    c = '\n';
+	    if (p + 1 < end && p[1] == '\n')
+		p++;
+	} else if (c == '\t')
+	    c = ' ';
+	else if (c != '\n' && ((unsigned char)c < ' ' || c == '\177'))
+	    continue;
+	if (c == '\n')
+	    lines++, last = d;
+	*d++ = c;
+    }
+    end = d;
+
+    if (lines > 1 && opt_sendpaste && tcp_fd != -1) {
+	/* what is before the cursor is the beginning of the first line */
+	text = ptrmcpy(text, edbuf, pos);
+	text = ptrmcat(text, s, last + 1 - s);
+	if (!MEM_ERROR &&
+	    tcp_stream_text(tcp_fd, "(paste)", ptrdata(text), ptrlen(text)) == 0) {
+	    ptrdel(text);
+	    if (opt_info) {
+		clear_input_line(0);
+		PRINTF("#sending %d pasted lines.\n", lines);
+	    } else
+		clear_input_lazy();
+	    s = last + 1;
+	    n = MIN2(end - s, BUFSIZE - 2 - (edlen - pos));
+	    memmove(edbuf + n, edbuf + pos, edlen - pos + 1);
+	    memcpy(edbuf, s, n);
+	    edlen = n + edlen - pos;
+	    pos = n;
+	    return;
+	}
+	ptrdel(text);
+	errmsg("malloc");
+	return;
+    }
+
+    while (s < end) {
+	for (p = s; p < end && *p != '\n'; p++)
+	    ;
+	insert_chars(s, p - s);
+	if (p == end)
+	    break;
+	enter_line(NULL);
+	s = p + 1;
+    }
+}
+
+/*
+ * a bracketed paste begins
+ */
+void paste_begin(char *dummy)
+{
+    pasting = 1;
+}
+
+/*
+ * add n typed bytes to the current bracketed paste, and insert it
+ * when PASTE_END is found. return how many bytes were part of the paste.
+ */
+int paste_collect(char *s, int n)
+{
+    int old = paste_buf ? ptrlen(paste_buf) : 0, from, len;
+    char *end;
+
+    paste_buf = ptrmcat(paste_buf, s, n);
+    if (MEM_ERROR) {
+	print_error(error);
+	pasting = 0;
+	return n;
+    }
+    /* the end marker may have been split between two reads */
+    from = old > PASTE_LEN - 1 ? old - (PASTE_LEN - 1) : 0;
+    end = memfind(ptrdata(paste_buf) + from, ptrlen(paste_buf) - from,
+		  PASTE_END, PASTE_LEN);
+    if (!end)
+	return n;
+
+    pasting = 0;
+    len = end - ptrdata(paste_buf);
+    paste_text(ptrdata(paste_buf), len);
+    if (ptrmax(paste_buf) > BUFSIZE) {
+	ptrdel(paste_buf);
+    } else
+	ptrtrunc(paste_buf, 0);
+    return len + PASTE_LEN - old;
+}
+
 static void insert_string(char *arg)
 {
     char buf[BUFSIZE];
@@ -948,7 +2236,7 @@ void key_run_command(char *cmd)
     error = 0;
 
     if (recordfile)
-	fprintf(recordfile, "%s\n", edbuf);
+	logfile_printf(recordfile, "%s\n", edbuf);
 
     parse_instruction(cmd, 1, 0, 1);
     history_done = 0;
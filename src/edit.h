@@ -13,23 +13,37 @@ extern edit_function internal_functions[];
 /*
  * GH: completion list, stolen from cancan 2.6.3a
  *
- *     words[wordindex] is where the next word will go (always empty)
- *     words[wordindex].prev is last (least interesting)
- *     words[wordindex].next is 2nd (first to search for completion)
+ *     words typed (put in history or #add) and words seen in MUD output
+ *     are kept in two lists, most recent first: when one is longer than
+ *     MAX_WORDS its least recent word is dropped.
+ *     Static words (#addstatic and commands) are never dropped.
  */
-#define WORD_UNIQUE	1		/* word is unique in list */
+#define WORD_TYPED	0
+#define WORD_SEEN	1
+#define WORD_STATIC	2		/* or dropped from its list */
 typedef struct {
     char *word;
-    int  next, prev;
-    char flags;
+    int  next, prev;			/* in its list; next is older */
+    int  hnext;				/* next in hash chain */
+    unsigned stamp;			/* when last put */
+    char kind, is_static;
 } wordnode;
 
 extern char *hist[MAX_HIST];
 extern int curline;
 extern int pickline;
+extern char pasting;
+extern char searching;
 
-extern wordnode words[MAX_WORDS];
-extern int wordindex;
+extern wordnode *words;
+extern int word_last[2];
+
+extern int split_rows;
+extern int status_rows;
+
+/* call after assigning a variable, kind is 1 for $variables */
+#define STATUSLINE_VAR(kind, idx) \
+    do { if (status_rows) statusline_var((kind), (idx)); } while (0)
 
 /*         public function declarations         */
 void edit_bootstrap(void);
@@ -52,7 +66,11 @@ void to_history(char *dummy);
 void put_history(char *str);
 void complete_word(char *dummy);
 void complete_line(char *dummy);
+void reverse_search(char *dummy);
+void cancel_search(char *dummy);
+void search_end(int accept);
 void put_word(char *s);
+void put_seen_words(char *line);
 void put_static_word(char *s);
 void set_custom_delimeters(char *s);
 void to_input_line(char *str);
@@ -60,6 +78,9 @@ void clear_line(char *dummy);
 void enter_line(char *dummy);
 void putbackcursor(void);
 void insert_char(char c);
+void insert_chars(char *s, int n);
+void paste_begin(char *dummy);
+int  paste_collect(char *s, int n);
 void next_word(char *dummy);
 void prev_word(char *dummy);
 void del_word_right(char *dummy);
@@ -71,5 +92,12 @@ void next_line(char *dummy);
 void prev_char(char *dummy);
 void next_char(char *dummy);
 void key_run_command(char *cmd);
+int  split_fit(void);
+void split_reset(void);
+void split_update(void);
+void statusline_var(int kind, int idx);
+void statusline_forget(void);
+int  statusline_define(int n, int attrcode, char *expr);
+char *statusline_get(int n, int *attrcode);
 
 #endif /* _EDIT_H_ */
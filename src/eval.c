@@ -488,6 +488,7 @@ static int exe_op(operator *op)
 
 	if (o1.type==TYPE_NUM_VAR && o2.type==TYPE_NUM) {
 	    *VAR[o1.num].num = o2.num;
+	    STATUSLINE_VAR(0, o1.num);
 	    p=&o2;
 	    ret=1;
 	}
@@ -502,6 +503,7 @@ static int exe_op(operator *op)
 
 	    *VAR[o1.num].str = ptrcpy(*VAR[o1.num].str, o2.txt);
 	    if (REAL_ERROR) break;
+	    STATUSLINE_VAR(1, o1.num);
 	    p=&o2;
 	    ret=1;
 	}
@@ -549,6 +551,7 @@ static int exe_op(operator *op)
 		if ((*l %= o2.num) < 0) *l += o2.num; break;
 	    }
 	    o2.num=*l;
+	    STATUSLINE_VAR(0, o1.num);
 	    p=&o2;
 	    ret=1;
 	}
@@ -561,6 +564,7 @@ static int exe_op(operator *op)
 		src=*VAR[o2.num].str;
 
 	    *VAR[o1.num].str = ptrcat(*VAR[o1.num].str, src);
+	    STATUSLINE_VAR(1, o1.num);
 	    check_delete(&o2);
 
 	    dst = ptrdup(*VAR[o1.num].str);
@@ -592,6 +596,7 @@ static int exe_op(operator *op)
 		for (n = 1; !error && n<o2.num; n++)
 		    memcpy(tmp+n*delta, tmp, delta);
 	    }
+	    STATUSLINE_VAR(1, o1.num);
 
 	    check_delete(&o2);
 	    dst = ptrdup(*VAR[o1.num].str);
@@ -1154,6 +1159,7 @@ static int exe_op(operator *op)
 
 	if (o1.type==TYPE_NUM_VAR) {
 	    l=VAR[o1.num].num;
+	    STATUSLINE_VAR(0, o1.num);
 	    o1.type=TYPE_NUM;
 
 	    if (*op==pre_plus_plus)
@@ -0,0 +1,371 @@
+/*
+ *  history.c  --  all the command history, the #histfile it is kept in,
+ *                 and the index used to complete and search it
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "defines.h"
+#include "main.h"
+#include "utils.h"
+#include "edit.h"
+#include "tty.h"
+#include "history.h"
+
+/*
+ * hist[] in edit.c keeps the last MAX_HIST lines for prev-line/next-line.
+ * Here instead are all the lines of the session, plus the ones read
+ * from the #histfile: those point into the file mapped in memory,
+ * the others are malloc()ed. Lines are not '\0' terminated.
+ */
+typedef struct {
+    char *s;
+    int len;
+} histline;
+
+static histline *hl;		/* all lines, oldest first */
+static int hl_count, hl_size;
+
+/*
+ * the index: one entry for each distinct line, sorted by text,
+ * holding the position in hl[] of its newest copy.
+ * Built when first needed, then kept up to date.
+ */
+static int *hx;
+static int hx_count, hx_size, hx_built;
+
+static int *cand;		/* result of history_complete() */
+static int cand_size;
+
+static char *hmap;		/* the #histfile as it was when opened */
+static size_t hmap_len;
+static int hfd = -1;		/* new lines are appended to it */
+static char *hname;
+static int loading;		/* 1 while filling hist[] from the file */
+
+#define MAPPED(s) (hmap && (s) >= hmap && (s) < hmap + hmap_len)
+
+/* compare two lines of hl[], by text then by age */
+static int hl_cmp(const void *a, const void *b)
+{
+    histline *x = hl + *(int *)a, *y = hl + *(int *)b;
+    int c = memcmp(x->s, y->s, MIN2(x->len, y->len));
+
+    if (!c)
+	c = x->len - y->len;
+    if (!c)
+	c = *(int *)a - *(int *)b;
+    return c;
+}
+
+/* compare the first len chars of line n with s */
+static int hl_prefix_cmp(int n, char *s, int len)
+{
+    int c = memcmp(hl[n].s, s, MIN2(hl[n].len, len));
+
+    return c ? c : hl[n].len < len ? -1 : 0;
+}
+
+/* first index entry not less than s (exact line if full, else prefix) */
+static int hx_lower(char *s, int len, int full)
+{
+    int lo = 0, hi = hx_count, mid, c;
+
+    while (lo < hi) {
+	mid = (lo + hi) / 2;
+	c = hl_prefix_cmp(hx[mid], s, len);
+	if (full && !c && hl[hx[mid]].len > len)
+	    c = 1;
+	if (c < 0)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return lo;
+}
+
+static void hx_build(void)
+{
+    int i, j;
+
+    if (hx_size < hl_count) {
+	int *p = (int *)realloc(hx, hl_count * sizeof(int));
+	if (!p) {
+	    errmsg("malloc");
+	    return;
+	}
+	hx = p;
+	hx_size = hl_count;
+    }
+    for (i = 0; i < hl_count; i++)
+	hx[i] = i;
+    qsort(hx, hl_count, sizeof(int), hl_cmp);
+
+    /* keep only the newest copy of each line */
+    for (i = j = 0; i < hl_count; i++) {
+	if (j && hl[hx[j-1]].len == hl[hx[i]].len &&
+	    !memcmp(hl[hx[j-1]].s, hl[hx[i]].s, hl[hx[i]].len))
+	    j--;
+	hx[j++] = hx[i];
+    }
+    hx_count = j;
+    hx_built = 1;
+}
+
+/* line n was just added to hl[]: update the index */
+static void hx_add(int n)
+{
+    int i = hx_lower(hl[n].s, hl[n].len, 1);
+
+    if (i < hx_count && hl[hx[i]].len == hl[n].len &&
+	!memcmp(hl[hx[i]].s, hl[n].s, hl[n].len)) {
+	hx[i] = n;
+	return;
+    }
+    if (hx_count == hx_size) {
+	int *p = (int *)realloc(hx, (hx_size * 2 + 64) * sizeof(int));
+	if (!p) {
+	    hx_built = 0;	/* rebuild it next time */
+	    return;
+	}
+	hx = p;
+	hx_size = hx_size * 2 + 64;
+    }
+    memmove(hx + i + 1, hx + i, (hx_count - i) * sizeof(int));
+    hx[i] = n;
+    hx_count++;
+}
+
+static int hl_grow(void)
+{
+    histline *p;
+
+    if (hl_count < hl_size)
+	return 0;
+    if (!(p = (histline *)realloc(hl, (hl_size * 2 + 256) * sizeof(histline)))) {
+	errmsg("malloc");
+	return -1;
+    }
+    hl = p;
+    hl_size = hl_size * 2 + 256;
+    return 0;
+}
+
+/*
+ * add a line to the history, and append it to the #histfile if any
+ */
+void history_add(char *s)
+{
+    int len = strlen(s);
+    char *p;
+
+    if (loading)
+	return;
+    if (hl_grow() < 0 || !(p = (char *)malloc(len + 1))) {
+	errmsg("malloc");
+	return;
+    }
+    memcpy(p, s, len);
+    p[len] = '\n';
+    hl[hl_count].s = p;
+    hl[hl_count].len = len;
+    if (hx_built)
+	hx_add(hl_count);
+    hl_count++;
+
+    /* one write(), so that lines from different powwows do not mix */
+    if (hfd != -1 && write(hfd, p, len + 1) != len + 1) {
+	PRINTF("#error writing history file \"%s\": %s\n", hname,
+	       strerror(errno));
+	close(hfd);
+	hfd = -1;
+    }
+}
+
+int history_count(void)
+{
+    return hl_count;
+}
+
+char *history_line(int n, int *len)
+{
+    *len = hl[n].len;
+    return hl[n].s;
+}
+
+static int cand_cmp(const void *a, const void *b)
+{
+    return *(int *)b - *(int *)a;
+}
+
+/*
+ * find the distinct lines starting with the first len chars of s,
+ * newest first. *list is valid until the history changes.
+ * Return how many they are.
+ */
+int history_complete(char *s, int len, int **list)
+{
+    int lo, l, hi, mid;
+
+    if (!hx_built)
+	hx_build();
+    if (!hx_built)
+	return 0;
+
+    lo = hx_lower(s, len, 0);
+    for (l = lo, hi = hx_count; l < hi; ) {
+	mid = (l + hi) / 2;
+	if (hl_prefix_cmp(hx[mid], s, len) > 0)
+	    hi = mid;
+	else
+	    l = mid + 1;
+    }
+
+    if (hi - lo > cand_size) {
+	int *p = (int *)realloc(cand, (hi - lo) * sizeof(int));
+	if (!p) {
+	    errmsg("malloc");
+	    return 0;
+	}
+	cand = p;
+	cand_size = hi - lo;
+    }
+    memcpy(cand, hx + lo, (hi - lo) * sizeof(int));
+    qsort(cand, hi - lo, sizeof(int), cand_cmp);
+    *list = cand;
+    return hi - lo;
+}
+
+/*
+ * find the newest line before line from that contains s.
+ * Return its number and set *at to the offset of s in it, or -1 if none.
+ */
+int history_search(char *s, int len, int from, int *at)
+{
+    char *p;
+
+    if (from > hl_count)
+	from = hl_count;
+    while (--from >= 0) {
+	if (hl[from].len >= len &&
+	    (p = memfind(hl[from].s, hl[from].len, s, len))) {
+	    *at = p - hl[from].s;
+	    return from;
+	}
+    }
+    return -1;
+}
+
+char *history_file(void)
+{
+    return hname;
+}
+
+/*
+ * stop appending to the #histfile. The lines read from it are kept.
+ */
+void history_close(void)
+{
+    if (hfd != -1) {
+	close(hfd);
+	hfd = -1;
+    }
+    if (hname) {
+	free(hname);
+	hname = NULL;
+    }
+}
+
+/* forget all lines, before reading another #histfile */
+static void history_clear(void)
+{
+    int i;
+
+    for (i = 0; i < hl_count; i++)
+	if (!MAPPED(hl[i].s))
+	    free(hl[i].s);
+    hl_count = hx_count = hx_built = 0;
+    if (hmap) {
+	munmap(hmap, hmap_len);
+	hmap = NULL;
+	hmap_len = 0;
+    }
+}
+
+/*
+ * use the history file name: read it (mapping it in memory, it can be big)
+ * and append to it every new line. Return -1 on error.
+ */
+int history_open(char *name)
+{
+    struct stat st;
+    char *p, *end, *nl, buf[BUFSIZE];
+    int fd, len, i;
+
+    if ((fd = open(name, O_RDWR | O_CREAT | O_APPEND, 0600)) < 0)
+	return -1;
+    if (fstat(fd, &st) < 0) {
+	close(fd);
+	return -1;
+    }
+    history_close();
+    history_clear();
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    hfd = fd;
+    if (!(hname = my_strdup(name)))
+	errmsg("malloc");
+
+    if (st.st_size == 0)
+	return 0;
+    hmap = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (hmap == (char *)MAP_FAILED) {
+	hmap = NULL;
+	return 0;	/* just append to it */
+    }
+    hmap_len = st.st_size;
+
+    for (p = hmap, end = hmap + hmap_len; p < end; p = nl + 1) {
+	if (!(nl = memchr(p, '\n', end - p))) {
+	    /* interrupted while writing it: start the next line cleanly */
+	    if (write(hfd, "\n", 1) != 1) {
+		close(hfd);
+		hfd = -1;
+	    }
+	    nl = end;
+	}
+	if (nl == p)
+	    continue;
+	if (hl_grow() < 0)
+	    break;
+	hl[hl_count].s = p;
+	hl[hl_count].len = nl - p;
+	hl_count++;
+    }
+
+    /* the newest lines can also be recalled with prev-line */
+    loading = 1;
+    for (i = MAX2(0, hl_count - MAX_HIST + 1); i < hl_count; i++) {
+	len = MIN2(hl[i].len, BUFSIZE - 2);
+	memcpy(buf, hl[i].s, len);
+	buf[len] = '\0';
+	put_history(buf);
+    }
+    loading = 0;
+    pickline = curline;
+    return 0;
+}
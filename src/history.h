@@ -0,0 +1,15 @@
+/* public things from history.c */
+
+#ifndef _HISTORY_H_
+#define _HISTORY_H_
+
+void  history_add(char *s);
+int   history_count(void);
+char *history_line(int n, int *len);
+int   history_complete(char *s, int len, int **list);
+int   history_search(char *s, int len, int from, int *at);
+char *history_file(void);
+int   history_open(char *name);
+void  history_close(void);
+
+#endif /* _HISTORY_H_ */
@@ -26,6 +26,28 @@
 #include "list.h"
 #include "tty.h"
 #include "eval.h"
+#include "edit.h"
+
+/*
+ * Key sequence decoder: a trie over the sequences in keydefs,
+ * so that each byte typed is decoded with a single table lookup.
+ * Node KEYTRIE_ROOT is the empty sequence, 0 means no node.
+ * add_keynode() adds nodes to it, while deleting or rebinding a key
+ * changes keytrie_gen and the trie is rebuilt at the next keypress.
+ */
+typedef struct {
+    keynode *key;		/* key bound to this sequence, if any */
+    unsigned short next[256];	/* node after each byte, 0 if none */
+} keytrie;
+
+#define KEYTRIE_MAX 65535	/* must fit in next[] */
+
+static keytrie *ktrie;
+static int ktrie_len, ktrie_size;
+static int ktrie_built = -1;	/* keytrie_gen when ktrie was built */
+int keytrie_gen;		/* changes when node numbers become invalid */
+
+static int keytrie_insert(keynode *k);
 
 /*
  * compare two times, return -1 if t1 < t2, 1 if t1 > t2, 0 if t1 == t2
@@ -373,6 +395,8 @@ void add_keynode(char *name, char *sequence, int seqlen, function_str funct, cha
 	return;
     }
     add_node((defnode*)new, (defnode**)&keydefs, ascii_sort);
+    if (ktrie_built == keytrie_gen && keytrie_insert(new) < 0)
+	keytrie_gen++;
 }
 
 /*
@@ -670,6 +694,7 @@ void delete_keynode(keynode **base)
     if (p->call_data) free(p->call_data);
     *base = p->next;
     free((void*)p);
+    keytrie_gen++;
 }
 
 /*
@@ -731,3 +756,81 @@ void delete_varnode(varnode **base, int type)
 	VAR[ i ].num = NULL;
     }
 }
+
+/*
+ * add the sequence of a key to the trie. return -1 if out of nodes.
+ */
+static int keytrie_insert(keynode *k)
+{
+    int i, n = KEYTRIE_ROOT;
+    unsigned char c;
+    keytrie *t;
+
+    for (i = 0; i < k->seqlen; i++) {
+	c = k->sequence[i];
+	if (!ktrie[n].next[c]) {
+	    if (ktrie_len == ktrie_size) {
+		if (ktrie_size >= KEYTRIE_MAX ||
+		    !(t = (keytrie *)realloc(ktrie, 2 * ktrie_size * sizeof(keytrie))))
+		    return -1;
+		ktrie = t;
+		ktrie_size = MIN2(2 * ktrie_size, KEYTRIE_MAX);
+	    }
+	    memzero(ktrie + ktrie_len, sizeof(keytrie));
+	    ktrie[n].next[c] = ktrie_len++;
+	}
+	n = ktrie[n].next[c];
+    }
+    /* like a scan of keydefs, the first key in the list wins */
+    if (!ktrie[n].key)
+	ktrie[n].key = k;
+    return 0;
+}
+
+/* the start of a bracketed paste is decoded like a key */
+static keynode paste_key = {
+    NULL, "paste", PASTE_BEGIN, PASTE_LEN, paste_begin, NULL
+};
+
+static void keytrie_build(void)
+{
+    keynode *k;
+
+    ktrie_built = keytrie_gen;
+    if (!ktrie) {
+	if (!(ktrie = (keytrie *)malloc(64 * sizeof(keytrie)))) {
+	    errmsg("malloc");
+	    return;
+	}
+	ktrie_size = 64;
+    }
+    ktrie_len = KEYTRIE_ROOT + 1;
+    memzero(ktrie + KEYTRIE_ROOT, sizeof(keytrie));
+    for (k = keydefs; k; k = k->next)
+	if (keytrie_insert(k) < 0) {
+	    PRINTF("#too many key bindings, \"%s\" and later ones ignored.\n",
+		   k->name);
+	    break;
+	}
+    /* after the #binds, so that they win */
+    keytrie_insert(&paste_key);
+}
+
+/*
+ * return the node reached from node with byte c, 0 if none.
+ * Nodes are valid until keytrie_gen changes.
+ */
+int keytrie_next(int node, char c)
+{
+    if (ktrie_built != keytrie_gen)
+	keytrie_build();
+    return ktrie ? ktrie[node].next[(unsigned char)c] : 0;
+}
+
+/*
+ * return the key whose sequence ends at node, NULL if none
+ */
+keynode *keytrie_key(int node)
+{
+    return ktrie[node].key;
+}
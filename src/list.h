@@ -46,4 +46,9 @@ void delete_delaynode(delaynode **base);
 void delete_substnode(substnode **base);
 void delete_varnode(varnode **base, int type);
 
+#define KEYTRIE_ROOT 1
+extern int keytrie_gen;
+int      keytrie_next(int node, char c);
+keynode *keytrie_key(int node);
+
 #endif /* _LIST_H_ */
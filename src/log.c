@@ -16,6 +16,11 @@
 #include <string.h>
 #include <unistd.h>
 #include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include "defines.h"
 #include "main.h"
@@ -23,52 +28,120 @@
 #include "tty.h"
 #include "list.h"
 #include "utils.h"
+#include "logfile.h"
+#include "movie.h"
+#include "buffile.h"
+#include "tcp.h"
 
 vtime movie_last;		     /* time movie_file was last written */
-FILE *capturefile = (FILE *)NULL;    /* capture file or NULL */
-FILE *moviefile = (FILE *)NULL;	     /* movie file or NULL */
-FILE *recordfile = (FILE *)NULL;     /* record file or NULL */
+logfile *capturefile = NULL;	     /* capture file or NULL */
+logfile *moviefile = NULL;	     /* movie file or NULL */
+logfile *recordfile = NULL;	     /* record file or NULL */
 
 
+/*
+ * the circular buffer of #setvar buffer. Its header is in memhdr,
+ * or at the start of the #buffile when it is mapped from one:
+ * then what was received survives if powwow dies.
+ */
+static bufhdr memhdr;
+static bufhdr *bh = &memhdr;
 static char *datalist;		/* circular string list */
-static int datastart = 0;	/* index to first string start */
-static int dataend   = 0;	/* index one past last string end */
-static int datasize  = 0;	/* size of circular string list */
+static bufentry *loglist;	/* circular (index of string) list */
+static char *bufname;		/* the #buffile, or NULL */
+static long buflen;		/* bytes mapped from it, 0 if none */
 
-#define DATALEFT (datastart > dataend ? datastart - dataend - 2 : datastart ? \
-		MAX2(datastart - 1, datasize - dataend - 1) : datasize - dataend - 1)
+#define DATALEFT (bh->datastart > bh->dataend ? bh->datastart - bh->dataend - 2 : bh->datastart ? \
+		MAX2(bh->datastart - 1, bh->datasize - bh->dataend - 1) : bh->datasize - bh->dataend - 1)
 
-typedef struct logentry {
-    enum linetype kind;
-    long msecs;			/* millisecs to sleep if kind == SLEEP */
-    char *line;			/* pointer to string in "datalist" circular buffer */
-} logentry;
+#define LOGFULL (bh->logend == (bh->logstart ? bh->logstart - 1 : bh->logsize - 1))
 
-logentry *loglist;		/* circular (pointer to string) list */
+static moviewriter *movie_w;	/* formats what goes to moviefile */
 
-static int logstart = 0;	/* index to first loglist used */
-static int logend   = 0;	/* index one past last loglist used */
-static int logsize  = 0;	/* size of circular (pointer to string) list */
+#define MOVIE_KIND(kind) ((kind) == PROMPT ? MOVIE_PROMPT : MOVIE_LINE)
+#define MSECS(t) ((t).tv_sec * (long long)mSEC_PER_SEC + (t).tv_usec / uSEC_PER_mSEC)
 
-#define LOGFULL (logend == (logstart ? logstart - 1 : logsize - 1))
+static int movie_to_file(void *arg, const char *s, int len, int must)
+{
+    return must ? logfile_write_all(moviefile, s, len)
+		: logfile_write(moviefile, s, len);
+}
 
-static char *names[] = { NULL, "line", "prompt", "sleep" };
+/*
+ * moviefile was just opened: start writing to it,
+ * in the binary format if asked to
+ */
+void log_movie_begin(int binary)
+{
+    if (!(movie_w = movie_writer(binary, movie_to_file, NULL)))
+	errmsg("malloc");
+}
+
+/*
+ * moviefile is about to be closed. Binary movies end with their index.
+ */
+void log_movie_end(void)
+{
+    if (movie_w) {
+	movie_writer_end(movie_w);
+	movie_w = NULL;
+    }
+}
+
+/*
+ * #setvar logsize and logtime: when lf is due, go on in a new file.
+ * Movies get a writer of their own, that starts with a comment
+ * telling the time and the file before (as do captures).
+ */
+static void log_rotate(logfile *lf, moviewriter **w, movie_out out, void *arg)
+{
+    char old[BUFSIZE], note[BUFSIZE + 64], stamp[32];
+    time_t t;
+    int len;
+
+    if (!logfile_due(lf, !w))
+	return;
+    update_now();
+    if (logfile_rotate(lf, old, BUFSIZE) < 0) {
+	PRINTF("#cannot start a new file for \"%s\": %s\n",
+	       logfile_name(lf), strerror(errno));
+	return;
+    }
+    if (w && *w)
+	movie_writer_end(*w);
+    logfile_cut(lf);
+
+    t = now.tv_sec;
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&t));
+    if (!w) {
+	logfile_printf(lf, "#%s, continued from \"%s\"\n", stamp, old);
+	return;
+    }
+    if (!(*w = movie_writer(movie_binary_name(logfile_name(lf)), out, arg))) {
+	errmsg("malloc");
+	return;
+    }
+    /* "#0": no pause on it in powwow-muc */
+    len = sprintf(note, "#0 %s, continued from \"%s\"", stamp, old);
+    movie_put(*w, MOVIE_COMMENT, MSECS(now), 0, note, len);
+}
 
 /*
  * flush a single buffer line
  */
 static void log_flushline(int i)
 {
+    char *line = datalist + loglist[i].line;
+
+    log_rotate(capturefile, NULL, NULL, NULL);
+    if (moviefile)
+	log_rotate(moviefile, &movie_w, movie_to_file, NULL);
     if (capturefile)
-	fprintf(capturefile, "%s%s",
-		loglist[i].line, loglist[i].kind == LINE ? "\n" : "");
-    if (moviefile) {
-	if (loglist[i].msecs)
-	    fprintf(moviefile, "%s %ld\n",
-		    names[SLEEP], loglist[i].msecs);
-	fprintf(moviefile, "%s %s\n",
-		names[loglist[i].kind], loglist[i].line);
-    }
+	logfile_printf(capturefile, "%s%s",
+		       line, loglist[i].kind == LINE ? "\n" : "");
+    if (moviefile && movie_w)
+	movie_put(movie_w, MOVIE_KIND(loglist[i].kind), loglist[i].time,
+		  loglist[i].msecs, line, strlen(line));
 }
 
 /*
@@ -78,15 +151,15 @@ static void log_clearline(void)
 {
     int next;
 
-    if (logstart == logend)
+    if (bh->logstart == bh->logend)
 	return;
-    log_flushline(logstart);
+    log_flushline(bh->logstart);
 
-    next = (logstart + 1) % logsize;
-    if (next == logend)
-	datastart = dataend = logstart = logend = 0;
+    next = (bh->logstart + 1) % bh->logsize;
+    if (next == bh->logend)
+	bh->datastart = bh->dataend = bh->logstart = bh->logend = 0;
     else
-	datastart = loglist[next].line - datalist, logstart = next;
+	bh->datastart = loglist[next].line, bh->logstart = next;
 }
 
 /*
@@ -94,8 +167,8 @@ static void log_clearline(void)
  */
 void log_clearsleep(void)
 {
-    if (logstart != logend)
-	loglist[logstart].msecs = 0;
+    if (bh->logstart != bh->logend)
+	loglist[bh->logstart].msecs = 0;
 }
 
 /*
@@ -103,31 +176,111 @@ void log_clearsleep(void)
  */
 void log_flush(void)
 {
-    int i = logstart;
-    while (i != logend) {
+    int i = bh->logstart;
+    while (i != bh->logend) {
 	log_flushline(i);
-	if (++i == logsize)
+	if (++i == bh->logsize)
 	    i = 0;
     }
-    datastart = dataend = logstart = logend = 0;
+    bh->datastart = bh->dataend = bh->logstart = bh->logend = 0;
 }
 
 int log_getsize(void)
 {
-    return datasize;
+    return bh->datasize;
+}
+
+char *log_file(void)
+{
+    return bufname;
 }
 
 static void log_reset(void)
 {
-    if (datasize) {
+    if (buflen) {
+	munmap((void *)bh, buflen);
+	bh = &memhdr;
+	buflen = 0;
+    } else if (bh->datasize) {
 	if (datalist) free(datalist);
 	if (loglist)  free(loglist);
-	loglist = NULL;
-	datalist = NULL;
-	logsize = datasize = 0;
     }
+    loglist = NULL;
+    datalist = NULL;
+    memset(&memhdr, 0, sizeof(memhdr));
 }
 
+/* the buffer is in memory only */
+static void log_alloc(int newsize)
+{
+    datalist = (char *)malloc(newsize);
+    if (!datalist) { log_reset(); errmsg("malloc"); return; }
+
+    loglist = (bufentry *)malloc(newsize/16*sizeof(bufentry));
+    if (!loglist) { log_reset(); errmsg("malloc"); return; }
+
+    bh->datasize = newsize;
+    bh->logsize = newsize / 16;
+}
+
+/*
+ * map the buffer from file name. If it already holds a buffer
+ * of newsize bytes (or any size, if newsize is 0) keep what is in it,
+ * otherwise start an empty one. Return -1 on error, with errno set.
+ */
+static int log_map(char *name, int newsize)
+{
+    struct stat st;
+    bufhdr *h;
+    long len;
+    int fd, keep;
+
+    if ((fd = open(name, O_RDWR | O_CREAT, 0600)) < 0)
+	return -1;
+    if (fstat(fd, &st) < 0)
+	goto fail;
+    len = st.st_size;
+    keep = 0;
+    if (len >= BUF_HDRLEN && len == st.st_size) {
+	h = (bufhdr *)mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+	if (h != (bufhdr *)MAP_FAILED) {
+	    keep = buf_valid(h, len) && (!newsize || h->datasize == newsize);
+	    munmap((void *)h, len);
+	}
+    }
+    if (!keep) {
+	if (!newsize) {
+	    errno = EINVAL;
+	    goto fail;
+	}
+	len = BUF_FILELEN(newsize, newsize / 16);
+	/* zero the old content: it may be text from the last session */
+	if (ftruncate(fd, 0) < 0 || ftruncate(fd, len) < 0)
+	    goto fail;
+    }
+    h = (bufhdr *)mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (h == (bufhdr *)MAP_FAILED)
+	goto fail;
+    close(fd);
+
+    if (!keep) {
+	memcpy(h->magic, BUF_MAGIC, 8);
+	h->entrysize = sizeof(bufentry);
+	h->datasize = newsize;
+	h->logsize = newsize / 16;
+	h->datastart = h->dataend = h->logstart = h->logend = 0;
+    }
+    bh = h;
+    buflen = len;
+    loglist = BUF_ENTRIES(h);
+    datalist = BUF_DATA(h);
+    return 0;
+fail:
+    keep = errno;
+    close(fd);
+    errno = keep;
+    return -1;
+}
 
 void log_resize(int newsize)
 {
@@ -136,26 +289,84 @@ void log_resize(int newsize)
 	return;
     }
 
-    if (newsize == datasize)
+    if (newsize == bh->datasize)
 	return;
 
     log_flush();
     log_reset();
     if (newsize) {
-	datalist = (char *)malloc(newsize);
-	if (!datalist) { log_reset(); errmsg("malloc"); return; }
-
-	loglist = (logentry *)malloc(newsize/16*sizeof(logentry));
-	if (!loglist) { log_reset(); errmsg("malloc"); return; }
-
-	datasize = newsize;
-	logsize = newsize / 16;
+	if (bufname && log_map(bufname, newsize) < 0) {
+	    PRINTF("#error writing file \"%s\": %s, buffer kept in memory only\n",
+		   bufname, strerror(errno));
+	    free(bufname);
+	    bufname = NULL;
+	}
+	if (!bufname)
+	    log_alloc(newsize);
     }
     if (opt_info) {
 	PRINTF("#buffer resized to %d bytes%s\n", newsize, newsize ? "" : " (disabled)");
     }
 }
 
+/*
+ * keep the buffer in file name, or only in memory if name is NULL.
+ * Return -1 on error with errno set, EINVAL meaning the buffer has no size
+ */
+int log_setfile(char *name)
+{
+    int size = bh->datasize, err;
+
+    log_flush();
+    log_reset();
+    if (bufname) {
+	free(bufname);
+	bufname = NULL;
+    }
+    if (name) {
+	if (log_map(name, size) == 0) {
+	    if (!(bufname = my_strdup(name)))
+		errmsg("malloc");
+	    return 0;
+	}
+	err = errno;
+	if (size)
+	    log_alloc(size);
+	errno = err;
+	return -1;
+    }
+    if (size)
+	log_alloc(size);
+    return 0;
+}
+
+/*
+ * write to lf the lines in the buffer received between from and to
+ * millisecs ago (oldest first), without removing them.
+ * Return how many.
+ */
+int log_dump(logfile *lf, long long from, long long to)
+{
+    long long t;
+    char *line;
+    int i, n = 0;
+
+    update_now();
+    t = MSECS(now);
+    from = t - from;
+    to = t - to;
+    for (i = bh->logstart; i != bh->logend; i = (i + 1) % bh->logsize) {
+	if (loglist[i].time < from || loglist[i].time > to)
+	    continue;
+	line = datalist + loglist[i].line;
+	logfile_write_all(lf, line, strlen(line));
+	if (loglist[i].kind == LINE)
+	    logfile_write_all(lf, "\n", 1);
+	n++;
+    }
+    return n;
+}
+
 /*
  * add a single line to the buffer
  */
@@ -163,7 +374,7 @@ static void log_writeline(const char *line, int len, int kind, long msecs)
 {
     int dst;
 
-    if (++len >= datasize) {
+    if (++len >= bh->datasize) {
 	PRINTF("#line too long, discarded from movie/capture buffer\n");
 	return;
     }
@@ -171,23 +382,60 @@ static void log_writeline(const char *line, int len, int kind, long msecs)
 	log_clearline();
     /* ok, now we know there IS enough space */
 
-    if (datastart >= dataend /* is == iff loglist is empty */
-	|| datasize - dataend > len)
-	dst = dataend;
+    if (bh->datastart >= bh->dataend /* is == iff loglist is empty */
+	|| bh->datasize - bh->dataend > len)
+	dst = bh->dataend;
     else
 	dst = 0;
 
-    memcpy(loglist[logend].line = datalist + dst, line, len - 1);
+    memcpy(datalist + dst, line, len - 1);
     datalist[dst + len - 1] = '\0';
 
-    loglist[logend].kind = kind;
-    loglist[logend].msecs = msecs;
+    loglist[bh->logend].line = dst;
+    loglist[bh->logend].kind = kind;
+    loglist[bh->logend].msecs = msecs;
+    loglist[bh->logend].time = MSECS(now);
 
-    if ((dataend = dst + len) == datasize)
-	dataend = 0;
+    if ((bh->dataend = dst + len) == bh->datasize)
+	bh->dataend = 0;
 
-    if (++logend == logsize)
-	logend = 0;
+    if (++bh->logend == bh->logsize)
+	bh->logend = 0;
+}
+
+/*
+ * write str line by line to capture and through w to a movie
+ * (either can be NULL), diff millisecs after what they got last
+ */
+static void log_lines(logfile *capture, moviewriter *w, long diff,
+		      const char *str, int len, int newline)
+{
+    char *next;
+    int i, last = 0;
+
+    do {
+	if ((next = memchr(str, '\n', len))) {
+	    i = next - str;
+            newline = 1;
+        } else {
+	    i = len;
+            last = 1;
+	}
+
+	if (w)
+	    movie_put(w, MOVIE_KIND(last && !newline ? PROMPT : LINE),
+		      MSECS(now), diff, str, i);
+	if (capture) {
+	    logfile_printf(capture, "%.*s%s", i, str,
+			   newline ? "\n" : "");
+	    newline = 0;
+	}
+	diff = 0;
+	if (next) {
+	    len -= next + 1 - str;
+	    str = next + 1;
+	}
+    } while (next && len > 0);
 }
 
 /*
@@ -199,13 +447,21 @@ void log_write(const char *str, int len, int newline)
     long diff;
     int i, last = 0;
 
-    if (!datasize && !moviefile && !capturefile)
+    if (!bh->datasize && !moviefile && !capturefile)
 	return;
 
     update_now();
     diff = diff_vtime(&now, &movie_last);
     movie_last = now;
 
+    if (!bh->datasize) {
+	log_rotate(capturefile, NULL, NULL, NULL);
+	if (moviefile)
+	    log_rotate(moviefile, &movie_w, movie_to_file, NULL);
+	log_lines(capturefile, moviefile ? movie_w : NULL, diff,
+		  str, len, newline);
+	return;
+    }
     do {
 	if ((next = memchr(str, '\n', len))) {
 	    i = next - str;
@@ -214,25 +470,7 @@ void log_write(const char *str, int len, int newline)
 	    i = len;
             last = 1;
 	}
-
-	if (datasize)
-	    log_writeline(str, i, last && !newline ? PROMPT : LINE, diff);
-	else {
-	    if (moviefile) {
-		if (diff)
-		    fprintf(moviefile, "%s %ld\n",
-			names[SLEEP], diff);
-		fprintf(moviefile, "%s %.*s\n",
-			names[last && !newline ? PROMPT : LINE], i, str);
-	    }
-	    if (capturefile) {
-                fwrite(str, 1, i, capturefile);
-                if (newline) {
-                    fputc('\n', capturefile);
-                    newline = 0;
-                }
-            }
-	}
+	log_writeline(str, i, last && !newline ? PROMPT : LINE, diff);
 	diff = 0;
 	if (next) {
 	    len -= next + 1 - str;
@@ -241,6 +479,85 @@ void log_write(const char *str, int len, int newline)
     } while (next && len > 0);
 }
 
+/*
+ * #capture ##id and #movie ##id get what connection fd receives and
+ * is sent, and nothing else. The files are written by the same
+ * background thread as all the others, each through its own ring.
+ * #setvar buffer is not split by connection, so they start empty.
+ */
+static int conn_movie_to_file(void *arg, const char *s, int len, int must)
+{
+    logfile *lf = ((logstream *)arg)->movie;
+
+    return must ? logfile_write_all(lf, s, len) : logfile_write(lf, s, len);
+}
+
+/* the files of connection fd, created if needed. NULL if out of memory */
+logstream *log_conn(int fd)
+{
+    logstream **s = &CONN_LIST(fd).log;
+
+    if (!*s && !(*s = (logstream *)calloc(1, sizeof(logstream))))
+	errmsg("malloc");
+    return *s;
+}
+
+/* s->movie was just opened */
+void log_conn_movie_begin(logstream *s, int binary)
+{
+    if (!(s->movie_w = movie_writer(binary, conn_movie_to_file, s)))
+	errmsg("malloc");
+    update_now();
+    s->movie_last = now;
+}
+
+/* s->movie is about to be closed */
+void log_conn_movie_end(logstream *s)
+{
+    if (s->movie_w) {
+	movie_writer_end(s->movie_w);
+	s->movie_w = NULL;
+    }
+}
+
+void log_conn_write(int fd, const char *str, int len, int newline)
+{
+    logstream *s = CONN_LIST(fd).log;
+    long diff;
+
+    if (!s || (!s->capture && !s->movie))
+	return;
+    update_now();
+    diff = diff_vtime(&now, &s->movie_last);
+    s->movie_last = now;
+    log_rotate(s->capture, NULL, NULL, NULL);
+    if (s->movie)
+	log_rotate(s->movie, &s->movie_w, conn_movie_to_file, s);
+    log_lines(s->capture, s->movie ? s->movie_w : NULL, diff,
+	      str, len, newline);
+}
+
+/*
+ * connection fd is being closed: so are its files
+ */
+void log_conn_close(int fd)
+{
+    logstream *s = CONN_LIST(fd).log;
+
+    if (!s)
+	return;
+    if (opt_info && (s->capture || s->movie)) {
+	PRINTF("#end of %s of \"%s\" to file.\n",
+	       !s->movie ? "capture" : !s->capture ? "movie" :
+	       "capture and movie", CONN_LIST(fd).id);
+    }
+    log_conn_movie_end(s);
+    logfile_close(s->capture);
+    logfile_close(s->movie);
+    free(s);
+    CONN_LIST(fd).log = NULL;
+}
+
 static char reprintlist[BUFSIZE];	/* circular string list */
 static int  reprintstart = 0;		/* index to first string start */
 static int  reprintend   = 0;		/* index one past last string end */
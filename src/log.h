@@ -5,15 +5,33 @@
 
 enum linetype { EMPTY = 0, LINE = 1, PROMPT = 2, SLEEP = 3 };
 
-extern FILE *capturefile, *recordfile, *moviefile;
+extern logfile *capturefile, *recordfile, *moviefile;
 extern vtime movie_last;
 
+/* #capture ##id and #movie ##id: the files of a single connection */
+typedef struct logstream {
+    logfile *capture, *movie;
+    struct moviewriter *movie_w;	/* formats what goes to movie */
+    vtime movie_last;			/* time movie was last written */
+} logstream;
+
 void log_clearsleep(void);
+void log_movie_begin(int binary);
+void log_movie_end(void);
 void log_flush(void);
 int  log_getsize(void);
 void log_resize(int newsize);
+int  log_setfile(char *name);
+char *log_file(void);
+int  log_dump(logfile *lf, long long from, long long to);
 void log_write(const char *str, int len, int newline);
 
+logstream *log_conn(int fd);
+void log_conn_movie_begin(logstream *s, int binary);
+void log_conn_movie_end(logstream *s);
+void log_conn_write(int fd, const char *str, int len, int newline);
+void log_conn_close(int fd);
+
 void  reprint_writeline(char *line);
 char *reprint_getline(void);
 void  reprint_clear(void);
@@ -0,0 +1,912 @@
+/*
+ *  logfile.c  --  the files written by #capture, #movie and #record,
+ *                 and the thread writing them in the background
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#ifdef USE_PTHREAD
+# include <pthread.h>
+#endif
+#ifdef USE_ZLIB
+# include <zlib.h>
+#endif
+
+#include "defines.h"
+#include "main.h"
+#include "utils.h"
+#include "tty.h"
+#include "logfile.h"
+
+#ifndef HAVE_FDATASYNC
+# define fdatasync fsync
+#endif
+
+/*
+ * Each file has a ring of LOG_RING bytes. The main thread is the only one
+ * appending to it (moving head), the writer thread the only one emptying
+ * it (moving tail), so the ring itself needs no lock: just a barrier
+ * between copying the bytes and publishing the new head or tail.
+ * A record that does not fit is dropped rather than stopping the main loop
+ * behind a slow disk, and counted.
+ * Compression, when enabled, is done by the writer too.
+ *
+ * #setvar logsize and logtime rotate a file: the main thread renames it
+ * and opens a new one under its name, and the writer switches to it
+ * once the ring is written up to rot_at. Finishing the old file and
+ * compressing it (#setvar logzip) are also left to the writer,
+ * or to a thread of their own.
+ */
+struct logfile {
+    logfile *next;
+    int fd;
+    char *name;
+    char *ring;
+    volatile unsigned long head;	/* bytes ever appended */
+    volatile unsigned long tail;	/* bytes ever written */
+    unsigned long dropped;		/* records that did not fit */
+    volatile int error;			/* errno of a failed write() */
+    int reported;			/* error already printed */
+    int unsynced;			/* written since last fdatasync() */
+    vtime synced;
+    unsigned long started;		/* head when this file was started */
+    time_t opened;			/* and at what time */
+    time_t due;				/* when to rotate it for logtime */
+    int due_for;			/* the logtime due was computed for */
+    int midline;			/* last record did not end in newline */
+    volatile int rotating;		/* the writer has not switched yet */
+    unsigned long rot_at;		/* head when it was rotated */
+    int rot_fd;				/* the new file */
+    char *rot_name;			/* what the old one was renamed to */
+#ifdef USE_ZLIB
+    z_stream *z;			/* not NULL if compressing */
+    z_stream *rot_z;			/* the same, for the new file */
+    char *zbuf;
+    long zpending;			/* bytes compressed but not flushed */
+#endif
+};
+
+#define RING_MASK (LOG_RING - 1)
+#define LOG_ZBUF 16384		/* compressed bytes per write() */
+
+int log_sync = 0;		/* millisecs between fdatasync(), 0 = never */
+int log_size = 0;		/* bytes per #capture/#movie file, 0 = no limit */
+int log_time = 0;		/* seconds per #capture/#movie file, 0 = no limit */
+int log_zip = 0;		/* compress the files rotated out */
+
+static logfile *files;		/* all open files */
+static int log_dirty;		/* something appended since last kick */
+
+#ifdef USE_PTHREAD
+# define BARRIER() __sync_synchronize()
+
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  log_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  log_idle = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  log_zipped = PTHREAD_COND_INITIALIZER;
+static pthread_t log_thread;
+static int log_started;
+static int log_pid;		/* the process that owns the writer thread */
+static int log_pending;		/* the writer has something to do */
+static int log_passing;		/* the writer is going through files */
+static int log_syncnow;		/* fdatasync() every file in next pass */
+static int log_zipping;		/* files rotated out being compressed */
+
+# define WRITER_ALIVE() (log_started && log_pid == getpid())
+#else
+# define BARRIER() do { } while (0)
+#endif
+
+static long since(vtime *t)
+{
+    vtime n;
+
+    gettimeofday(&n, NULL);
+    return (n.tv_sec - t->tv_sec) * mSEC_PER_SEC +
+	(n.tv_usec - t->tv_usec) / uSEC_PER_mSEC;
+}
+
+/* write all of s to the file. Return -1 on error */
+static int logfile_out(logfile *lf, const char *s, long len)
+{
+    long n;
+
+    while (len > 0) {
+	n = write(lf->fd, s, len);
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n <= 0) {
+	    if (!lf->error)
+		lf->error = n < 0 ? errno : ENOSPC;
+	    return -1;
+	}
+	s += n, len -= n;
+	lf->unsynced = 1;
+    }
+    return 0;
+}
+
+#ifdef USE_ZLIB
+/* is the file to be compressed? */
+static int logfile_gzname(char *name)
+{
+    int len = strlen(name);
+    return len > 3 && !strcmp(name + len - 3, ".gz");
+}
+
+static int logfile_deflate(logfile *lf, char *s, long len, int flush)
+{
+    z_stream *z = lf->z;
+
+    z->next_in = (Bytef *)s;
+    z->avail_in = len;
+    do {
+	z->next_out = (Bytef *)lf->zbuf;
+	z->avail_out = LOG_ZBUF;
+	deflate(z, flush);
+	if (logfile_out(lf, lf->zbuf, LOG_ZBUF - z->avail_out) < 0)
+	    return -1;
+    } while (z->avail_out == 0);
+    lf->zpending = flush == Z_NO_FLUSH ? lf->zpending + len : 0;
+    return 0;
+}
+
+static void logfile_zend(logfile *lf)
+{
+    if (lf->z) {
+	logfile_deflate(lf, NULL, 0, Z_FINISH);
+	deflateEnd(lf->z);
+	free(lf->z);
+	lf->z = NULL;
+    }
+}
+
+/* start compressing a file. Return NULL on error */
+static z_stream *logfile_zstart(char *name)
+{
+    z_stream *z;
+
+    if (!(z = (z_stream *)malloc(sizeof(z_stream)))) {
+	errmsg("malloc");
+	return NULL;
+    }
+    memset(z, 0, sizeof(z_stream));
+    /* 15 + 16: gzip header and trailer instead of zlib ones */
+    if (deflateInit2(z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16,
+		     8, Z_DEFAULT_STRATEGY) != Z_OK) {
+	PRINTF("#cannot start compressing \"%s\"\n", name);
+	free(z);
+	return NULL;
+    }
+    return z;
+}
+
+/*
+ * compress the file name to "name.gz" and remove it. On error, remove
+ * "name.gz" instead. Return -1 on error
+ */
+static int logfile_gzip(char *name)
+{
+    char buf[LOG_ZBUF], *gzname;
+    gzFile gz;
+    int fd, n, err;
+
+    if (!(gzname = (char *)malloc(strlen(name) + 4)))
+	return -1;
+    sprintf(gzname, "%s.gz", name);
+    if ((fd = open(name, O_RDONLY)) < 0) {
+	free(gzname);
+	return -1;
+    }
+    if (!(gz = gzopen(gzname, "wb"))) {
+	close(fd);
+	free(gzname);
+	return -1;
+    }
+    while ((n = read(fd, buf, LOG_ZBUF)) > 0)
+	if (gzwrite(gz, buf, n) != n)
+	    break;
+    err = n != 0;
+    close(fd);
+    if (gzclose(gz) != Z_OK)
+	err = 1;
+    unlink(err ? gzname : name);
+    free(gzname);
+    return err ? -1 : 0;
+}
+
+#ifdef USE_PTHREAD
+static void *logfile_zipper(void *arg)
+{
+    logfile_gzip((char *)arg);
+    free(arg);
+    pthread_mutex_lock(&log_lock);
+    if (!--log_zipping)
+	pthread_cond_broadcast(&log_zipped);
+    pthread_mutex_unlock(&log_lock);
+    return NULL;
+}
+#endif
+
+/*
+ * compress a file rotated out (name is malloc()ed, and freed here):
+ * in a thread of its own, not to hold up the writer
+ */
+static void logfile_zip(char *name)
+{
+#ifdef USE_PTHREAD
+    pthread_attr_t attr;
+    pthread_t t;
+    int err = -1;
+
+    if (WRITER_ALIVE()) {
+	pthread_mutex_lock(&log_lock);
+	log_zipping++;
+	pthread_mutex_unlock(&log_lock);
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	err = pthread_create(&t, &attr, logfile_zipper, name);
+	pthread_attr_destroy(&attr);
+	if (err == 0)
+	    return;
+	pthread_mutex_lock(&log_lock);
+	log_zipping--;
+	pthread_mutex_unlock(&log_lock);
+    }
+#endif
+    logfile_gzip(name);
+    free(name);
+}
+#endif /* USE_ZLIB */
+
+/*
+ * the ring of lf is written up to rot_at: finish the old file,
+ * and go on with the new one
+ */
+static void logfile_switch(logfile *lf)
+{
+    char *name = lf->rot_name;
+
+#ifdef USE_ZLIB
+    logfile_zend(lf);
+    lf->z = lf->rot_z;
+    lf->rot_z = NULL;
+    lf->zpending = 0;
+#endif
+    if (lf->unsynced && log_sync > 0)
+	fdatasync(lf->fd);
+    close(lf->fd);
+    lf->fd = lf->rot_fd;
+    lf->unsynced = 0;
+    gettimeofday(&lf->synced, NULL);
+    lf->rot_name = NULL;
+    BARRIER();
+    lf->rotating = 0;
+
+#ifdef USE_ZLIB
+    if (log_zip && !logfile_gzname(name)) {
+	logfile_zip(name);
+	return;
+    }
+#endif
+    free(name);
+}
+
+/* write the ring of lf from t to h. Return up to where */
+static unsigned long logfile_ring(logfile *lf, unsigned long t, unsigned long h)
+{
+    long chunk;
+    int err;
+
+    while (t != h) {
+	chunk = MIN2(h - t, LOG_RING - (t & RING_MASK));
+#ifdef USE_ZLIB
+	if (lf->z)
+	    err = logfile_deflate(lf, lf->ring + (t & RING_MASK), chunk, Z_NO_FLUSH);
+	else
+#endif
+	    err = logfile_out(lf, lf->ring + (t & RING_MASK), chunk);
+	if (err < 0)
+	    return h;		/* throw it away, or the ring stays full */
+	t += chunk;
+    }
+    return t;
+}
+
+/*
+ * write everything in the ring of lf, in as few write() as possible,
+ * compressing it if needed. Compressed text is flushed (so that it can
+ * be read, and survives a crash) when sync or idle are set, and at least
+ * every LOG_ZBLOCK bytes. Records are never split across passes,
+ * so it is always flushed at a line boundary.
+ * Switches to the new file of a rotation when it gets there.
+ * Called by the writer thread (or by the main one, if there is no thread).
+ */
+static void logfile_drain(logfile *lf, int sync, int idle)
+{
+    unsigned long h = lf->head, t = lf->tail;
+
+    BARRIER();
+    if (lf->rotating) {
+	BARRIER();
+	if (lf->rot_at - t <= h - t) {
+	    t = logfile_ring(lf, t, lf->rot_at);
+	    logfile_switch(lf);
+	}
+    }
+    t = logfile_ring(lf, t, h);
+    BARRIER();
+    lf->tail = t;
+
+#ifdef USE_ZLIB
+    if (lf->z && lf->zpending &&
+	(sync || idle || lf->zpending >= LOG_ZBLOCK))
+	logfile_deflate(lf, NULL, 0, Z_SYNC_FLUSH);
+#endif
+
+    if (lf->unsynced && !lf->error &&
+	(sync || (log_sync > 0 && since(&lf->synced) >= log_sync))) {
+	fdatasync(lf->fd);
+	gettimeofday(&lf->synced, NULL);
+	lf->unsynced = 0;
+    }
+}
+
+#ifdef USE_PTHREAD
+
+static void *logfile_writer(void *arg)
+{
+    struct timespec ts;
+    struct timeval tv;
+    logfile *lf;
+    long wait;
+    int sync, idle, unsynced = 0, zpending = 0;
+
+    pthread_mutex_lock(&log_lock);
+    for (;;) {
+	idle = 0;
+	while (!log_pending) {
+	    /* wake up in time for the next fdatasync() or compressed flush */
+	    wait = unsynced && log_sync > 0 ? log_sync : 0;
+	    if (zpending && (!wait || wait > LOG_ZIDLE))
+		wait = LOG_ZIDLE;
+	    if (wait) {
+		gettimeofday(&tv, NULL);
+		ts.tv_sec = tv.tv_sec + wait / mSEC_PER_SEC;
+		ts.tv_nsec = tv.tv_usec * 1000 + (wait % mSEC_PER_SEC) * 1000000L;
+		if (ts.tv_nsec >= 1000000000L)
+		    ts.tv_sec++, ts.tv_nsec -= 1000000000L;
+		if (pthread_cond_timedwait(&log_wake, &log_lock, &ts) == ETIMEDOUT) {
+		    idle = 1;
+		    break;
+		}
+	    } else
+		pthread_cond_wait(&log_wake, &log_lock);
+	}
+	log_pending = 0;
+	log_passing = 1;
+	sync = log_syncnow;
+	log_syncnow = 0;
+	pthread_mutex_unlock(&log_lock);
+
+	/* the list does not change while log_passing is set */
+	for (unsynced = zpending = 0, lf = files; lf; lf = lf->next) {
+	    logfile_drain(lf, sync, idle);
+	    unsynced |= lf->unsynced;
+#ifdef USE_ZLIB
+	    zpending |= lf->zpending != 0;
+#endif
+	}
+
+	pthread_mutex_lock(&log_lock);
+	log_passing = 0;
+	pthread_cond_broadcast(&log_idle);
+    }
+    return NULL;
+}
+
+static void logfile_start(void)
+{
+    sigset_t all, old;
+
+    if (log_started)
+	return;
+    /* signals are for the main thread */
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    if (pthread_create(&log_thread, NULL, logfile_writer, NULL) == 0) {
+	log_started = 1;
+	log_pid = getpid();
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+/* wake up the writer */
+static void logfile_kick(int sync)
+{
+    pthread_mutex_lock(&log_lock);
+    log_pending = 1;
+    log_syncnow |= sync;
+    pthread_cond_signal(&log_wake);
+    pthread_mutex_unlock(&log_lock);
+}
+
+/*
+ * wait until the writer has written everything. Returns with log_lock held,
+ * so that the caller can change the list of files.
+ */
+static void logfile_wait(int sync)
+{
+    pthread_mutex_lock(&log_lock);
+    log_pending = 1;
+    log_syncnow |= sync;
+    pthread_cond_signal(&log_wake);
+    while (log_pending || log_passing)
+	pthread_cond_wait(&log_idle, &log_lock);
+}
+
+#endif /* USE_PTHREAD */
+
+/*
+ * write all files now, and optionally fdatasync() them.
+ * In a child of fork() there is no writer thread: do nothing.
+ */
+static void logfile_sync_all(int sync)
+{
+    logfile *lf;
+
+#ifdef USE_PTHREAD
+    if (log_started) {
+	if (WRITER_ALIVE()) {
+	    logfile_wait(sync);
+	    pthread_mutex_unlock(&log_lock);
+	}
+	return;
+    }
+#endif
+    for (lf = files; lf; lf = lf->next)
+	logfile_drain(lf, sync, 0);
+}
+
+/*
+ * append a record to lf. If the ring is full, drop it unless must is set:
+ * then wait for the ring to be written. A record longer than the whole
+ * ring is written directly. Return 0 if done, -1 if dropped.
+ */
+static int logfile_put(logfile *lf, const char *s, int len, int must)
+{
+    unsigned long h, used;
+    int i;
+
+    if (!lf || len <= 0)
+	return 0;
+    lf->midline = s[len - 1] != '\n';
+    h = lf->head;
+    used = h - lf->tail;
+    BARRIER();
+    if (len > LOG_RING - used) {
+#ifdef USE_PTHREAD
+	if (log_started && !must && len <= LOG_RING) {
+	    lf->dropped++;
+	    logfile_kick(0);
+	    return -1;
+	}
+	if (WRITER_ALIVE()) {
+	    logfile_wait(0);
+	    pthread_mutex_unlock(&log_lock);
+	} else
+#endif
+	/* no thread: write the ring, then the record if still too long */
+	logfile_drain(lf, 0, 0);
+	h = lf->head;
+	if (len > LOG_RING) {
+#ifdef USE_ZLIB
+	    if (lf->z)
+		logfile_deflate(lf, (char *)s, len, Z_NO_FLUSH);
+	    else
+#endif
+		logfile_out(lf, s, len);
+	    return 0;
+	}
+    }
+
+    i = MIN2(len, LOG_RING - (h & RING_MASK));
+    memcpy(lf->ring + (h & RING_MASK), s, i);
+    if (i < len)
+	memcpy(lf->ring, s + i, len - i);
+    BARRIER();
+    lf->head = h + len;
+    log_dirty = 1;
+
+#ifdef USE_PTHREAD
+    /* do not wait the end of the main loop if the ring is filling up */
+    if (log_started && h + len - lf->tail > LOG_RING / 2)
+	logfile_kick(0);
+#endif
+    return 0;
+}
+
+int logfile_write(logfile *lf, const char *s, int len)
+{
+    return logfile_put(lf, s, len, 0);
+}
+
+/* as logfile_write(), but never drop it */
+int logfile_write_all(logfile *lf, const char *s, int len)
+{
+    return logfile_put(lf, s, len, 1);
+}
+
+int logfile_printf(logfile *lf, const char *fmt, ...)
+{
+    char buf[BUFSIZE], *p = buf;
+    va_list ap;
+    int len, ret;
+
+    if (!lf)
+	return 0;
+    va_start(ap, fmt);
+    len = vsnprintf(buf, BUFSIZE, fmt, ap);
+    va_end(ap);
+    if (len >= BUFSIZE) {
+	if (!(p = (char *)malloc(len + 1))) {
+	    lf->dropped++;
+	    return -1;
+	}
+	va_start(ap, fmt);
+	vsnprintf(p, len + 1, fmt, ap);
+	va_end(ap);
+    }
+    ret = logfile_write(lf, p, len);
+    if (p != buf)
+	free(p);
+    return ret;
+}
+
+/*
+ * called once each time through the main loop: hand what was appended
+ * to the writer, and report errors it met.
+ */
+void logfile_poll(void)
+{
+    logfile *lf;
+
+#ifdef USE_PTHREAD
+    if (log_started && !WRITER_ALIVE())
+	return;
+#endif
+    if (log_dirty) {
+	log_dirty = 0;
+#ifdef USE_PTHREAD
+	if (log_started)
+	    logfile_kick(0);
+	else
+#endif
+	    for (lf = files; lf; lf = lf->next)
+		logfile_drain(lf, 0, 0);
+    }
+    for (lf = files; lf; lf = lf->next) {
+	if (lf->error && !lf->reported) {
+	    lf->reported = 1;
+	    PRINTF("#error writing file \"%s\": %s\n", lf->name,
+		   strerror(lf->error));
+	}
+    }
+}
+
+static void logfile_free(logfile *lf)
+{
+#ifdef USE_ZLIB
+    if (lf->zbuf)
+	free(lf->zbuf);
+    if (lf->rot_z) {
+	deflateEnd(lf->rot_z);
+	free(lf->rot_z);
+    }
+#endif
+    if (lf->rot_name) {
+	/* in a child of fork(), the writer never got to it */
+	close(lf->rot_fd);
+	free(lf->rot_name);
+    }
+    close(lf->fd);
+    free(lf->ring);
+    free(lf->name);
+    free(lf);
+}
+
+logfile *logfile_open(char *name, int append)
+{
+    struct stat st;
+    logfile *lf;
+    int fd;
+
+    fd = open(name, O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC), 0666);
+    if (fd < 0)
+	return NULL;
+    if (!(lf = (logfile *)malloc(sizeof(logfile))) ||
+	!(lf->ring = (char *)malloc(LOG_RING)) ||
+	!(lf->name = my_strdup(name))) {
+	errmsg("malloc");
+	if (lf) {
+	    if (lf->ring)
+		free(lf->ring);
+	    free(lf);
+	}
+	close(fd);
+	return NULL;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    lf->fd = fd;
+    lf->head = lf->tail = lf->dropped = 0;
+    lf->error = lf->reported = lf->unsynced = 0;
+    gettimeofday(&lf->synced, NULL);
+    /* appending: what the file holds counts for #setvar logsize */
+    lf->started = append && fstat(fd, &st) == 0 ? 0 - (unsigned long)st.st_size : 0;
+    lf->opened = lf->synced.tv_sec;
+    lf->due = 0;
+    lf->due_for = lf->midline = lf->rotating = 0;
+    lf->rot_name = NULL;
+
+#ifdef USE_ZLIB
+    /*
+     * "name.gz": write a gzip file. Appending to one adds a new member,
+     * which gzip reads as if it were a single file
+     */
+    lf->z = lf->rot_z = NULL;
+    lf->zbuf = NULL;
+    lf->zpending = 0;
+    if (logfile_gzname(name)) {
+	if (!(lf->zbuf = (char *)malloc(LOG_ZBUF))) {
+	    errmsg("malloc");
+	    logfile_free(lf);
+	    return NULL;
+	}
+	if (!(lf->z = logfile_zstart(name))) {
+	    logfile_free(lf);
+	    return NULL;
+	}
+    }
+#endif
+
+#ifdef USE_PTHREAD
+    logfile_start();
+    if (log_started) {
+	logfile_wait(0);
+	lf->next = files;
+	files = lf;
+	pthread_mutex_unlock(&log_lock);
+	return lf;
+    }
+#endif
+    lf->next = files;
+    files = lf;
+    return lf;
+}
+
+/*
+ * write everything appended to all files and fdatasync() them
+ */
+void logfile_flush(void)
+{
+    logfile_sync_all(1);
+    logfile_poll();
+}
+
+/*
+ * write the rest of lf and close it.
+ */
+void logfile_close(logfile *lf)
+{
+    logfile **p;
+
+    if (!lf)
+	return;
+#ifdef USE_PTHREAD
+    if (WRITER_ALIVE())
+	logfile_wait(0);
+    else if (!log_started)
+#endif
+	logfile_drain(lf, 0, 0);
+
+    for (p = &files; *p; p = &(*p)->next) {
+	if (*p == lf) {
+	    *p = lf->next;
+	    break;
+	}
+    }
+#ifdef USE_PTHREAD
+    if (WRITER_ALIVE())
+	pthread_mutex_unlock(&log_lock);
+#endif
+#ifdef USE_ZLIB
+    logfile_zend(lf);
+#endif
+    if (lf->error && !lf->reported)
+	PRINTF("#error writing file \"%s\": %s\n", lf->name,
+	       strerror(lf->error));
+    logfile_free(lf);
+}
+
+/*
+ * the first multiple of log_time seconds after t,
+ * counting from the midnight before it
+ */
+static time_t logfile_next(time_t t)
+{
+    struct tm tm = *localtime(&t);
+    time_t midnight;
+
+    tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+    tm.tm_isdst = -1;
+    midnight = mktime(&tm);
+    if (midnight == (time_t)-1 || midnight > t)
+	midnight = t;
+    return midnight + ((t - midnight) / log_time + 1) * log_time;
+}
+
+/*
+ * is it time for lf to go on in a new file, because of #setvar logsize
+ * or logtime? Not while the writer is still switching to the last one,
+ * and if lines is set, not in the middle of a line.
+ */
+int logfile_due(logfile *lf, int lines)
+{
+    if (!lf || lf->rotating || lf->rot_name || (lines && lf->midline))
+	return 0;
+    if (log_size > 0 && lf->head - lf->started >= (unsigned long)log_size)
+	return 1;
+    if (log_time > 0) {
+	if (lf->due_for != log_time) {
+	    lf->due = logfile_next(lf->opened);
+	    lf->due_for = log_time;
+	}
+	return now.tv_sec >= lf->due;
+    }
+    return 0;
+}
+
+/*
+ * the name lf gets when rotated out: the time it was started
+ * before its suffixes, as in "log-20010203-040506.txt.gz"
+ */
+static char *logfile_oldname(logfile *lf)
+{
+    char stamp[32], *base, *dot, *old;
+    struct stat st;
+    int n, len, gone;
+
+    base = strrchr(lf->name, '/');
+    base = base ? base + 1 : lf->name;
+    if (!*base || !(dot = strchr(base + 1, '.')))
+	dot = base + strlen(base);
+    strftime(stamp, sizeof(stamp), "-%Y%m%d-%H%M%S", localtime(&lf->opened));
+    if (!(old = (char *)malloc(strlen(lf->name) + strlen(stamp) + 16))) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    /* more than one in the same second: add a number (sorting after) */
+    for (n = 0; n < 1000; n++) {
+	sprintf(old, "%.*s%s", (int)(dot - lf->name), lf->name, stamp);
+	if (n)
+	    sprintf(old + strlen(old), "_%d", n);
+	strcat(old, dot);
+	if (lstat(old, &st) < 0 && errno == ENOENT) {
+	    /* nor the one compressed from it, for #setvar logzip */
+	    len = strlen(old);
+	    strcpy(old + len, ".gz");
+	    gone = lstat(old, &st) < 0 && errno == ENOENT;
+	    old[len] = '\0';
+	    if (gone)
+		return old;
+	}
+    }
+    free(old);
+    errno = EEXIST;
+    return NULL;
+}
+
+/*
+ * rename lf to the time it was started, and open a new file with its name.
+ * What is written to lf still goes to the old one, until logfile_cut().
+ * Return -1 on error, with errno set, and then try again only after
+ * another logsize bytes or logtime seconds.
+ * old gets the name of the old file.
+ */
+int logfile_rotate(logfile *lf, char *old, int size)
+{
+    char *name;
+    int fd, err;
+
+    if (!lf || lf->rotating || lf->rot_name) {
+	errno = EBUSY;
+	return -1;
+    }
+    name = logfile_oldname(lf);
+    lf->started = lf->head;
+    lf->opened = now.tv_sec;
+    lf->due_for = 0;
+    if (!name)
+	return -1;
+    if (rename(lf->name, name) < 0)
+	goto fail;
+    fd = open(lf->name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+	err = errno;
+	rename(name, lf->name);
+	errno = err;
+	goto fail;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+#ifdef USE_ZLIB
+    if (lf->z && !(lf->rot_z = logfile_zstart(lf->name))) {
+	close(fd);
+	rename(name, lf->name);
+	errno = ENOMEM;
+	goto fail;
+    }
+#endif
+    snprintf(old, size, "%s", name);
+    lf->rot_fd = fd;
+    lf->rot_name = name;
+    return 0;
+fail:
+    free(name);
+    return -1;
+}
+
+/*
+ * after logfile_rotate(): what was written to lf so far goes to the old
+ * file, the rest to the new one. The writer finishes the old one
+ * (and compresses it, for #setvar logzip) in the background.
+ */
+void logfile_cut(logfile *lf)
+{
+    if (!lf->rot_name || lf->rotating)
+	return;
+    lf->started = lf->rot_at = lf->head;
+    BARRIER();
+    lf->rotating = 1;
+    log_dirty = 1;
+}
+
+/*
+ * before exiting: wait for the files rotated out to be compressed
+ */
+void logfile_done(void)
+{
+#ifdef USE_PTHREAD
+    if (!WRITER_ALIVE())
+	return;
+    pthread_mutex_lock(&log_lock);
+    while (log_zipping)
+	pthread_cond_wait(&log_zipped, &log_lock);
+    pthread_mutex_unlock(&log_lock);
+#endif
+}
+
+char *logfile_name(logfile *lf)
+{
+    return lf->name;
+}
+
+unsigned long logfile_dropped(logfile *lf)
+{
+    return lf->dropped;
+}
@@ -0,0 +1,22 @@
+/* public things from logfile.c */
+
+#ifndef _LOGFILE_H_
+#define _LOGFILE_H_
+
+extern int log_sync, log_size, log_time, log_zip;
+
+logfile *logfile_open(char *name, int append);
+void  logfile_close(logfile *lf);
+int   logfile_write(logfile *lf, const char *s, int len);
+int   logfile_write_all(logfile *lf, const char *s, int len);
+int   logfile_printf(logfile *lf, const char *fmt, ...);
+void  logfile_flush(void);
+void  logfile_poll(void);
+int   logfile_due(logfile *lf, int lines);
+int   logfile_rotate(logfile *lf, char *old, int size);
+void  logfile_cut(logfile *lf);
+void  logfile_done(void);
+char *logfile_name(logfile *lf);
+unsigned long logfile_dropped(logfile *lf);
+
+#endif /* _LOGFILE_H_ */
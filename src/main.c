@@ -64,6 +64,7 @@
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/wait.h>
+#include <sys/ioctl.h>
 #include <memory.h>
 #include <unistd.h>
 
@@ -89,6 +90,8 @@ extern int select();
 #include "tty.h"
 #include "eval.h"
 #include "log.h"
+#include "logfile.h"
+#include "scrollback.h"
 
 /*     local function declarations       */
 #ifdef MOTDFILE
@@ -98,6 +101,8 @@ static void mainloop(void);
 static void exec_delays(void);
 static void prompt_reset_iac(void);
 static void get_remote_input(void);
+static void flush_partials(void);
+static int  partial_sleeptime(void);
 static void get_user_input(void);
 
 static int  search_action_or_prompt(char *line, char clearline, char copyprompt);
@@ -135,6 +140,7 @@ char opt_info = 1;	/* 0 if internal messages are suppressed */
 char opt_exit = 0;	/* 1 to autoquit when closing last conn. */
 char opt_history;	/* 1 if to save also history */
 char opt_words = 0;	/* 1 if to save also word completion list */
+char opt_mudwords = 1;	/* 1 if to complete also words seen in MUD output */
 char opt_compact = 0;	/* 1 if to clear prompt between remote messages */
 char opt_debug = 0;	/* 1 if to echo every line before executing it */
 char opt_speedwalk = 0;	/* 1 = speedwalk on */
@@ -142,11 +148,21 @@ char opt_wrap = 0;	/* 1 = word wrap active */
 char opt_autoprint = 0;	/* 1 = automatically #print lines matched by actions */
 char opt_reprint = 0;	/* 1 = reprint sent commands when we get a prompt */
 char opt_sendsize = 0;	/* 1 = send term size upon connect */
+char opt_split = 0;	/* 1 = keep prompt and input line below a scroll region */
+char opt_paste = 1;	/* 1 = use bracketed paste mode of the terminal */
+char opt_sendpaste = 0;	/* 1 = send multi-line pastes through the send queue */
 char opt_autoclear = 1;	/* 1 = clear input line before executing commands
 			 * from spawned programs.
 			 * if 0, spawned progs must #clear before printing
 			 */
 
+int partial_timeout = PARTIAL_TIMEOUT; /* millisecs to wait for the rest of
+					* a line splitted into different packets */
+int max_line = MAX_LINE_LEN;	/* longest line from remote hosts
+				 * kept in one piece (0 = unlimited) */
+int flood_limit = 0;		/* bytes waiting to be processed that start
+				 * flood mode (0 = never) */
+
 char hostname[BUFSIZE];
 int portnumber;
 static char powwow_dir[BUFSIZE];   /* default path to definition files */
@@ -179,6 +195,8 @@ char globptrok = 1|2;		   /* x&i = 0 if globptr[i] is in use */
 
 varnode *prompt;		   /* $prompt is always set */
 ptr marked_prompt;		   /* $prompt with marks added */
+static varnode *flood_skipped;	   /* @flood_skipped: lines not displayed
+				    * because of flood mode */
 static varnode *last_line;	   /* $line is always set to
 				    * the last line processed */
 
@@ -305,13 +323,14 @@ int main(int argc, char **argv)
     paramstk.curr = 0;
 
     /* allocate permanent variables */
-    if ((prompt = add_varnode("prompt", 1))
+    if ((prompt = add_permanent_varnode("prompt", 1))
 	&& (prompt->str = ptrnew(PARAMLEN))
 	&& (marked_prompt = ptrnew(PARAMLEN))
-	&& (last_line = add_varnode("last_line", 1))
+	&& (last_line = add_permanent_varnode("last_line", 1))
 	&& (last_line->str = ptrnew(PARAMLEN))
 	&& (globptr[0] = ptrnew(PARAMLEN))
 	&& (globptr[1] = ptrnew(PARAMLEN))
+	&& (flood_skipped = add_permanent_varnode("flood_skipped", 0))
 	&& !MEM_ERROR)
 	;
     else
@@ -330,6 +349,7 @@ int main(int argc, char **argv)
      */
     edit_bootstrap();
     tty_bootstrap();
+    tcp_bootstrap();
 
 #ifdef MOTDFILE
     printmotd();
@@ -474,6 +494,7 @@ static void printmotd(void)
 
 static void redraw_everything(void)
 {
+    split_update();
     if (prompt_status == 1 && line_status == 0)
 	line_status = 1;
     if (prompt_status == 1)
@@ -490,7 +511,7 @@ static void redraw_everything(void)
 static void compute_sleeptime(vtime **timeout)
 {
     static vtime tbuf;
-    int sleeptime = 0;
+    int sleeptime = 0, i;
 
     if (delays) {
 	update_now();
@@ -502,6 +523,18 @@ static void compute_sleeptime(vtime **timeout)
     if (flashback && (!sleeptime || sleeptime > FLASHDELAY))
 	sleeptime = FLASHDELAY;
 
+    /* an incomplete line from the MUD must be flushed */
+    if ((i = partial_sleeptime()) >= 0 && (!sleeptime || sleeptime > i))
+	sleeptime = i ? i : 1;
+
+    /* #send <file wants to send more lines, or typed chars are waiting */
+    if ((i = tcp_stream_sleeptime()) == 0 || tty_has_chars()) {
+	tbuf.tv_sec = tbuf.tv_usec = 0;
+	*timeout = &tbuf;
+	return;
+    } else if (i > 0 && (!sleeptime || sleeptime > i))
+	sleeptime = i;
+
     if (sleeptime) {
 	tbuf.tv_sec = sleeptime / mSEC_PER_SEC;
 	tbuf.tv_usec = (sleeptime % mSEC_PER_SEC) * uSEC_PER_mSEC;
@@ -522,12 +555,15 @@ static void mainloop(void)
     for (;;) {
 	tcp_fd = tcp_main_fd;
 	exec_delays();
+	flush_partials();
+	tcp_stream_run();
 
 	do {
 	    if (sig_pending)
 		sig_bottomhalf(); /* this might set errno... */
 
 	    tcp_flush();
+	    logfile_poll();	/* hand #capture and #movie to the writer */
 
 	    if (!(pos <= edlen)) {
 		PRINTF("\n#*ARGH* assertion failed (pos <= edlen): mail bpk@hoopajoo.net\n");
@@ -535,6 +571,8 @@ static void mainloop(void)
 	    }
 
 	    redraw_everything();
+	    /* passwords and char mode read raw bytes, no paste markers there */
+	    tty_set_paste(opt_paste && !(linemode & (LM_NOECHO | LM_CHAR)));
 	    tty_flush();
 
 	    compute_sleeptime(&timeout);
@@ -544,8 +582,6 @@ static void mainloop(void)
             readfds = fdset;
             err = select(tcp_max_fd+1, &readfds, NULL, NULL, timeout);
 
-	    prompt_reset_iac();
-
 	} while (err < 0 && errno == EINTR);
 
 	if (err < 0 && errno != EINTR)
@@ -553,6 +589,8 @@ static void mainloop(void)
 
 	if (flashback) putbackcursor();
 
+	tcp_stream_ready(&readfds);
+
 	/* process subsidiary and spawned connections first */
 	if (tcp_count > 1 || tcp_attachcount) {
 	    for (i=0; err && i<conn_max_index; i++) {
@@ -570,7 +608,7 @@ static void mainloop(void)
 	    tcp_fd = tcp_main_fd;
 	    get_remote_input();
 	}
-	if (FD_ISSET(tty_read_fd, &readfds)) {
+	if (FD_ISSET(tty_read_fd, &readfds) || tty_has_chars()) {
 	    tcp_fd = tcp_main_fd;
 	    confirm = 0;
 	    get_user_input();
@@ -656,37 +694,68 @@ static void exec_delays(void)
 }
 
 
-#define IAC_N 1024
-static char *iac_v[IAC_N];
-static int iac_f, iac_l;
+/*
+ * positions of IAC GA / IAC EOR (end of prompt) in the data
+ * just read from the connection being processed.
+ * They are valid only until get_remote_input() returns.
+ */
+static char **iac_v;
+static int iac_f, iac_l, iac_max;
 
 static void prompt_reset_iac(void)
 {
-	iac_f = iac_l = 0;
+    iac_f = iac_l = 0;
 }
 
 void prompt_set_iac(char *p)
 {
+    char **v;
+
     if (iac_f == iac_l)
 	iac_f = iac_l = 0;
 
-    if (iac_l < IAC_N)
-	iac_v[iac_l++] = p;
+    if (iac_l == iac_max) {
+	/* on failure, just forget the mark: prompt heuristics will do */
+	if (!(v = (char **)realloc(iac_v, (iac_max + 64) * sizeof(char *))))
+	    return;
+	iac_v = v;
+	iac_max += 64;
+    }
+    iac_v[iac_l++] = p;
 }
 
-static char *prompt_get_iac(void)
+/*
+ * return the first end-of-prompt mark inside the line
+ * and consume it, or NULL if there is none
+ */
+static char *prompt_get_iac(char *linestart, int len)
 {
-    return iac_l > iac_f ? iac_v[iac_f] : NULL;
+    char *p;
+
+    while (iac_l > iac_f && (p = iac_v[iac_f]) <= linestart + len) {
+	iac_f++;
+	if (p > linestart)
+	    return p;
+    }
+    return NULL;
 }
 
+static char *prompt_last_iac(void)
+{
+    return iac_l > iac_f ? iac_v[iac_l - 1] : NULL;
+}
 
-/* compute the effective prompt string; may end in \b* or \r */
+
+/*
+ * compute the effective prompt string; may end in \b* or \r
+ * works in place: the write position never passes the read position,
+ * and ESC [ K just forgets whatever was after the cursor.
+ */
 static void effective_prompt(void)
 {
     char *const pstr = promptstr;
-    char *dst = pstr;
     const size_t len = promptlen;
-    size_t pos = 0, maxpos = 0, p;
+    size_t pos = 0, maxpos = 0, p, nbs;
     for (p = 0; p < len; ++p) {
         char c = pstr[p];
         if (c == '\b') {
@@ -700,22 +769,15 @@ static void effective_prompt(void)
         }
         if (c == '\033'
             && len - p > 2 && pstr[p + 1] == '[' && pstr[p + 2] == 'K') {
-            if (dst == pstr)
-                dst = strdup(pstr);
             maxpos = pos;
-            memset(dst + pos, 0, len - pos);
             p += 2;
             continue;
         }
-        dst[pos++] = c;
+        pstr[pos++] = c;
         if (pos > maxpos)
             maxpos = pos;
     }
-    if (dst != pstr) {
-        memcpy(pstr, dst, pos);
-        free(dst);
-    }
-    size_t nbs = maxpos - pos;
+    nbs = maxpos - pos;
     if (nbs == 0)
         ;
     else if (pos == 0)
@@ -732,10 +794,14 @@ static int grab_prompt(char *linestart, int len, int islast)
     char *p;
     int is_iac_prompt = surely_isprompt = 0;
 
-    /* recognize IAC GA as end-of-prompt marker */
-    if ((CONN_LIST(tcp_fd).flags & IDPROMPT)) {
-	if ((p = prompt_get_iac()) && p > linestart && p <= linestart+len)
-	    iac_f++, is_iac_prompt = len = p - linestart;
+    /*
+     * recognize IAC GA / IAC EOR as end-of-prompt marker.
+     * If the host sends them, they are authoritative:
+     * the heuristics below are used only for the incomplete last line.
+     */
+    if ((CONN_LIST(tcp_fd).flags & (IDPROMPT | PROMPTMARK))) {
+	if ((p = prompt_get_iac(linestart, len)))
+	    is_iac_prompt = len = p - linestart;
 	else if (!islast)
 	    return 0;
     }
@@ -760,6 +826,7 @@ static int grab_prompt(char *linestart, int len, int islast)
 	} else if (!surely_isprompt && is_iac_prompt) {
             len = surely_isprompt = is_iac_prompt;
 	    prompt->str = ptrmcpy(prompt->str, linestart, len);
+	    STATUSLINE_VAR(1, prompt->index);
             effective_prompt();
 	    if (MEM_ERROR) { promptzero(); errmsg("malloc(prompt)"); return 0; }
 	    prompt_status = 1;
@@ -778,6 +845,7 @@ static int grab_prompt(char *linestart, int len, int islast)
     } else if (islast) {
 	prompt->str = ptrmcpy(prompt->str, linestart, len);
 	if (MEM_ERROR) { promptzero(); errmsg("malloc(prompt)"); return 0; }
+	STATUSLINE_VAR(1, prompt->index);
         effective_prompt();
 	prompt_status = 1; /* good, we got what to redraw */
     } else
@@ -787,6 +855,143 @@ static int grab_prompt(char *linestart, int len, int islast)
 }
 
 
+/*
+ * Flood mode: when too much text is waiting to be processed,
+ * the terminal is the bottleneck. Lines still go through #actions
+ * and logging, but are not printed: every FLOOD_SHOW millisecs
+ * and at the end of the flood only the last ones are shown,
+ * preceded by how many were skipped.
+ * Each connection has its own, so that a quiet one does not end
+ * the flood of another; text #emulated without one uses flood_none.
+ */
+typedef struct floodstate {
+    char on;				/* 1 if in flood mode */
+    long lines;				/* lines received since flood_show() */
+    vtime time;				/* when flood_show() was called */
+    ptr tail[FLOOD_TAIL];		/* last lines received, "##id> " included */
+    int next, kept;			/* where the next goes, how many */
+} floodstate;
+
+static floodstate flood_none;
+
+/* the flood state of connection fd, created if create is set */
+static floodstate *flood_get(int fd, int create)
+{
+    floodstate **f;
+
+    if (fd < 0 || !CONN_LIST(fd).id)
+	return &flood_none;
+    f = &CONN_LIST(fd).flood;
+    if (!*f && create && !(*f = (floodstate *)calloc(1, sizeof(floodstate))))
+	errmsg("malloc");
+    return *f;
+}
+
+static void flood_show(floodstate *f, int fd)
+{
+    int n = f->kept, i;
+
+    if (n > lines - 2)
+	n = lines > 2 ? lines - 2 : 0;
+    if ((f->lines -= n) > 0) {
+	flood_skipped->num += f->lines;
+	STATUSLINE_VAR(0, flood_skipped->index);
+	if (line0 < lines - 1)
+	    line0++;
+	if (f != &flood_none && fd != tcp_main_fd)
+	    tty_printf("#flood on \"%s\": %ld line%s not shown.\n",
+		       CONN_LIST(fd).id, f->lines, f->lines == 1 ? "" : "s");
+	else
+	    tty_printf("#flood: %ld line%s not shown.\n", f->lines,
+		       f->lines == 1 ? "" : "s");
+    }
+    for (i = f->next - n; n; n--, i++) {
+	if (line0 < lines - 1)
+	    line0++;
+	smart_print(ptrdata(f->tail[(i + FLOOD_TAIL) % FLOOD_TAIL]), 1);
+    }
+    f->lines = f->kept = 0;
+    update_now();
+    f->time = now;
+}
+
+/*
+ * remember a line not printed because of flood mode,
+ * with the "##id> " of sub connections
+ */
+static void flood_keep(floodstate *f, char *line)
+{
+    ptr *p = &f->tail[f->next];
+
+    if (tcp_fd >= 0 && tcp_fd != tcp_main_fd) {
+	*p = ptrmcpy(*p, "##", 2);
+	*p = ptrmcat(*p, CONN_LIST(tcp_fd).id, strlen(CONN_LIST(tcp_fd).id));
+	*p = ptrmcat(*p, "> ", 2);
+	*p = ptrmcat(*p, line, strlen(line));
+    } else
+	*p = ptrmcpy(*p, line, strlen(line));
+    if (MEM_ERROR) {
+	error = 0;
+	flood_skipped->num++;
+	return;
+    }
+    f->next = (f->next + 1) % FLOOD_TAIL;
+    if (f->kept < FLOOD_TAIL)
+	f->kept++;
+    f->lines++;
+
+    update_now();
+    if (diff_vtime(&now, &f->time) >= FLOOD_SHOW)
+	flood_show(f, tcp_fd);
+}
+
+/*
+ * start or stop flood mode for the connection being processed,
+ * looking at how much text is still waiting to be read from fd
+ * (-1 if no more text is coming).
+ * Call only when it is possible to print on screen.
+ */
+void flood_check(int fd)
+{
+    floodstate *f;
+    int n = 0;
+
+    if (fd < 0 || ioctl(fd, FIONREAD, &n) < 0)
+	n = 0;
+    if (!(f = flood_get(tcp_fd, flood_limit && n > flood_limit)))
+	return;
+    if (!f->on) {
+	if (flood_limit && n > flood_limit) {
+	    f->on = 1;
+	    f->lines = f->kept = 0;
+	    update_now();
+	    f->time = now;
+	}
+    } else if (!flood_limit || n <= flood_limit / 4) {
+	f->on = 0;
+	flood_show(f, tcp_fd);
+    }
+}
+
+/*
+ * connection fd is being closed: end its flood, if any
+ */
+void flood_close(int fd)
+{
+    floodstate *f = flood_get(fd, 0);
+    int i;
+
+    if (!f || f == &flood_none)
+	return;
+    if (f->on)
+	flood_show(f, fd);
+    for (i = 0; i < FLOOD_TAIL; i++) {
+	ptrdel(f->tail[i]);
+    }
+    free(f);
+    CONN_LIST(fd).flood = NULL;
+}
+
 /*
  * process remote input one line at time. stop at "\n".
  */
@@ -794,6 +999,7 @@ static void process_singleline(char **pbuf, int *psize)
 {
     int size, len = 0;
     char *wasn = 0, *buf, *linestart = *pbuf, *lineend, *end = *pbuf + *psize;
+    floodstate *fs;
 
     if ((lineend = memchr(linestart, '\n', *psize))) {
 	/* ok, there is a newline */
@@ -805,6 +1011,9 @@ static void process_singleline(char **pbuf, int *psize)
     if (!lineend)
 	/* line continues till end of buffer, no trailing \n */
 	buf = lineend = end;
+    else
+	scrollback_add(tcp_fd != -1 ? CONN_LIST(tcp_fd).id : NULL,
+		       linestart, lineend - linestart);
 
     size = buf - linestart;
 
@@ -858,18 +1067,24 @@ static void process_singleline(char **pbuf, int *psize)
 		/* set $last_line */
 		last_line->str = ptrmcpy(last_line->str, linestart, strlen(linestart));
 		if (MEM_ERROR) { print_error(error); return; }
+		STATUSLINE_VAR(1, last_line->index);
 
 		if (lineend > linestart && (len = grab_prompt(linestart, lineend-linestart, 0)))
 		    size = len;
 	    }
 	}
 	if (!len && ((!search_action(linestart, 0) || opt_autoprint))) {
-	    if (line0 < lines - 1)
-		line0++;
-	    if (tcp_fd != tcp_main_fd)        /* sub connection */
-		tty_printf("##%s> ", CONN_LIST(tcp_fd).id);
+	    if ((fs = flood_get(tcp_fd, 0)) && fs->on)
+		flood_keep(fs, linestart);
+	    else {
+		if (line0 < lines - 1)
+		    line0++;
+		if (tcp_fd >= 0 && tcp_fd != tcp_main_fd) /* sub connection */
+		    tty_printf("##%s> ", CONN_LIST(tcp_fd).id);
 
-	    smart_print(linestart, 1);
+		smart_print(linestart, 1);
+		put_seen_words(linestart);
+	    }
 	}
     }
 
@@ -884,106 +1099,63 @@ static void process_singleline(char **pbuf, int *psize)
 }
 
 /*
- * Code to merge lines from host that were splitted
- * into different packets: it is a horrible kludge (sigh)
- * and can be used only on one connection at time.
- * We currently do it on main connection.
- *
- * Note that this code also works for _prompts_ splitted into
- * different packets, as long as no #prompts execute #isprompt
- * on an incomplete prompt (as stated in the docs).
+ * Text arrived on main connection while a prompt is on screen.
+ * If shown != 0, the prompt is the first shown chars of buf, i.e.
+ * an incomplete line we displayed while waiting for the rest of it.
+ * Return how many chars of buf have been dealt with.
  */
-static int process_first_fragment(char *buf, int got)
+static int end_prompt(char *buf, int shown)
 {
-    int processed = 0;
-
-    /*
-     * Don't merge if the first part of the line was intercepted
-     * by a #prompt action which executed #isprompt
-     * (to avoid intercepting it twice)
-     */
-    if (*buf == '\n') {
-	char deleteprompt = 0, matched = 0;
-
-	if (opt_compact) {
-	    /* in compact mode, skip the first \n */
-	    deleteprompt = 1;
-	    processed++;
-	}
+    char matched = 0;
 
+    if (buf[shown] == '\n') {
 	/*
 	 * the prompt was actually a complete line.
-	 * no need to put it on the top of received data.
 	 * unless #isprompt was executed, demote it to a regular line,
 	 * match #actions on it, copy it in last_line.
 	 */
 	if (!surely_isprompt) {
 	    last_line->str = ptrcpy(last_line->str, prompt->str);
-	    if (MEM_ERROR) { print_error(error); return 0; }
+	    if (MEM_ERROR) { print_error(error); return shown; }
+	    STATUSLINE_VAR(1, last_line->index);
 
 	    /*
-	     * Kludge for kludge: don't delete the old prompt immediately.
+	     * Don't delete the old prompt immediately.
 	     * Instead, match actions on it first.
 	     * If it matches, clear the line before running the action
 	     * (done by the "1" in search_action() )
 	     * If it doesn't match, delete it only if opt_compact != 0
 	     */
-
 	    matched = search_action(promptstr, 1);
 	}
 	if (!matched)
-	    clear_input_line(deleteprompt);
+	    clear_input_line(opt_compact);
 	status(-1);
-    } else {
-	/*
-	 * try to merge the prompt with the first line in buf
-	 * (assuming we have a line splitted into those parts)
-	 * then clear the prompt.
-	 */
-	char *lineend, *spinning = NULL;
-
-	/* find the end of the first line. include the final newline. */
-	if ((lineend = strchr(buf, '\n')))
-	    lineend++;
-	else
-	    lineend = buf + got;
 
-	if (surely_isprompt) {
-	    /*
-	     * either #isprompt _was_ executed,
-	     * or we got a MUME spinning bar.
-	     * in both cases, don't try to merge.
-	     *
-	     * print a newline (to keep the old prompt on screen)
-	     * only if !opt_compact and we didn't get a MUME spinning bar.
-	     */
-	    clear_input_line(opt_compact);
-	    if (!spinning && !opt_compact)
-		tty_putc('\n'), col0 = 0;
-	    promptzero();
-       	} else {
-	    ptr *pp, p = (ptr)0;
-	    char *dummy;
-	    int dummyint;
-
-	    /* ok, merge this junk with the prompt */
-	    TAKE_PTR(pp, p);
-	    *pp = ptrcpy(*pp, prompt->str);
-	    *pp = ptrmcat(*pp, buf, lineend - buf);
-
-	    if (MEM_ERROR) { print_error(error); return 0; }
-	    if (!*pp)
-		return 0;
-	    dummy = ptrdata(*pp);
-	    dummyint = ptrlen(*pp);
-	    /* this also sets last_line or prompt->str : */
-	    clear_input_line(1);
-	    process_singleline(&dummy, &dummyint);
+	/* in compact mode, skip the \n too */
+	return shown + (opt_compact ? 1 : 0);
+    }
 
-	    processed = lineend - buf;
-	}
+    if (shown) {
+	/*
+	 * the prompt was just the first part of a line:
+	 * clear it, the whole line will be processed together
+	 */
+	clear_input_line(1);
+	promptzero();
+	return 0;
     }
-    return processed;
+
+    /*
+     * a real prompt (#isprompt was executed or IAC GA was received).
+     * print a newline (to keep the old prompt on screen)
+     * only if !opt_compact
+     */
+    clear_input_line(opt_compact);
+    if (!opt_compact)
+	tty_putc('\n'), col0 = 0;
+    promptzero();
+    return 0;
 }
 
 /*
@@ -1013,131 +1185,370 @@ static void common_clear(int newline)
 }
 
 /*
- * get data from the socket and process/display it.
+ * start waiting partial_timeout millisecs for the rest
+ * of the incomplete line of c
  */
-static void get_remote_input(void)
+static void partial_wait(connsess *c)
 {
-    char buffer[BUFSIZE + 2];        /* allow for a terminating \0 later */
-    char *buf = buffer, *newline;
-    int got, otcp_fd, i;
+    update_now();
+    c->partial_time.tv_sec = now.tv_sec + partial_timeout / mSEC_PER_SEC;
+    c->partial_time.tv_usec = now.tv_usec
+	+ (partial_timeout % mSEC_PER_SEC) * uSEC_PER_mSEC;
+    if (c->partial_time.tv_usec >= uSEC_PER_SEC) {
+	c->partial_time.tv_sec++;
+	c->partial_time.tv_usec -= uSEC_PER_SEC;
+    }
+}
 
-    if (CONN_LIST(tcp_fd).fragment) {
-	if ((i = strlen(CONN_LIST(tcp_fd).fragment)) >= BUFSIZE-1) {
-	    i = 0;
-	    common_clear(promptlen && !opt_compact);
-	    tty_printf("#error: ##%s : line too long, discarded\n", CONN_LIST(tcp_fd).id);
-	} else {
-	    buf += i;
-	    memcpy(buffer, CONN_LIST(tcp_fd).fragment, i);
+/*
+ * take the partial line buffer away from connection fd:
+ * #actions run while we process it may close the connection
+ */
+static char *partial_take(int fd, int *len, int *max, int *shown)
+{
+    connsess *c = &CONN_LIST(fd);
+    char *buf = c->partial;
+
+    *len = c->partial_len;
+    *max = c->partial_max;
+    *shown = c->partial_shown;
+    c->partial = NULL;
+    c->partial_len = c->partial_max = c->partial_shown = 0;
+    c->partial_time.tv_sec = 0;
+    return buf;
+}
+
+/*
+ * give the partial line buffer back to connection fd,
+ * keeping the first len chars of it
+ */
+static void partial_give(int fd, char *buf, int len, int max)
+{
+    connsess *c;
+
+    if (fd != -1 && (c = &CONN_LIST(fd))->id && !c->partial) {
+	c->partial = buf;
+	c->partial_len = len;
+	c->partial_max = max;
+	if (!len && max > PARTIAL_KEEP) {
+	    /* do not hold on to the memory used by a huge line */
+	    free(buf);
+	    c->partial = NULL;
+	    c->partial_max = 0;
 	}
-	free(CONN_LIST(tcp_fd).fragment);
-	CONN_LIST(tcp_fd).fragment = 0;
+	if (len && !c->partial_shown && !(c->flags & SPAWN))
+	    partial_wait(c);
     } else
-	i = 0;
+	free(buf);
+}
+
+/*
+ * read more data from connection c, after its partial line.
+ * return number of chars read (0 on error or if connection was closed).
+ */
+static int partial_read(connsess *c)
+{
+    char *buf;
+    int max = c->partial_len + BUFSIZE + 2;
+
+    if (c->partial_max < max) {
+	/* grow geometrically, lines of some megabytes are not unheard of */
+	if (max < c->partial_max * 2)
+	    max = c->partial_max * 2;
+	if (!(buf = (char *)realloc(c->partial, max))) {
+	    errmsg("malloc");
+	    return 0;
+	}
+	c->partial = buf;
+	c->partial_max = max;
+    }
+    return tcp_read(c->fd, c->partial + c->partial_len, BUFSIZE);
+}
+
+/*
+ * find the end of the last complete line in buf, looking only
+ * at new data after the first old chars. return 0 if none
+ */
+static int partial_end(char *buf, int old, int size)
+{
+    char *p;
+    for (p = buf + size; p > buf + old && p[-1] != '\n'; p--)
+	;
+    return p > buf + old ? p - buf : 0;
+}
+
+/*
+ * get data from a spawned command and execute it as if typed
+ */
+static void get_spawn_input(void)
+{
+    connsess *c = &CONN_LIST(tcp_fd);
+    char *buf, *line, *newline;
+    int fd = tcp_fd, got, old, size, max, end, shown;
 
-    got = tcp_read(tcp_fd, buf, BUFSIZE - i);
-    if (!got)
+    old = c->partial_len;
+    if (!(got = partial_read(c)))
 	return;
 
-    buf[got]='\0';  /* Safe, there is space. Do it now not to forget it later */
+    buf = c->partial;
+    size = old + got;
+    buf[size] = '\0';  /* Safe, there is space. */
     received += got;
 
-#ifdef DEBUGCODE
-    /* debug code to see in detail what strange codes come from the server */
-    {
-	char c, *t;
-	newline = buf + got;
-	tty_printf("%s{", edattrend);
-	for (t = buf; t < newline; t++) {
-	    if ((c = *t) < ' ' || c > '~')
-		tty_printf("[%d]", c);
-	    else tty_putc(c);
-	}
-	tty_puts("}\n");
+    if (!(c->flags & ACTIVE)) {
+	/* process only active connections */
+	c->partial_len = old;
+	return;
     }
-#endif
 
-    if (!(CONN_LIST(tcp_fd).flags & ACTIVE))
-	return; /* process only active connections */
+    if (!(end = partial_end(buf, old, size))) {
+	c->partial_len = size;
+	if (max_line && size > max_line) {
+	    common_clear(promptlen && !opt_compact);
+	    tty_printf("#error: ##%s : line too long, discarded\n", c->id);
+	    c->partial_len = 0;
+	}
+	return;
+    }
 
-    got += (buf - buffer);
-    buf = buffer;
+    buf = partial_take(fd, &size, &max, &shown);
+    size = old + got;
+    tcp_fd = tcp_main_fd;
 
-    if (CONN_LIST(tcp_fd).flags & SPAWN) {
-	/* this is data from a spawned child or an attached program.
-	 * execute as if typed */
-	otcp_fd = tcp_fd;
-	tcp_fd = tcp_main_fd;
+    if (opt_autoclear && line_status == 0) {
+	common_clear(!opt_compact);
+    }
+    for (line = buf; line < buf + end; line = newline + 1) {
+	newline = memchr(line, '\n', buf + end - line);
+	*newline = '\0';
+	if (opt_info) {
+	    if (line_status == 0) {
+		common_clear(!opt_compact);
+	    }
+	    tty_printf("##%s [%s]\n", CONN_LIST(fd).id ? CONN_LIST(fd).id : "", line);
+	}
+	/* parse_user_input() may use strtok(): newline was found before */
+	parse_user_input(line, 0);
+    }
 
-	if ((newline = strchr(buf, '\n'))) {
-	    /* instead of newline = strtok(buf, "\n") */
-	    *newline = '\0';
+    if ((size -= end) > 0) {
+	/*
+	 * keep last fragment for later, when spawned command will
+	 * (hopefully) send the rest of the text
+	 */
+	memmove(buf, buf + end, size);
+	buf[size] = '\0';
 
-	    if (opt_autoclear && line_status == 0) {
+	if (opt_info) {
+	    if (line_status == 0) {
 		common_clear(!opt_compact);
 	    }
-	    do {
-		if (opt_info) {
-		    if (line_status == 0) {
-			common_clear(!opt_compact);
-		    }
-		    tty_printf("##%s [%s]\n", CONN_LIST(otcp_fd).id, buf);
-		}
-		parse_user_input(buf, 0);
-		/*
-		 * strtok() may have been used in parse_user_input()...
-		 * cannot rely it refers on what we may have set above.
-		 * (it causes a bug in #spawned commands if they
-		 * evaluate (attr(), noattr) or they #connect ... )
-		 * so do it manually.
-		 */
-		/*
-		 * buf = strtok(NULL, "\n");
-		 */
-		if ((buf = newline) &&
-		    (newline = strchr(++buf, '\n')))
-			*newline = '\0';
-	    } while (buf && newline);
+	    tty_printf("#warning: ##%s : unterminated [%s]\n",
+		       CONN_LIST(fd).id ? CONN_LIST(fd).id : "", buf);
 	}
+    }
+    tcp_fd = fd;
+    partial_give(fd, buf, size, max);
+}
 
-	if (buf && *buf && !newline) {
-	    /*
-	     * save last fragment for later, when spawned command will
-	     * (hopefully) send the rest of the text
-	     */
-	    CONN_LIST(otcp_fd).fragment = my_strdup(buf);
+/*
+ * the incomplete line buf of tcp_fd must be processed now:
+ * on main connection it becomes the prompt (and if keep != 0 we keep it
+ * until the rest of the line arrives, unless #isprompt was executed),
+ * on other connections it is printed as a line.
+ * buf must have room for a final \0 at buf[len].
+ * return how many chars of buf must be kept.
+ */
+static int partial_flush(char *buf, int len, int keep)
+{
+    buf[len] = '\0';
+    process_remote_input(buf, len);
 
-	    if (opt_info) {
-		if (line_status == 0) {
-		    common_clear(!opt_compact);
-		}
-		tty_printf("#warning: ##%s : unterminated [%s]\n", CONN_LIST(otcp_fd).id, buf);
-	    }
+    if (keep && tcp_fd != -1 && tcp_fd == tcp_main_fd && !surely_isprompt && promptlen) {
+	CONN_LIST(tcp_fd).partial_shown = len;
+	return len;
+    }
+    return 0;
+}
+
+/*
+ * process the incomplete lines we waited for long enough
+ */
+static void flush_partials(void)
+{
+    connsess *c;
+    char *buf;
+    int i, fd, len, max, shown;
+
+    for (i = 0; i < conn_max_index; i++) {
+	c = &CONN_INDEX(i);
+	if (!c->id || !c->partial_time.tv_sec)
+	    continue;
+	update_now();
+	if (cmp_vtime(&c->partial_time, &now) > 0)
+	    continue;
+
+	tcp_fd = fd = c->fd;
+	buf = partial_take(fd, &len, &max, &shown);
+
+	if (tcp_fd == tcp_main_fd && promptlen)
+	    end_prompt(buf, shown);
+	else
+	    common_clear(promptlen && !opt_compact);
+
+	len = partial_flush(buf, len, 1);
+	partial_give(fd, buf, len, max);
+    }
+    tcp_fd = tcp_main_fd;
+}
+
+/*
+ * return millisecs until flush_partials() has something to do, or -1
+ */
+static int partial_sleeptime(void)
+{
+    connsess *c;
+    long ms, min = -1;
+    int i;
+
+    for (i = 0; i < conn_max_index; i++) {
+	c = &CONN_INDEX(i);
+	if (!c->id || !c->partial_time.tv_sec)
+	    continue;
+	update_now();
+	if ((ms = diff_vtime(&c->partial_time, &now)) < 0)
+	    ms = 0;
+	if (min < 0 || ms < min)
+	    min = ms;
+    }
+    return (int)min;
+}
+
+/*
+ * get data from a MUD connection and process/display it.
+ *
+ * Lines split into different packets are put back together:
+ * the incomplete last line of each connection is kept in its
+ * partial buffer until the rest of the line arrives, or IAC GA
+ * marks it as a prompt, or partial_timeout millisecs elapse.
+ * In this way #actions run exactly once on each complete line.
+ */
+static void get_mud_input(void)
+{
+    connsess *c = &CONN_LIST(tcp_fd);
+    char *buf, *p;
+    int fd = tcp_fd, got, old, size, max, end, shown, ga;
+
+    old = c->partial_len;
+    if (!(got = partial_read(c)))
+	return;  /* maybe connection was closed */
+
+    buf = c->partial;
+    size = old + got;
+    buf[size] = '\0';  /* Safe, there is space. */
+    received += got;
+
+#ifdef DEBUGCODE
+    /* debug code to see in detail what strange codes come from the server */
+    {
+	char ch, *t;
+	tty_printf("%s{", edattrend);
+	for (t = buf + old; t < buf + size; t++) {
+	    if ((ch = *t) < ' ' || ch > '~')
+		tty_printf("[%d]", ch);
+	    else tty_putc(ch);
 	}
-	tcp_fd = otcp_fd;
+	tty_puts("}\n");
+    }
+#endif
+
+    if (!(c->flags & ACTIVE)) {
+	/* process only active connections */
+	c->partial_len = 0;
+	c->partial_time.tv_sec = 0;
 	return;
     }
 
     if (linemode & LM_CHAR) {
 	/* char-by-char mode: just display output, no fuss */
 	clear_input_line(0);
-	tty_puts(buf);
+	tty_puts(buf + old);
+	c->partial_len = old;
 	return;
     }
 
     /* line-at-a-time mode: process input in a number of ways */
 
-    if (tcp_fd == tcp_main_fd && promptlen) {
-	i = process_first_fragment(buf, got);
-	buf += i, got -= i;
-    } else {
+    /* find the end of the last complete line */
+    if (!(end = partial_end(buf, old, size)) && max_line && size > max_line) {
+	/* line too long: cut it here, the rest will follow as a new line */
+	buf[size++] = '\n';
+	buf[size] = '\0';  /* Still safe, partial_read() left room */
+	end = size;
+    }
+
+    /* IAC GA / IAC EOR after the last complete line marks a prompt */
+    ga = (p = prompt_last_iac()) && p > buf + end && p <= buf + size;
+
+    if (!end && !ga && partial_timeout) {
+	/* nothing complete yet, wait for the rest of the line */
+	c->partial_len = size;
+	partial_wait(c);
+	return;
+    }
+
+    buf = partial_take(fd, &size, &max, &shown);
+    size = old + got;
+    if (shown && shown != old) {
+	/* more text arrived after we displayed it as prompt */
+	clear_input_line(1);
+	promptzero();
+	shown = 0;
+    }
+
+    if (tcp_fd == tcp_main_fd && promptlen)
+	got = end_prompt(buf, shown);
+    else {
 	common_clear(promptlen && !opt_compact);
+	got = 0;
+    }
+    flood_check(fd);
+
+    if (end > got) {
+	char ch = buf[end];
+	buf[end] = '\0';
+	process_remote_input(buf + got, end - got);
+	buf[end] = ch;
+	got = end;
+	/* #actions may have switched connection, or closed this one */
+	if (!CONN_LIST(fd).id)
+	    size = got;
+	else
+	    tcp_fd = fd;
     }
 
-    if (got > 0)
-	process_remote_input(buf, got);
+    if ((size -= got) > 0) {
+	/* IAC GA / IAC EOR: the host does not intend to complete the line */
+	if (ga || !partial_timeout)
+	    size = partial_flush(buf + got, size, !ga);
+	if (size)
+	    memmove(buf, buf + got, size);
+    }
+    partial_give(fd, buf, size, max);
 }
 
+/*
+ * get data from the socket and process/display it.
+ */
+static void get_remote_input(void)
+{
+    prompt_reset_iac();
+    if (CONN_LIST(tcp_fd).flags & SPAWN)
+	get_spawn_input();
+    else
+	get_mud_input();
+    prompt_reset_iac();
+}
 
 #ifdef USE_REGEXP
 /*
@@ -1173,10 +1584,10 @@ static int match_regexp_action(void *regexp, char *line, int *match_s, int *matc
  */
 static int match_weak_action(char *pat, char *line, int *match_s, int *match_e)
 {
-    char mpat[BUFSIZE], *npat=0, *npat2=0, *src=line, *nsrc=0, c;
+    char *npat=0, *npat2=0, *src=line, *nsrc=0, c;
     ptr *pbuf, buf = (ptr)0;
     char *tmp, *realpat = pat;
-    int mbeg = 0, mword = 0, prm = -1;
+    int mbeg = 0, mword = 0, prm = -1, mlen = 0, linelen = strlen(line);
 
     TAKE_PTR(pbuf, buf);
 
@@ -1234,14 +1645,11 @@ static int match_weak_action(char *pat, char *line, int *match_s, int *match_e)
 	if (npat2 < npat) npat = npat2;
 	if (!*npat) npat = 0;
 
-	if (npat) {
-	    my_strncpy(mpat, pat, npat-pat);
-	    /* mpat[npat - pat] = 0; */
-	} else
-	    strcpy(mpat, pat);
+	/* the literal text up to next wildcard, matched in place */
+	mlen = npat ? npat - pat : strlen(pat);
 
-	if (*mpat) {
-	    nsrc = strstr(src, mpat);
+	if (mlen) {
+	    nsrc = memfind(src, line + linelen - src, pat, mlen);
 	    if (!nsrc) {
 		DROP_PTR(pbuf);
 		return 0;
@@ -1260,7 +1668,7 @@ static int match_weak_action(char *pat, char *line, int *match_s, int *match_e)
 	} else if (prm != -1) {
 	    /* end of pattern space */
 	    match_s[prm] = src - line;
-	    match_e[prm] = strlen(line);
+	    match_e[prm] = linelen;
 	}
 
 	/* post-processing of param */
@@ -1290,12 +1698,12 @@ static int match_weak_action(char *pat, char *line, int *match_s, int *match_e)
 	}
 	if (prm != -1 && match_e[prm])
 	    mbeg = mword = 0;  /* reset match flags */
-	src = nsrc + strlen(mpat);
+	src = nsrc + mlen;
 	pat = npat;
     }
     DROP_PTR(pbuf);
 
-    match_s[0] = 0; match_e[0] = strlen(line);
+    match_s[0] = 0; match_e[0] = linelen;
     return 1;
 }
 
@@ -1333,6 +1741,7 @@ static int search_action_or_prompt(char *line, char clearline, char onprompt)
 	    if (onprompt == 2) {
 		prompt->str = ptrmcpy(prompt->str, line, strlen(line));
 		if (MEM_ERROR) { promptzero(); errmsg("malloc(prompt)"); return 0; }
+		STATUSLINE_VAR(1, prompt->index);
 	    }
 	    if (clearline)
 		clear_input_line(1);
@@ -1358,6 +1767,8 @@ static void get_user_input(void)
     char *c = buf;
     static char typed[CAPLEN];    /* chars typed so far (with partial match) */
     static int nchars = 0;	  /* number of them */
+    static int walked = 0;	  /* how many of them lead to node */
+    static int node = KEYTRIE_ROOT, gen = 0;
 
     /* We have 4 possible line modes:
      * line mode, local echo: line editing functions in effect
@@ -1399,58 +1810,84 @@ static void get_user_input(void)
 #endif
 	    tcp_write(tcp_fd, edbuf);
 	    edlen = 0;
-	    typed[nchars = 0] = 0;
+	    typed[nchars = walked = 0] = 0;
+	    node = KEYTRIE_ROOT;
 	}
 	edbuf[pos = edlen] = '\0';
 	last_edit_cmd = (function_any)0;
     } else {
 	/* normal mode (line mode, echo). chunk == BUFSIZE */
-	int done = 0;
 	keynode *p;
+	function_str funct;
+	int n;
 
-	for (; j > 0; c++, j--) {
-
-	    /* search function key strings for match */
-	    /* GH: support for \0 in sequence */
-	    done = 0;
-	    typed[nchars++] = *c;
-
-	    while (!done) {
-		done = 1;
-		/*
-		 * shortcut:
-		 * an initial single ASCII char cannot match any #bind
-		 */
-		if (nchars == 1 && *c >= ' ' && *c <= '~')
-		    p = NULL;
-		else {
-		    for (p = keydefs; (p && (p->seqlen < nchars ||
-					     memcmp(typed, p->sequence, nchars)));
-			 p = p->next)
-			;
-		}
-
-		if (!p) {
+	for (;;) {
+	    if (gen != keytrie_gen) {
+		/* key bindings changed, decode again what was typed */
+		gen = keytrie_gen;
+		node = KEYTRIE_ROOT;
+		walked = 0;
+	    }
+	    if (pasting) {
+		/* inside a bracketed paste nothing is a key */
+		if (nchars) {
+		    i = paste_collect(typed, nchars);
+		    memmove(typed, typed + i, nchars -= i);
+		} else if (j) {
+		    i = paste_collect(c, j);
+		    c += i, j -= i;
+		} else
+		    break;
+		continue;
+	    }
+	    if (walked == nchars) {
+		if (!j)
+		    break;
+		if (!nchars) {
 		    /*
-		     * GH: type the first character and keep processing
-		     *     the rest in the input buffer
+		     * shortcut: an initial single ASCII char cannot match
+		     * any #bind, insert at once all such chars (pastes)
 		     */
-		    i = 1;
-		    last_edit_cmd = (function_any)0;
-		    insert_char(typed[0]);
-		    while (i < nchars) {
-			typed[i - 1] = typed[i];
-			i++;
+		    for (i = 0; i < j && ((c[i] >= ' ' && c[i] <= '~') ||
+			 ((c[i] & 0x80) && !keytrie_next(KEYTRIE_ROOT, c[i]))); i++)
+			;
+		    if (i) {
+			last_edit_cmd = (function_any)0;
+			insert_chars(c, i);
+			c += i, j -= i;
+			continue;
 		    }
-		    if (--nchars)
-			done = 0;
-		} else if (p->seqlen == nchars) {
-		    if (flashback)
-			putbackcursor();
-		    p->funct(p->call_data);
-		    last_edit_cmd = (function_any)p->funct; /* GH: keep track of last command */
-		    nchars = 0;
 		}
+		typed[nchars++] = *c++, j--;
+	    }
+
+	    /* GH: support for \0 in sequence */
+	    if (!(n = keytrie_next(node, typed[walked])) ||
+		(!walked && typed[0] >= ' ' && typed[0] <= '~')) {
+		/*
+		 * GH: type the first character and keep processing
+		 *     the rest in the input buffer
+		 */
+		last_edit_cmd = (function_any)0;
+		insert_char(typed[0]);
+		memmove(typed, typed + 1, --nchars);
+		node = KEYTRIE_ROOT;
+		walked = 0;
+	    } else if ((p = keytrie_key(n))) {
+		memmove(typed, typed + walked + 1, nchars -= walked + 1);
+		node = KEYTRIE_ROOT;
+		walked = 0;
+		if (flashback)
+		    putbackcursor();
+		funct = p->funct;
+		if (searching && funct != reverse_search &&
+		    funct != cancel_search && funct != del_char_left)
+		    search_end(1);
+		funct(p->call_data);
+		last_edit_cmd = (function_any)funct; /* GH: keep track of last command */
+	    } else {
+		node = n;
+		walked++;
 	    }
 	}
     }
@@ -2073,10 +2510,35 @@ void set_deffile(char *arg)
 	strcpy(deffile, arg);
 }
 
+static varnode *permanent_vars[MAX_PERMANENT_VARS];
+static int num_permanent_vars = 0;
+
+/*
+ * create a variable that cannot be deleted
+ * and is not saved in the definition file
+ */
+varnode *add_permanent_varnode(char *name, int type)
+{
+    varnode *v;
+
+    if (num_permanent_vars >= MAX_PERMANENT_VARS) {
+	print_error(error=OUT_OF_VAR_SPACE_ERROR);
+	return NULL;
+    }
+    if ((v = add_varnode(name, type)))
+	permanent_vars[num_permanent_vars++] = v;
+    return v;
+}
+
 /*
  * GH: return true if var is one of the permanent variables
  */
 int is_permanent_variable(varnode *v)
 {
-    return (v == prompt || v == last_line);
+    int i;
+
+    for (i = 0; i < num_permanent_vars; i++)
+	if (v == permanent_vars[i])
+	    return 1;
+    return 0;
 }
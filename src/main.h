@@ -10,6 +10,8 @@
 void printver(void);
 void status(int s);
 void process_remote_input(char *buf, int size);
+void flood_check(int fd);
+void flood_close(int fd);
 void push_params(void);
 void pop_params(void);
 void prompt_set_iac(char *p);
@@ -17,12 +19,16 @@ char *parse_instruction(char *line, char silent, char subs, char jit_subs);
 char *get_next_instr(char *p);
 void parse_user_input(char *line, char silent);
 void set_deffile(char *arg);
+varnode *add_permanent_varnode(char *name, int type);
 int  is_permanent_variable(varnode *v);
 
 
 /* shared vars from main.c */
 extern int  prompt_status, line_status;
 extern int  limit_mem;
+extern int  partial_timeout;
+extern int  max_line;
+extern int  flood_limit;
 extern char ready;
 extern volatile char confirm;
 extern int  history_done;
@@ -93,6 +99,7 @@ extern char verbatim;
 extern char opt_exit;
 extern char opt_history;
 extern char opt_words;
+extern char opt_mudwords;
 extern char opt_compact;
 extern char opt_debug;
 extern char opt_wrap;
@@ -102,7 +109,10 @@ extern char opt_keyecho;
 extern char opt_speedwalk;
 extern char opt_autoprint;
 extern char opt_reprint;
+extern char opt_paste;
+extern char opt_sendpaste;
 extern char opt_sendsize;
+extern char opt_split;
 extern char opt_autoclear;
 
 extern function_str last_edit_cmd;
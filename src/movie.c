@@ -0,0 +1,757 @@
+/*
+ *  movie.c  --  read and write #movie files, in text or binary format.
+ *               Used by powwow and by the movie tools.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#ifdef USE_ZLIB
+# include <zlib.h>
+#endif
+
+#include "movie.h"
+
+#define READ_CHUNK	(256*1024)
+
+static void put32(char *p, unsigned long x)
+{
+    int i;
+    for (i = 0; i < 4; i++, x >>= 8)
+	p[i] = (char)(x & 0xff);
+}
+
+static void put64(char *p, unsigned long long x)
+{
+    int i;
+    for (i = 0; i < 8; i++, x >>= 8)
+	p[i] = (char)(x & 0xff);
+}
+
+static unsigned long get32(const char *p)
+{
+    unsigned long x = 0;
+    int i;
+    for (i = 3; i >= 0; i--)
+	x = (x << 8) | (unsigned char)p[i];
+    return x;
+}
+
+static unsigned long long get64(const char *p)
+{
+    unsigned long long x = 0;
+    int i;
+    for (i = 7; i >= 0; i--)
+	x = (x << 8) | (unsigned char)p[i];
+    return x;
+}
+
+static int put_varint(char *p, unsigned long long x)
+{
+    int n = 0;
+
+    while (x >= 0x80) {
+	p[n++] = (char)(x & 0x7f) | 0x80;
+	x >>= 7;
+    }
+    p[n++] = (char)x;
+    return n;
+}
+
+/* return the bytes used, 0 if more than avail are needed */
+static int get_varint(const char *p, long avail, unsigned long long *x)
+{
+    int n = 0, shift = 0;
+
+    *x = 0;
+    while (n < avail && n < 10) {
+	*x |= (unsigned long long)(p[n] & 0x7f) << shift;
+	if (!(p[n++] & 0x80))
+	    return n;
+	shift += 7;
+    }
+    return 0;
+}
+
+/* does the name ask for a binary movie? */
+int movie_binary_name(const char *name)
+{
+    int len = strlen(name), slen = strlen(MOVIE_SUFFIX);
+
+    if (len > 3 && !strcmp(name + len - 3, ".gz"))
+	len -= 3;		/* compressed while written */
+    return len > slen && !strncmp(name + len - slen, MOVIE_SUFFIX, slen);
+}
+
+/*
+ *                 writing
+ */
+
+struct moviewriter {
+    int binary;
+    movie_out out;
+    void *arg;
+    long long off;		/* bytes written */
+    long long last;		/* time of last record */
+    long long *ix;		/* time and offset of each sync record */
+    int ix_count, ix_size;
+    char *buf;
+    long size;
+};
+
+static int writer_grow(moviewriter *w, long len)
+{
+    char *p;
+
+    if (len <= w->size)
+	return 0;
+    if (!(p = (char *)realloc(w->buf, len + READ_CHUNK)))
+	return -1;
+    w->buf = p;
+    w->size = len + READ_CHUNK;
+    return 0;
+}
+
+moviewriter *movie_writer(int binary, movie_out out, void *arg)
+{
+    moviewriter *w = (moviewriter *)calloc(1, sizeof(moviewriter));
+
+    if (!w)
+	return NULL;
+    w->binary = binary;
+    w->out = out;
+    w->arg = arg;
+    w->last = 0;
+    if (binary) {
+	out(arg, MOVIE_MAGIC, MOVIE_TAGLEN, 1);
+	w->off = MOVIE_TAGLEN;
+    }
+    return w;
+}
+
+/*
+ * write a record. sleep is used by text movies, time by binary ones.
+ * Return -1 if it was dropped.
+ */
+int movie_put(moviewriter *w, int kind, long long time, long sleep,
+	      const char *s, int len)
+{
+    long n = 0;
+    int sync;
+
+    if (!w->binary) {
+	if (writer_grow(w, len + 48) < 0)
+	    return -1;
+	if (sleep)
+	    n = sprintf(w->buf, "sleep %ld\n", sleep);
+	if (kind == MOVIE_LINE)
+	    n += sprintf(w->buf + n, "line ");
+	else if (kind == MOVIE_PROMPT)
+	    n += sprintf(w->buf + n, "prompt ");
+	memcpy(w->buf + n, s, len);
+	n += len;
+	w->buf[n++] = '\n';
+	return w->out(w->arg, w->buf, n, 0);
+    }
+
+    /* seeking needs times that never go back, whatever the clock does */
+    if (time < w->last)
+	time = w->last;
+    sync = !w->ix_count || w->off - w->ix[2*w->ix_count - 1] >= MOVIE_SYNC;
+    if (sync && w->ix_count == w->ix_size) {
+	long long *p = (long long *)realloc(w->ix,
+			(w->ix_size * 2 + 64) * 2 * sizeof(long long));
+	if (!p)
+	    return -1;
+	w->ix = p;
+	w->ix_size = w->ix_size * 2 + 64;
+    }
+    if (writer_grow(w, MOVIE_SYNCLEN + MOVIE_MAXHDR + len) < 0)
+	return -1;
+
+    if (sync) {
+	w->buf[0] = MOVIE_SYNCREC;
+	put64(w->buf + 1, time);
+	memcpy(w->buf + 9, MOVIE_SYNCTAG, MOVIE_TAGLEN);
+	n = MOVIE_SYNCLEN;
+    }
+    w->buf[n++] = (char)kind;
+    n += put_varint(w->buf + n, sync ? 0 : time - w->last);
+    n += put_varint(w->buf + n, len);
+    memcpy(w->buf + n, s, len);
+    n += len;
+
+    if (w->out(w->arg, w->buf, n, 0) < 0)
+	return -1;
+    if (sync) {
+	w->ix[2*w->ix_count] = time;
+	w->ix[2*w->ix_count + 1] = w->off;
+	w->ix_count++;
+    }
+    w->off += n;
+    w->last = time;
+    return 0;
+}
+
+/*
+ * finish the movie: append the index to binary ones. Frees w.
+ */
+void movie_writer_end(moviewriter *w)
+{
+    long n, i;
+
+    if (w->binary &&
+	writer_grow(w, MOVIE_IXHDRLEN + w->ix_count * 16 + 16) == 0) {
+	w->buf[0] = MOVIE_INDEX;
+	put64(w->buf + 1, w->last);
+	put32(w->buf + 9, w->ix_count);
+	for (n = MOVIE_IXHDRLEN, i = 0; i < 2 * w->ix_count; i++, n += 8)
+	    put64(w->buf + n, w->ix[i]);
+	memcpy(w->buf + n, MOVIE_TRAILER, MOVIE_TAGLEN);
+	put64(w->buf + n + MOVIE_TAGLEN, w->off);
+	w->out(w->arg, w->buf, n + 16, 1);
+    }
+    if (w->ix)
+	free(w->ix);
+    if (w->buf)
+	free(w->buf);
+    free(w);
+}
+
+/*
+ *                 reading
+ */
+
+struct movie {
+    int fd;
+    int binary;
+    int seekable;		/* can be read at any offset */
+    int rewindable;		/* can at least be read again: compressed
+				 * files, zlib decompresses them up to there */
+    char *buf;
+    long size;			/* allocated */
+    long pos, len;		/* unread bytes are buf[pos...len-1] */
+    off_t base;			/* file offset of buf[0] */
+    off_t filesize;
+    off_t end;			/* where records end */
+    off_t mark;			/* keep buf from here on, -1 if none */
+    long long time;		/* clock of text movies */
+    long long last;		/* time of last record, -1 if not known */
+    long long *ix;		/* the index of binary movies */
+    int ix_count;
+    char *map;			/* the whole file, if mapped: buf is map */
+#ifdef USE_ZLIB
+    gzFile gz;			/* not NULL if reading through zlib */
+#endif
+};
+
+static void movie_goto(movie *m, off_t off, long long time)
+{
+    if (m->map) {
+	m->base = 0;
+	m->pos = off;
+	m->len = m->end;
+	m->time = time;
+	return;
+    }
+    if (m->seekable)
+	lseek(m->fd, off, SEEK_SET);
+#ifdef USE_ZLIB
+    else if (m->gz)
+	gzseek(m->gz, off, SEEK_SET);
+#endif
+    m->base = off;
+    m->pos = m->len = 0;
+    m->time = time;
+}
+
+/*
+ * make at least need bytes available from buf + pos, keeping
+ * what is after mark (if set) in the buffer too.
+ * Return how many are available, less than need only at end of file.
+ */
+static long movie_fill(movie *m, long need)
+{
+    long n, max, keep;
+
+    if (m->len - m->pos >= need || m->map)
+	return m->len - m->pos;
+    keep = m->pos;
+    if (m->mark >= 0 && m->mark - m->base < keep)
+	keep = m->mark - m->base;
+    if (keep > 0) {
+	memmove(m->buf, m->buf + keep, m->len - keep);
+	m->base += keep;
+	m->len -= keep;
+	m->pos -= keep;
+    }
+    if (m->pos + need > m->size) {
+	char *p = (char *)realloc(m->buf, m->pos + need + READ_CHUNK);
+	if (!p)
+	    return m->len - m->pos;
+	m->buf = p;
+	m->size = m->pos + need + READ_CHUNK;
+    }
+    while (m->len < m->pos + need) {
+	max = m->size - m->len;
+	if (m->seekable && m->end - (m->base + m->len) < max)
+	    max = m->end - (m->base + m->len);
+	if (max <= 0)
+	    break;
+#ifdef USE_ZLIB
+	if (m->gz)
+	    n = gzread(m->gz, m->buf + m->len, max);
+	else
+#endif
+	n = read(m->fd, m->buf + m->len, max);
+	if (n <= 0)
+	    break;
+	m->len += n;
+    }
+    return m->len - m->pos;
+}
+
+static int read_at(movie *m, off_t off, char *buf, long len)
+{
+    return pread(m->fd, buf, len, off) == len ? 0 : -1;
+}
+
+/* read the index at the end of a binary movie, if there is one */
+static void load_index(movie *m)
+{
+    char t[16], h[MOVIE_IXHDRLEN];
+    off_t off;
+    long len, i;
+    char *p = NULL;
+
+    if (m->filesize < MOVIE_TAGLEN + MOVIE_IXHDRLEN + 16 ||
+	read_at(m, m->filesize - 16, t, 16) < 0 ||
+	memcmp(t, MOVIE_TRAILER, MOVIE_TAGLEN))
+	return;
+    off = (off_t)get64(t + MOVIE_TAGLEN);
+    if (off < MOVIE_TAGLEN || off > m->filesize - 16 - MOVIE_IXHDRLEN ||
+	read_at(m, off, h, MOVIE_IXHDRLEN) < 0 || h[0] != MOVIE_INDEX)
+	return;
+    len = get32(h + 9) * 16;
+    if (off + MOVIE_IXHDRLEN + len + 16 != m->filesize)
+	return;
+    if (!(p = (char *)malloc(len + 1)) ||
+	!(m->ix = (long long *)malloc(len / 8 * sizeof(long long) + 1)) ||
+	read_at(m, off + MOVIE_IXHDRLEN, p, len) < 0) {
+	if (p)
+	    free(p);
+	if (m->ix)
+	    free(m->ix);
+	m->ix = NULL;
+	return;
+    }
+    for (i = 0; i < len / 8; i++)
+	m->ix[i] = (long long)get64(p + 8 * i);
+    free(p);
+    m->ix_count = len / 16;
+    m->end = off;
+    m->last = (long long)get64(h + 1);
+}
+
+/*
+ * read regular files through mmap(): no copying, and records never
+ * need to be moved around to keep them in one piece
+ */
+static void movie_map(movie *m)
+{
+    char *p;
+    off_t off = movie_tell(m);
+
+    if (!m->seekable || m->filesize <= 0 || (long)m->filesize != m->filesize)
+	return;
+    p = (char *)mmap(NULL, m->filesize, PROT_READ, MAP_PRIVATE, m->fd, 0);
+    if (p == (char *)MAP_FAILED)
+	return;
+#ifdef MADV_SEQUENTIAL
+    madvise(p, m->filesize, MADV_SEQUENTIAL);
+#endif
+    free(m->buf);
+    m->buf = m->map = p;
+    m->size = m->filesize;
+    movie_goto(m, off, m->time);
+}
+
+/*
+ * open a movie for reading, "-" or NULL meaning standard input
+ */
+movie *movie_open(const char *name)
+{
+    struct stat st;
+    movie *m;
+    int fd = 0;
+#ifdef USE_ZLIB
+    unsigned char magic[2];
+#endif
+
+    if (name && strcmp(name, "-") && (fd = open(name, O_RDONLY)) < 0)
+	return NULL;
+    if (!(m = (movie *)calloc(1, sizeof(movie))) ||
+	!(m->buf = (char *)malloc(m->size = READ_CHUNK))) {
+	if (m)
+	    free(m);
+	if (fd)
+	    close(fd);
+	return NULL;
+    }
+    m->fd = fd;
+    m->last = -1;
+    m->mark = -1;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+	m->seekable = m->rewindable = 1;
+	m->filesize = m->end = st.st_size;
+    }
+#ifdef USE_ZLIB
+    /* gzip files, and pipes that might be: zlib reads plain ones too */
+    if (!m->seekable || (pread(fd, magic, 2, 0) == 2 &&
+			 magic[0] == 0x1f && magic[1] == 0x8b)) {
+	if (!(m->gz = gzdopen(fd, "rb"))) {
+	    movie_close(m);
+	    return NULL;
+	}
+	gzbuffer(m->gz, READ_CHUNK);
+	m->seekable = 0;
+	m->filesize = 0;
+    }
+#endif
+    if (movie_fill(m, MOVIE_TAGLEN) >= MOVIE_TAGLEN &&
+	!memcmp(m->buf, MOVIE_MAGIC, MOVIE_TAGLEN)) {
+	m->binary = 1;
+	m->pos = MOVIE_TAGLEN;
+	if (m->seekable) {
+	    load_index(m);
+	    movie_goto(m, MOVIE_TAGLEN, 0);
+	}
+    }
+    movie_map(m);
+    return m;
+}
+
+void movie_close(movie *m)
+{
+#ifdef USE_ZLIB
+    if (m->gz)
+	gzclose(m->gz);
+    else
+#endif
+    if (m->fd)
+	close(m->fd);
+    if (m->ix)
+	free(m->ix);
+    if (m->map)
+	munmap(m->map, m->filesize);
+    else
+	free(m->buf);
+    free(m);
+}
+
+int movie_is_binary(movie *m)
+{
+    return m->binary;
+}
+
+long long movie_tell(movie *m)
+{
+    return m->base + m->pos;
+}
+
+/* remember where the next record starts */
+void movie_getpos(movie *m, moviepos *p)
+{
+    p->off = movie_tell(m);
+    p->time = m->time;
+}
+
+/*
+ * go back (or forward) to a position saved by movie_getpos().
+ * Return -1 if not possible (pipes): compressed files are read again
+ * from the beginning when going back.
+ */
+int movie_setpos(movie *m, const moviepos *p)
+{
+    if (!m->rewindable)
+	return -1;
+    movie_goto(m, (off_t)p->off, p->time);
+    return 0;
+}
+
+/* bytes in the file, -1 if not known (compressed ones: once read) */
+long long movie_size(movie *m)
+{
+    return m->seekable || m->filesize ? m->filesize : -1;
+}
+
+static int read_text(movie *m, movierec *r)
+{
+    char *line, *nl, *p;
+    long n, seen;
+
+    for (;;) {
+	seen = 0;
+	while (!(nl = memchr(m->buf + m->pos + seen, '\n',
+			     m->len - m->pos - seen))) {
+	    seen = m->len - m->pos;
+	    if (movie_fill(m, seen + 1) <= seen)
+		break;
+	}
+	n = nl ? nl - (m->buf + m->pos) : m->len - m->pos;
+	if (!nl && !n)
+	    return 0;
+	line = m->buf + m->pos;
+	m->pos += nl ? n + 1 : n;
+
+	r->time = m->time;
+	if (n >= 6 && !memcmp(line, "sleep ", 6)) {
+	    long s = 0;
+	    for (p = line + 6; p < line + n && *p >= '0' && *p <= '9'; p++)
+		s = s * 10 + (*p - '0');
+	    m->time += s;
+	    continue;
+	} else if (n >= 5 && !memcmp(line, "line ", 5)) {
+	    r->kind = MOVIE_LINE;
+	    r->data = line + 5;
+	    r->len = n - 5;
+	} else if (n >= 7 && !memcmp(line, "prompt ", 7)) {
+	    r->kind = MOVIE_PROMPT;
+	    r->data = line + 7;
+	    r->len = n - 7;
+	} else if (n && line[0] == '#') {
+	    r->kind = MOVIE_COMMENT;
+	    r->data = line;
+	    r->len = n;
+	} else {
+	    r->kind = 0;
+	    r->data = line;
+	    r->len = n;
+	    return -1;
+	}
+	return 1;
+    }
+}
+
+static int read_binary(movie *m, movierec *r)
+{
+    unsigned long long delta, len;
+    long avail;
+    char *h;
+    int n, k;
+
+    for (;;) {
+	avail = movie_fill(m, MOVIE_SYNCLEN);
+	if (avail < 1)
+	    return 0;
+	h = m->buf + m->pos;
+	if (h[0] == MOVIE_INDEX)
+	    return 0;
+	if (h[0] == MOVIE_SYNCREC) {
+	    if (avail < MOVIE_SYNCLEN)
+		return 0;	/* cut short by a crash */
+	    if (memcmp(h + 9, MOVIE_SYNCTAG, MOVIE_TAGLEN))
+		break;
+	    m->time = (long long)get64(h + 1);
+	    m->pos += MOVIE_SYNCLEN;
+	    continue;
+	}
+	if (h[0] != MOVIE_LINE && h[0] != MOVIE_PROMPT && h[0] != MOVIE_COMMENT)
+	    break;
+	if (!(n = get_varint(h + 1, avail - 1, &delta)) ||
+	    !(k = get_varint(h + 1 + n, avail - 1 - n, &len)))
+	    return 0;
+	if (len > (1UL << 30))
+	    break;
+	n += 1 + k;
+	if (movie_fill(m, n + len) < n + (long)len)
+	    return 0;
+	h = m->buf + m->pos;
+	m->pos += n + len;
+	m->time += delta;
+	r->kind = h[0];
+	r->time = m->time;
+	r->data = h + n;
+	r->len = len;
+	return 1;
+    }
+    r->kind = 0;
+    r->data = h;
+    r->len = 0;
+    return -1;
+}
+
+/*
+ * read the next record. Return 1 if done, 0 at end of movie,
+ * -1 on a syntax error (r->data is then the bad line)
+ */
+int movie_read(movie *m, movierec *r)
+{
+    return m->binary ? read_binary(m, r) : read_text(m, r);
+}
+
+/*
+ * find the first sync record starting in [from, to).
+ * Return its offset and set *time, or return -1.
+ */
+static off_t find_sync(movie *m, off_t from, off_t to, long long *time)
+{
+    char buf[MOVIE_SYNC + MOVIE_SYNCLEN], *p, *end;
+    long n;
+
+    while (from < to) {
+	n = MOVIE_SYNC + MOVIE_SYNCLEN;
+	if (n > m->end - from)
+	    n = m->end - from;
+	if (n < MOVIE_SYNCLEN || pread(m->fd, buf, n, from) != n)
+	    return -1;
+	for (p = buf + 9, end = buf + n - MOVIE_TAGLEN; p <= end; p++) {
+	    if (!(p = memchr(p, MOVIE_SYNCTAG[0], end + 1 - p)))
+		break;
+	    if (!memcmp(p, MOVIE_SYNCTAG, MOVIE_TAGLEN) &&
+		p[-9] == MOVIE_SYNCREC) {
+		*time = (long long)get64(p - 8);
+		return from + (p - buf) - 9;
+	    }
+	}
+	from += MOVIE_SYNC;
+    }
+    return -1;
+}
+
+/*
+ * go to the first record not older than time. Binary movies are
+ * searched in O(log n), with the index if they have one;
+ * text ones are read from the beginning when going back.
+ * Return -1 if not possible (going back in a pipe).
+ */
+int movie_seek(movie *m, long long time)
+{
+    movierec r;
+    off_t lo, hi, mid, off;
+    long long t;
+    int a, b, c;
+
+    if (m->binary && m->seekable) {
+	lo = MOVIE_TAGLEN;
+	if (m->ix_count) {
+	    /* last sync record older than time */
+	    for (a = 0, b = m->ix_count; a < b; ) {
+		c = (a + b) / 2;
+		if (m->ix[2*c] < time)
+		    a = c + 1;
+		else
+		    b = c;
+	    }
+	    if (a)
+		lo = (off_t)m->ix[2*a - 1];
+	} else {
+	    hi = m->end;
+	    while (hi - lo > 2 * MOVIE_SYNC) {
+		mid = lo + (hi - lo) / 2;
+		off = find_sync(m, mid, hi, &t);
+		if (off >= 0 && t < time)
+		    lo = off;
+		else
+		    hi = mid;
+	    }
+	}
+	movie_goto(m, lo, 0);
+    } else if (time < m->time) {
+	if (!m->rewindable)
+	    return -1;
+	movie_goto(m, m->binary ? MOVIE_TAGLEN : 0, 0);
+    }
+
+    for (;;) {
+	m->mark = off = movie_tell(m);
+	t = m->time;
+	if (movie_read(m, &r) <= 0 || r.time >= time)
+	    break;
+    }
+    /* that record is still in the buffer, after the mark: unread it */
+    m->pos = off - m->base;
+    m->mark = -1;
+    m->time = t;
+    return 0;
+}
+
+/* time of the first record */
+long long movie_start(movie *m)
+{
+    movierec r;
+    char h[9];
+    long long t = 0;
+
+    /* binary movies start with a sync record */
+    if (m->binary && m->seekable &&
+	read_at(m, MOVIE_TAGLEN, h, 9) == 0 && h[0] == MOVIE_SYNCREC)
+	return (long long)get64(h + 1);
+    if (m->binary && movie_tell(m) == MOVIE_TAGLEN &&
+	movie_fill(m, 9) >= 9 && m->buf[m->pos] == MOVIE_SYNCREC)
+	return (long long)get64(m->buf + m->pos + 1);
+    if (m->binary)
+	return m->time;
+    if (movie_tell(m) == 0) {
+	/* read the first record and unread it: it is still in the buffer */
+	m->mark = 0;
+	if (movie_read(m, &r) > 0)
+	    t = r.time;
+	m->pos = -m->base;
+	m->mark = -1;
+	m->time = 0;
+    }
+    return t;
+}
+
+/*
+ * time of the last record, -1 if not known. It has to read text movies,
+ * and the tail of binary ones without index.
+ */
+long long movie_end(movie *m)
+{
+    movierec r;
+    off_t off = movie_tell(m), from, s, back;
+    long long t = m->time;
+
+    if (m->last >= 0 || !m->rewindable)
+	return m->last;
+
+    if (m->binary && !m->seekable)
+	movie_goto(m, MOVIE_TAGLEN, 0);
+    else if (m->binary) {
+	from = MOVIE_TAGLEN;
+	for (back = 4 * MOVIE_SYNC; back < m->end; back *= 2) {
+	    if ((s = find_sync(m, m->end - back, m->end, &m->time)) >= 0) {
+		from = s;
+		while ((s = find_sync(m, s + 1, m->end, &m->time)) >= 0)
+		    from = s;
+		break;
+	    }
+	}
+	movie_goto(m, from, 0);
+    } else
+	movie_goto(m, 0, 0);
+
+    m->last = movie_start(m);
+    while (movie_read(m, &r) > 0)
+	m->last = r.time;
+    if (!m->binary && m->time > m->last)
+	m->last = m->time;	/* trailing sleep */
+    if (!m->seekable)
+	m->filesize = movie_tell(m);
+    movie_goto(m, off, t);
+    return m->last;
+}
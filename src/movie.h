@@ -0,0 +1,82 @@
+/* public things from movie.c, shared by powwow and the movie tools */
+
+#ifndef _MOVIE_H_
+#define _MOVIE_H_
+
+/*
+ * A binary movie (file name ending in MOVIE_SUFFIX) is MOVIE_MAGIC
+ * followed by records: kind (one byte), millisecs since the previous
+ * record and length of the data (both as varints: 7 bits per byte,
+ * least significant first, high bit set in all bytes but the last),
+ * then the data.
+ * The first record, and then one every MOVIE_SYNC bytes or so, is a
+ * sync record: its kind, the time in millisecs since the epoch
+ * (8 bytes, little endian) and MOVIE_SYNCTAG, MOVIE_SYNCLEN bytes in all.
+ * It tells the absolute time, and lets readers find record boundaries
+ * from any offset.
+ * When the movie is closed, an index record is appended: its kind,
+ * the time of the last record (8 bytes), the number of sync records
+ * (4 bytes) and the time and offset of each (8 bytes each). Then
+ * MOVIE_TRAILER and the offset of the index record (8 bytes).
+ * A movie cut short by a crash has no index, but can be searched anyway.
+ */
+#define MOVIE_SUFFIX	".pwm"
+#define MOVIE_MAGIC	"PWMOVIE1"
+#define MOVIE_SYNCTAG	"PWMSYNC\n"
+#define MOVIE_TRAILER	"PWMINDEX"
+#define MOVIE_TAGLEN	8	/* length of the three above */
+#define MOVIE_SYNCLEN	17
+#define MOVIE_IXHDRLEN	13	/* index record before the entries */
+#define MOVIE_MAXHDR	16	/* longest header of other records */
+#define MOVIE_SYNC	65536
+
+/* record kinds */
+#define MOVIE_LINE	'L'	/* a line, newline not included */
+#define MOVIE_PROMPT	'P'	/* text not followed by a newline */
+#define MOVIE_COMMENT	'#'	/* "#secs text" remark, shown by powwow-muc */
+#define MOVIE_SYNCREC	'S'
+#define MOVIE_INDEX	'I'
+
+typedef struct {
+    int kind;
+    long long time;	/* millisecs: since the epoch in binary movies,
+			 * since the beginning in text ones */
+    char *data;		/* valid until next movie_read() */
+    int len;
+} movierec;
+
+/* where the next record starts, as saved by movie_getpos() */
+typedef struct {
+    long long off;
+    long long time;	/* clock before reading it */
+} moviepos;
+
+typedef struct movie movie;
+typedef struct moviewriter moviewriter;
+
+/*
+ * where a moviewriter puts its output. It may drop the bytes (returning -1)
+ * unless must is set, but must never write only part of them.
+ */
+typedef int (*movie_out)(void *arg, const char *s, int len, int must);
+
+int  movie_binary_name(const char *name);
+
+moviewriter *movie_writer(int binary, movie_out out, void *arg);
+int  movie_put(moviewriter *w, int kind, long long time, long sleep,
+	       const char *s, int len);
+void movie_writer_end(moviewriter *w);
+
+movie *movie_open(const char *name);
+void movie_close(movie *m);
+int  movie_is_binary(movie *m);
+int  movie_read(movie *m, movierec *r);
+int  movie_seek(movie *m, long long time);
+long long movie_start(movie *m);
+long long movie_end(movie *m);
+long long movie_tell(movie *m);
+void movie_getpos(movie *m, moviepos *p);
+int  movie_setpos(movie *m, const moviepos *p);
+long long movie_size(movie *m);
+
+#endif /* _MOVIE_H_ */
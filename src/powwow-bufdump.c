@@ -0,0 +1,99 @@
+/*
+ *  powwow-bufdump.c  --  extract the text from a #buffile,
+ *                        even after powwow died
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "buffile.h"
+#include "movie.h"
+
+#define PROMPT 2		/* enum linetype in log.h */
+
+static int put_file(void *arg, const char *s, int len, int must)
+{
+    return fwrite(s, 1, len, (FILE *)arg) == (size_t)len ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    FILE *outfile = stdout;
+    moviewriter *w = NULL;
+    struct stat st;
+    bufhdr *h;
+    bufentry *e;
+    const char *line;
+    long long last;
+    int fd, i, bad = 0;
+
+    if (argc != 2 && argc != 3) {
+	fprintf(stderr,
+		"Usage: %s buffile [outfile]\n"
+		"\n"
+		"Writes the text kept in buffile by \"#buffile\", oldest first,\n"
+		"to outfile or to the standard output. If outfile ends in \"" MOVIE_SUFFIX "\",\n"
+		"writes a binary movie with the time of each line instead.\n",
+		argv[0]);
+	return 1;
+    }
+    if ((fd = open(argv[1], O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+	fprintf(stderr, "Error opening input file \"%s\"\n", argv[1]);
+	return 1;
+    }
+    h = (bufhdr *)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (st.st_size < BUF_HDRLEN || h == (bufhdr *)MAP_FAILED ||
+	!buf_valid(h, st.st_size)) {
+	fprintf(stderr, "\"%s\" is not a powwow buffer file\n", argv[1]);
+	return 1;
+    }
+    if (argc == 3 && strcmp(argv[2], "-") &&
+	(outfile = fopen(argv[2], "wb")) == NULL) {
+	fprintf(stderr, "Error opening output file \"%s\"\n", argv[2]);
+	return 1;
+    }
+    if (argc == 3 && movie_binary_name(argv[2]) &&
+	!(w = movie_writer(1, put_file, outfile))) {
+	fprintf(stderr, "Out of memory\n");
+	return 1;
+    }
+
+    e = BUF_ENTRIES(h);
+    last = h->logstart != h->logend ? e[h->logstart].time : 0;
+    for (i = h->logstart; i != h->logend; i = (i + 1) % h->logsize) {
+	if (!(line = buf_line(h, i))) {
+	    bad++;
+	    continue;
+	}
+	if (w) {
+	    movie_put(w, e[i].kind == PROMPT ? MOVIE_PROMPT : MOVIE_LINE,
+		      e[i].time, (long)(e[i].time - last), line, strlen(line));
+	    last = e[i].time;
+	} else {
+	    fputs(line, outfile);
+	    if (e[i].kind != PROMPT)
+		putc('\n', outfile);
+	}
+    }
+    if (w)
+	movie_writer_end(w);
+    if (bad)
+	fprintf(stderr, "%d damaged line%s skipped\n", bad, bad == 1 ? "" : "s");
+    if (fclose(outfile) != 0) {
+	fprintf(stderr, "Error writing file \"%s\"\n", argc == 3 ? argv[2] : "-");
+	return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,131 @@
+/*
+ *  powwow-movieconv.c  --  convert powwow movies between
+ *                          the text and the binary (.pwm) format
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef USE_ZLIB
+# include <zlib.h>
+#endif
+
+#include "movie.h"
+
+static int put_file(void *arg, const char *s, int len, int must)
+{
+    return fwrite(s, 1, len, (FILE *)arg) == (size_t)len ? 0 : -1;
+}
+
+#ifdef USE_ZLIB
+static int put_gz(void *arg, const char *s, int len, int must)
+{
+    return gzwrite((gzFile)arg, s, len) == len ? 0 : -1;
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+    FILE *outfile = NULL;
+    movie_out put = put_file;
+    void *arg;
+    movie *in;
+    moviewriter *out;
+    movierec r;
+    struct stat st;
+    long long start = -1, base, last;
+    int i;
+
+    if (argc > 2 && !strcmp(argv[1], "-t")) {
+	start = strtoll(argv[2], NULL, 10) * 1000;
+	argc -= 2;
+	argv += 2;
+    }
+    if (argc != 3) {
+	fprintf(stderr,
+		"Usage: %s [-t start] infile outfile\n"
+		"\n"
+		"Writes a binary movie if outfile ends in \"" MOVIE_SUFFIX "\", a text one otherwise.\n"
+#ifdef USE_ZLIB
+		"If it also ends in \".gz\", it is compressed.\n"
+#endif
+		"Text movies only have relative times: when making a binary one,\n"
+		"they start at `start' (seconds since the epoch), by default\n"
+		"when infile was last modified minus its length.\n",
+		argv[0]);
+	return 1;
+    }
+    i = strlen(argv[2]);
+
+    if ((in = movie_open(argv[1])) == NULL) {
+	fprintf(stderr, "Error opening input file \"%s\"\n", argv[1]);
+	return 1;
+    }
+#ifdef USE_ZLIB
+    if (i > 3 && !strcmp(argv[2] + i - 3, ".gz")) {
+	put = put_gz;
+	arg = gzopen(argv[2], "wb");
+    } else
+#endif
+	arg = outfile = fopen(argv[2], "wb");
+    if (arg == NULL) {
+	fprintf(stderr, "Error opening output file \"%s\"\n", argv[2]);
+	return 1;
+    }
+    if (!(out = movie_writer(movie_binary_name(argv[2]), put, arg))) {
+	fprintf(stderr, "Out of memory\n");
+	return 1;
+    }
+
+    base = 0;
+    if (!movie_is_binary(in)) {
+	if (start >= 0)
+	    base = start;
+	else if (stat(argv[1], &st) == 0 && movie_end(in) >= 0)
+	    base = st.st_mtime * 1000LL - movie_end(in);
+    }
+    last = movie_start(in) + base;
+
+    while ((i = movie_read(in, &r)) > 0) {
+	r.time += base;
+	if (movie_put(out, r.kind, r.time, (long)(r.time - last),
+		      r.data, r.len) < 0) {
+	    fprintf(stderr, "Error writing file \"%s\"\n", argv[2]);
+	    return 1;
+	}
+	last = r.time;
+    }
+    if (i < 0) {
+	if (!movie_is_binary(in))
+	    fprintf(stderr, "Syntax error in line:\n%.*s\n", r.len, r.data);
+	else
+	    fprintf(stderr, "Corrupt movie at offset %lld\n", movie_tell(in));
+	return 1;
+    }
+    movie_writer_end(out);
+    movie_close(in);
+#ifdef USE_ZLIB
+    if (!outfile) {
+	if (gzclose((gzFile)arg) != Z_OK) {
+	    fprintf(stderr, "Error writing file \"%s\"\n", argv[2]);
+	    return 1;
+	}
+	return 0;
+    }
+#endif
+    if (fclose(outfile) != 0) {
+	fprintf(stderr, "Error writing file \"%s\"\n", argv[2]);
+	return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,345 @@
+/*
+ *  powwow-moviegrep.c  --  extract a time range and/or the lines matching
+ *                          a pattern from a powwow movie, as a movie
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef USE_ZLIB
+# include <zlib.h>
+#endif
+
+#include "feature/regex.h"
+#include "movie.h"
+
+#define OUT_SIZE (1024*1024)
+
+/* a record kept for the context before a match */
+typedef struct {
+    int kind;
+    long long time;
+    char *data;
+    int len, size;
+} saved;
+
+static char *outname;
+
+static int put_file(void *arg, const char *s, int len, int must)
+{
+    return fwrite(s, 1, len, (FILE *)arg) == (size_t)len ? 0 : -1;
+}
+
+#ifdef USE_ZLIB
+static int put_gz(void *arg, const char *s, int len, int must)
+{
+    return gzwrite((gzFile)arg, s, len) == len ? 0 : -1;
+}
+#endif
+
+static void *xrealloc(void *p, size_t len)
+{
+    if (!(p = realloc(p, len))) {
+	fprintf(stderr, "Out of memory\n");
+	exit(1);
+    }
+    return p;
+}
+
+/* write a record, with the sleep since the previous one written */
+static void put(moviewriter *w, int kind, long long time, const char *s, int len)
+{
+    static long long last = -1;
+
+    if (movie_put(w, kind, time, last < 0 ? 0 : (long)(time - last), s, len) < 0) {
+	fprintf(stderr, "Error writing file \"%s\"\n", outname);
+	exit(1);
+    }
+    last = time;
+}
+
+/*
+ * parse when into millisecs since the epoch: "[YYYY-MM-DD] HH:MM[:SS]"
+ * (local time, on the day the movie starts if no date),
+ * "YYYY-MM-DD", "@seconds" since the epoch or "+[[hours:]minutes:]seconds"
+ * after start. Return -1 if not valid.
+ */
+static long long parse_when(char *when, long long start)
+{
+    struct tm tm;
+    time_t secs = (time_t)(start / 1000);
+    long long t = 0;
+    char *end;
+    int n, y, mo, d, h, mi, s = 0;
+
+    if (*when == '@') {
+	t = strtoll(when + 1, &end, 10);
+	return end == when + 1 || *end ? -1 : t * 1000;
+    }
+    if (*when == '+') {
+	for (end = when; ; ) {
+	    when = end + 1;
+	    n = (int)strtol(when, &end, 10);
+	    if (end == when || n < 0)
+		return -1;
+	    t = t * 60 + n;
+	    if (*end != ':')
+		break;
+	}
+	return *end ? -1 : start + t * 1000;
+    }
+    tm = *localtime(&secs);
+    if (sscanf(when, "%d-%d-%d%n", &y, &mo, &d, &n) == 3) {
+	tm.tm_year = y - 1900;
+	tm.tm_mon = mo - 1;
+	tm.tm_mday = d;
+	tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+	for (when += n; isspace((unsigned char)*when); when++)
+	    ;
+	if (!*when)
+	    goto done;
+    }
+    n = 0;
+    if (sscanf(when, "%d:%d%n:%d%n", &h, &mi, &n, &s, &n) < 2 || when[n])
+	return -1;
+    tm.tm_hour = h;
+    tm.tm_min = mi;
+    tm.tm_sec = s;
+done:
+    tm.tm_isdst = -1;
+    if ((secs = mktime(&tm)) == (time_t)-1)
+	return -1;
+    return secs * 1000LL;
+}
+
+/* copy s to out without escape sequences (colors), '\0' terminated */
+static void strip(const char *s, int len, char *out)
+{
+    const char *end = s + len;
+
+    while (s < end) {
+	if (*s != '\033') {
+	    *out++ = *s++;
+	    continue;
+	}
+	if (++s < end && *s == '[') {
+	    while (++s < end && (*s < '@' || *s > '~'))
+		;
+	}
+	if (s < end)
+	    s++;
+    }
+    *out = '\0';
+}
+
+#ifndef USE_REGEXP
+/* lowercase s in place, for -i without regexps */
+static void fold(char *s)
+{
+    for (; *s; s++)
+	*s = tolower((unsigned char)*s);
+}
+#endif
+
+static void usage(char *name)
+{
+    fprintf(stderr,
+	    "Usage: %s [-f from] [-u until] [-e pattern] [-i]\n"
+	    "       [-A lines] [-B lines] [-C lines] [-T start] infile outfile\n"
+	    "\n"
+	    "Writes to outfile the records of the movie infile received from `from'\n"
+	    "until `until' and, with -e, only the lines matching pattern (a regular\n"
+	    "expression, colors ignored; -i ignores case) with the lines after (-A)\n"
+	    "or before (-B) them, or both (-C). Times are \"[YYYY-MM-DD] HH:MM[:SS]\",\n"
+	    "\"@seconds\" since the epoch or \"+[[hours:]minutes:]seconds\" after\n"
+	    "the movie starts. Text movies start at `start' (seconds since the\n"
+	    "epoch), by default when infile was last modified minus its length.\n"
+	    "Writes a binary movie if outfile ends in \"" MOVIE_SUFFIX "\", a text one otherwise.\n"
+#ifdef USE_ZLIB
+	    "If it also ends in \".gz\", it is compressed.\n"
+#endif
+	    "Either file can be \"-\" for the standard input or output.\n",
+	    name);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    FILE *outfile = NULL;
+    movie_out put_out = put_file;
+    void *arg;
+    movie *in;
+    moviewriter *out;
+    movierec r;
+    struct stat st;
+    saved *ring = NULL;
+    char *from_s = NULL, *until_s = NULL, *pattern = NULL, *text = NULL;
+    long long start = -1, base = 0, from, until;
+    int after = 0, before = 0, icase = 0, textsize = 0;
+    int i, n, nring = 0, ringpos = 0, left = 0;
+#ifdef USE_REGEXP
+    regex_t re;
+#endif
+
+    while ((i = getopt(argc, argv, "f:u:e:iA:B:C:T:")) != -1) {
+	switch (i) {
+	case 'f': from_s = optarg; break;
+	case 'u': until_s = optarg; break;
+	case 'e': pattern = optarg; break;
+	case 'i': icase = 1; break;
+	case 'A': after = atoi(optarg); break;
+	case 'B': before = atoi(optarg); break;
+	case 'C': after = before = atoi(optarg); break;
+	case 'T': start = strtoll(optarg, NULL, 10) * 1000; break;
+	default: usage(argv[0]);
+	}
+    }
+    if (argc - optind != 2 || after < 0 || before < 0)
+	usage(argv[0]);
+    outname = argv[optind + 1];
+
+    if (pattern) {
+#ifdef USE_REGEXP
+	if ((i = regcomp(&re, pattern, REG_EXTENDED | REG_NOSUB |
+			 (icase ? REG_ICASE : 0))) != 0) {
+	    char buf[256];
+	    regerror(i, &re, buf, sizeof(buf));
+	    fprintf(stderr, "Bad pattern \"%s\": %s\n", pattern, buf);
+	    return 1;
+	}
+#else
+	if (icase)
+	    fold(pattern);
+#endif
+	if (before) {
+	    ring = (saved *)xrealloc(NULL, before * sizeof(saved));
+	    memset(ring, 0, before * sizeof(saved));
+	}
+    }
+
+    if ((in = movie_open(argv[optind])) == NULL) {
+	fprintf(stderr, "Error opening input file \"%s\"\n", argv[optind]);
+	return 1;
+    }
+    /* text movies only have relative times: find when they began */
+    if (!movie_is_binary(in)) {
+	if (start >= 0)
+	    base = start;
+	else if (stat(argv[optind], &st) == 0 && movie_end(in) >= 0)
+	    base = st.st_mtime * 1000LL - movie_end(in);
+    }
+    from = until = movie_start(in) + base;
+    if ((from_s && (from = parse_when(from_s, from)) < 0) ||
+	(until_s && (until = parse_when(until_s, until)) < 0)) {
+	fprintf(stderr, "Bad time \"%s\"\n", from < 0 ? from_s : until_s);
+	return 1;
+    }
+    if (!until_s)
+	until = -1;
+
+    i = strlen(outname);
+#ifdef USE_ZLIB
+    if (i > 3 && !strcmp(outname + i - 3, ".gz")) {
+	put_out = put_gz;
+	arg = gzopen(outname, "wb");
+    } else
+#endif
+	arg = outfile = strcmp(outname, "-") ? fopen(outname, "wb") : stdout;
+    if (arg == NULL) {
+	fprintf(stderr, "Error opening output file \"%s\"\n", outname);
+	return 1;
+    }
+    if (outfile)
+	setvbuf(outfile, NULL, _IOFBF, OUT_SIZE);
+    if (!(out = movie_writer(movie_binary_name(outname), put_out, arg))) {
+	fprintf(stderr, "Out of memory\n");
+	return 1;
+    }
+
+    /* binary movies with an index jump straight to `from' */
+    if (from_s && movie_seek(in, from - base) < 0) {
+	fprintf(stderr, "Cannot seek in this input\n");
+	return 1;
+    }
+
+    while ((i = movie_read(in, &r)) > 0) {
+	r.time += base;
+	if (r.time < from)
+	    continue;
+	if (until >= 0 && r.time > until)
+	    break;
+	if (!pattern) {
+	    put(out, r.kind, r.time, r.data, r.len);
+	    continue;
+	}
+	if (r.len >= textsize)
+	    text = (char *)xrealloc(text, textsize = r.len + 1);
+	strip(r.data, r.len, text);
+#ifdef USE_REGEXP
+	n = regexec(&re, text, 0, NULL, 0) == 0;
+#else
+	if (icase)
+	    fold(text);
+	n = strstr(text, pattern) != NULL;
+#endif
+	if (n) {
+	    /* the context before it, oldest first */
+	    for (n = nring; n > 0; n--) {
+		saved *s = &ring[(ringpos + before - n) % before];
+		put(out, s->kind, s->time, s->data, s->len);
+	    }
+	    nring = 0;
+	    put(out, r.kind, r.time, r.data, r.len);
+	    left = after;
+	} else if (left > 0) {
+	    put(out, r.kind, r.time, r.data, r.len);
+	    left--;
+	} else if (before) {
+	    saved *s = &ring[ringpos];
+	    if (r.len > s->size)
+		s->data = (char *)xrealloc(s->data, s->size = r.len);
+	    memcpy(s->data, r.data, r.len);
+	    s->len = r.len;
+	    s->kind = r.kind;
+	    s->time = r.time;
+	    ringpos = (ringpos + 1) % before;
+	    if (nring < before)
+		nring++;
+	}
+    }
+    if (i < 0) {
+	if (!movie_is_binary(in))
+	    fprintf(stderr, "Syntax error in line:\n%.*s\n", r.len, r.data);
+	else
+	    fprintf(stderr, "Corrupt movie at offset %lld\n", movie_tell(in));
+	return 1;
+    }
+    movie_writer_end(out);
+    movie_close(in);
+#ifdef USE_ZLIB
+    if (!outfile) {
+	if (gzclose((gzFile)arg) != Z_OK) {
+	    fprintf(stderr, "Error writing file \"%s\"\n", outname);
+	    return 1;
+	}
+	return 0;
+    }
+#endif
+    if (fclose(outfile) != 0) {
+	fprintf(stderr, "Error writing file \"%s\"\n", outname);
+	return 1;
+    }
+    return 0;
+}
@@ -14,6 +14,49 @@
 #include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <fcntl.h>
+
+#include "movie.h"
+
+#define OUT_SIZE (1024*1024)
+
+/*
+ * output goes through a big buffer and write(): converting gigabytes
+ * of movie is then limited by the disk, not by stdio
+ */
+static int outfd;
+static char outbuf[OUT_SIZE];
+static long outlen;
+
+static int out_flush()
+{
+    char *p = outbuf;
+    long n;
+
+    while (outlen > 0) {
+	if ((n = write(outfd, p, outlen)) <= 0)
+	    return -1;
+	p += n;
+	outlen -= n;
+    }
+    return 0;
+}
+
+static int out_put(s, len)
+char *s; long len;
+{
+    long n;
+
+    if (len > OUT_SIZE - outlen && out_flush() < 0)
+	return -1;
+    /* too big to be worth copying */
+    for (; len >= OUT_SIZE; s += n, len -= n)
+	if ((n = write(outfd, s, len)) <= 0)
+	    return -1;
+    memcpy(outbuf + outlen, s, len);
+    outlen += len;
+    return 0;
+}
 
 void millisec_sleep(msec)
 long msec;
@@ -24,12 +67,34 @@ long msec;
     select(0, NULL, NULL, NULL, &t);
 }
 
+/* parse [[hours:]minutes:]seconds into millisecs, -1 if invalid */
+long parse_time(s)
+char *s;
+{
+    long t = 0, n;
+    char *end;
+
+    for (;;) {
+	n = strtol(s, &end, 10);
+	if (end == s || n < 0)
+	    return -1;
+	t = t * 60 + n;
+	if (*end != ':')
+	    break;
+	s = end + 1;
+    }
+    return *end ? -1 : t * 1000;
+}
+
 int main(argc, argv)
 int argc; char *argv[];
 {
-    FILE *infile, *outfile;
-    char buf[4096];
-    int i, play = 0;
+    movie *in;
+    movierec r;
+    char *inname = NULL;
+    long long last;
+    long start = 0;
+    int i, err = 0, play = 0;
 
     if (strstr(argv[0], "powwow-movieplay"))
 	play = 1;
@@ -38,60 +103,74 @@ int argc; char *argv[];
 	return 1;
     }
 
-    if (play) {
-	if (argc == 2) {
-	    infile = fopen(argv[1], "rb");
-	    outfile = stdout;
-	    if (infile == NULL) {
-		fprintf(stderr, "Error opening input file \"%s\"\n", argv[1]);
-		return 1;
-	    }
-	} else {
-	    infile = stdin;
-	    outfile = stdout;
+    if (argc > 2 && !strcmp(argv[1], "-s")) {
+	if ((start = parse_time(argv[2])) < 0) {
+	    fprintf(stderr, "Bad time \"%s\", use [[hours:]minutes:]seconds\n", argv[2]);
+	    return 1;
 	}
+	argc -= 2;
+	argv += 2;
+    }
+
+    if (play) {
+	if (argc == 2)
+	    inname = argv[1];
+	outfd = 1;
     } else {
 	if (argc == 3) {
-	    infile = fopen(argv[1], "rb");
-	    outfile = fopen(argv[2], "wb");
-	    if (infile == NULL) {
-		fprintf(stderr, "Error opening input file \"%s\"\n", argv[1]);
-		return 1;
-	    }
-	    if (outfile == NULL) {
+	    inname = argv[1];
+	    if (!strcmp(argv[2], "-"))
+		outfd = 1;
+	    else if ((outfd = open(argv[2], O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0) {
 		fprintf(stderr, "Error opening output file \"%s\"\n", argv[2]);
 		return 1;
 	    }
 	} else {
-	    fprintf(stderr, "Usage: %s [infile [outfile]]\n", argv[0]);
+	    fprintf(stderr, "Usage: %s [-s [[hours:]minutes:]seconds] infile outfile\n", argv[0]);
 	    return 1;
 	}
     }
+    if ((in = movie_open(inname)) == NULL) {
+	fprintf(stderr, "Error opening input file \"%s\"\n", inname);
+	return 1;
+    }
 
-    while (fgets(buf, 4096, infile) != NULL) {
-	i = strlen(buf);
-	if (i > 0 && buf[i-1] == '\n')
-	    buf[i-1] = '\0';
-	if (!strncmp(buf, "sleep ", 6)) {
-	    if (play)
-		millisec_sleep(atoi(buf + 6));
-	}
-	else if (!strncmp(buf, "line ", 5))
-	    fprintf(outfile, "%s\n", buf + 5);
-	else if (!strncmp(buf, "prompt ", 7))
-	    fprintf(outfile, "%s", buf + 7);
-	else {
-	    fprintf(stderr, "Syntax error in line:\n%s\n", buf);
+    last = movie_start(in);
+    if (start) {
+	last += start;
+	if (movie_seek(in, last) < 0) {
+	    fprintf(stderr, "Cannot seek in this input\n");
 	    return 1;
 	}
-	fflush(outfile);
     }
-    if (feof(infile)) {
-	fprintf(outfile, "\n");
+
+    while ((i = movie_read(in, &r)) > 0) {
+	if (play && r.time > last) {
+	    if ((err = out_flush() < 0))
+		break;
+	    millisec_sleep((long)(r.time - last));
+	}
+	last = r.time;
+	if (r.kind == MOVIE_LINE)
+	    err = out_put(r.data, r.len) < 0 || out_put("\n", 1) < 0;
+	else if (r.kind == MOVIE_PROMPT)
+	    err = out_put(r.data, r.len) < 0;
+	if (err)
+	    break;
+    }
+    if (!err && i == 0)
+	err = out_put("\n", 1) < 0;
+    if (err || out_flush() < 0 || (outfd != 1 && close(outfd) < 0)) {
+	fprintf(stderr, "Error writing %s\n", play ? "output" : argv[2]);
+	return 1;
+    }
+    if (i == 0) {
 	return 0;
+    } else if (r.kind == 0 && !movie_is_binary(in)) {
+	fprintf(stderr, "Syntax error in line:\n%.*s\n", r.len, r.data);
+	return 1;
     } else {
 	fprintf(stderr, "Error reading file\n");
 	return 1;
     }
 }
-
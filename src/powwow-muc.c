@@ -3,6 +3,8 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "movie.h"
+
 /* Curses based powwow movie player.
  * Author: Steve Slaven - http://hoopajoo.net
  *
@@ -13,19 +15,181 @@
  *
  */
 
-#define JUMP_SMALL     1000
-#define JUMP_BIG       5000
+#define JUMP_SMALL     10000	/* millisecs */
+#define JUMP_BIG       60000
 #define MAX_SPEED      20
+#define IX_STEP        256	/* records between two index entries */
+#define BATCH          64	/* records shown between two screen updates
+				   when there is no time to wait */
+
+/* where every IX_STEP-th record starts, and its time */
+typedef struct {
+	moviepos pos;
+	long long time;
+} ixentry;
+
+static movie *in;
+static ixentry *ix;		/* NULL if the movie cannot be read again */
+static long ix_count;
+static long records = -1;	/* in the movie, -1 if not known */
+static long cur;		/* records read so far */
+static long long now;		/* time of the last one */
+
+/* current SGR state */
+static int attr, fg = -1, bg = -1;
+
+/* read the whole movie once, noting where every IX_STEP-th record is */
+static void build_index( long long *end ) {
+	moviepos pos;
+	movierec rec;
+	long n;
+
+	movie_getpos( in, &pos );
+	if( movie_setpos( in, &pos ) < 0 )
+		return;		/* a pipe: play it as it comes */
+
+	for( n = 0; ; n++ ) {
+		movie_getpos( in, &pos );
+		if( movie_read( in, &rec ) <= 0 )
+			break;
+		if( n % IX_STEP == 0 ) {
+			if( ix_count % 1024 == 0 &&
+			    ! ( ix = realloc( ix, ( ix_count + 1024 ) * sizeof( ixentry ) ) ) ) {
+				perror( "Out of memory" );
+				exit( 1 );
+			}
+			ix[ ix_count ].pos = pos;
+			ix[ ix_count++ ].time = rec.time;
+		}
+		*end = rec.time;
+	}
+	records = n;
+	if( ix_count )
+		movie_setpos( in, &ix[ 0 ].pos );
+}
+
+/* go to record n (the first is 0), exactly */
+static void goto_record( long n ) {
+	movierec rec;
+
+	if( n > records )
+		n = records;
+	if( n < 0 || ! ix_count )
+		return;
+	movie_setpos( in, &ix[ n / IX_STEP ].pos );
+	now = ix[ n / IX_STEP ].time;
+	for( cur = n / IX_STEP * IX_STEP; cur < n && movie_read( in, &rec ) > 0; cur++ )
+		now = rec.time;
+}
+
+/* the number of the first record not older than t */
+static long find_time( long long t ) {
+	movierec rec;
+	long lo = 0, hi = ix_count, mid;
+
+	/* last index entry older than t */
+	while( hi - lo > 1 ) {
+		mid = ( lo + hi ) / 2;
+		if( ix[ mid ].time < t )
+			lo = mid;
+		else
+			hi = mid;
+	}
+	goto_record( lo * IX_STEP );
+	while( cur < records && movie_read( in, &rec ) > 0 && rec.time < t )
+		cur++;
+	return cur;
+}
+
+/* apply the parameters of an ESC [ ... m sequence */
+static void sgr( WINDOW *w, const char *p, const char *end ) {
+	int n, pair, f, b;
+
+	while( p <= end ) {
+		for( n = 0; p < end && *p >= '0' && *p <= '9'; p++ )
+			n = n * 10 + ( *p - '0' );
+		p++;	/* past the ';' */
+		if( n == 0 ) {
+			attr = 0;
+			fg = bg = -1;
+		} else if( n == 1 )
+			attr |= A_BOLD;
+		else if( n == 4 )
+			attr |= A_UNDERLINE;
+		else if( n == 5 )
+			attr |= A_BLINK;
+		else if( n == 7 )
+			attr |= A_REVERSE;
+		else if( n == 22 )
+			attr &= ~A_BOLD;
+		else if( n == 24 )
+			attr &= ~A_UNDERLINE;
+		else if( n == 25 )
+			attr &= ~A_BLINK;
+		else if( n == 27 )
+			attr &= ~A_REVERSE;
+		else if( n >= 30 && n <= 37 )
+			fg = n - 30;
+		else if( n == 39 )
+			fg = -1;
+		else if( n >= 40 && n <= 47 )
+			bg = n - 40;
+		else if( n == 49 )
+			bg = -1;
+		else if( n >= 90 && n <= 97 ) {
+			fg = n - 90;
+			attr |= A_BOLD;
+		} else if( n >= 100 && n <= 107 )
+			bg = n - 100;
+		else if( n == 38 || n == 48 ) {
+			/* 256 colors or RGB: not shown, skip their arguments */
+			for( n = p < end && *p == '2' ? 4 : 2; n > 0; n--, p++ )
+				while( p < end && *p != ';' )
+					p++;
+		}
+	}
+
+	pair = 0;
+	if( has_colors() && ( fg >= 0 || bg >= 0 ) ) {
+		f = fg < 0 ? COLOR_WHITE : fg;
+		b = bg < 0 ? COLOR_BLACK : bg;
+		pair = 1 + f + 8 * b;
+		if( pair >= COLOR_PAIRS )
+			pair = 1 + f;
+	}
+	wattrset( w, attr | COLOR_PAIR( pair ) );
+}
+
+/* show s, decoding the escape sequences for colors in one pass */
+static void show( WINDOW *w, const char *s, int len ) {
+	const char *end = s + len, *p;
+
+	while( s < end ) {
+		for( p = s; p < end && *p != '\033' && *p != '\r'; p++ )
+			;
+		if( p > s )
+			waddnstr( w, s, p - s );
+		if( p == end )
+			break;
+		if( *p == '\033' && ++p < end && *p == '[' ) {
+			for( s = ++p; p < end && ( *p < '@' || *p > '~' ); p++ )
+				;
+			if( p < end && *p == 'm' )
+				sgr( w, s, p );
+		}
+		s = p + 1;
+	}
+}
 
 /* Speed is a variable from 0 - 9, where 5 = normal and > 5 is faster */
 int main( int argc, char *argv[] ) {
 	WINDOW *text, *status;
 	int speed = 5;
-	int key, sleep, orig, color, looping, cursx, cursy;
-	size_t i;
-	FILE *in;
-	char line[ 1000 ], *displine, action[ 100 ];
-	long curr_pos, file_size, new_pos;
+	int key, sleep, orig, looping, cursx, cursy, r, f, b, batch = 0;
+	movierec rec;
+	char *displine, *action;
+	long long file_size, start, end, new_time;
+	long target, catchup = 0;
 
 	if( argc < 2 ) {
 		fprintf( stderr,
@@ -40,27 +204,34 @@ int main( int argc, char *argv[] ) {
 	}
 
 	/* Validate our file passed */
-	if( ! ( in = fopen( argv[ 1 ], "ro" ) ) ) {
+	if( ! ( in = movie_open( argv[ 1 ] ) ) ) {
 		perror( "Unable to open file" );
 		exit( 1 );
 	}
 
-	/* Get file size */
-	fseek( in, 0, SEEK_END );
-	file_size = ftell( in );
-	rewind( in );
+	/* Get length in time and in records, and file size */
+	now = start = end = movie_start( in );
+	fprintf( stderr, "Indexing %s...", argv[ 1 ] );
+	build_index( &end );
+	fprintf( stderr, "\n" );
+	if( ! ix_count )
+		end = movie_end( in );
+	file_size = movie_size( in );
+	if( file_size <= 0 )
+		file_size = 1;
 
 	/* Setup some basic stuff */
 	initscr();
 	cbreak();
 	noecho();
 
-	/* Initialize color */
+	/* Initialize color: every ansi foreground on every background,
+	   or on black only if the terminal has not that many pairs */
 	start_color();
-
-	/* this *should* init the default ansi colors... :/ */
-	for( i = 0; i < 16; i++ )
-		init_pair( i, i, COLOR_BLACK );
+	for( b = 0; b < 8; b++ )
+		for( f = 0; f < 8; f++ )
+			if( 1 + f + 8 * b < COLOR_PAIRS )
+				init_pair( 1 + f + 8 * b, f, b );
 
 	/* Create our windows, a status bar on the bottom and a
 	   scrollable window on top */
@@ -76,53 +247,53 @@ int main( int argc, char *argv[] ) {
 
 	/* instructions */
 	mvwprintw( status, 0, 0,
-		"(q)uit (r)ew small (R)ew large (f)orw small (F)orw large (0-9)(+)(-) speed" );
+		"(q)uit (r)ew small (R)ew large (f)orw small (F)orw large (<)(>) page (g)start (0-9)(+)(-) speed" );
 
 	/* Main loop */
 	refresh();
 	timeout( 0 );
 	looping = 1;
 	while( looping ) {
-		memset( line, 0, sizeof line );
-		fgets( line, sizeof line, in );
+		r = movie_read( in, &rec );
+		if( r > 0 )
+			cur++;
+		else {
+			rec.kind = 0;
+			rec.data = "";
+			rec.len = 0;
+			rec.time = now;
+		}
 
-		/* get file pos */
-		new_pos = curr_pos = ftell( in );
+		/* wait the time from the previous record before showing it */
+		sleep = (int)( rec.time - now );
+		now = rec.time;
+		new_time = now;
+		target = -1;
 
 		/* handle disp or other */
 		displine = NULL;
-		if( strncmp( line, "line", 4 ) == 0 ) {
-			displine = &line[ 5 ];
-			sleep = 0;
-		}else if( strncmp( line, "prompt", 5 ) == 0 ) {
-			displine = &line[ 7 ];
-			/* Munch newline */
-			line[ strlen( line ) - 1 ] = 0;
-			sleep = 0;
-		}else if( strncmp( line, "sleep", 5 ) == 0 ) {
-			sscanf( line, "sleep %d", &sleep );
-		}else if( line[ 0 ] == '#' ) { /* custom extension for commenting logs */
-			sscanf( line, "#%d", &sleep );
+		action = "";
+		if( rec.kind == MOVIE_LINE )
+			action = "line";
+		else if( rec.kind == MOVIE_PROMPT )
+			action = "prompt";
+		else if( rec.kind == MOVIE_COMMENT ) { /* custom extension for commenting logs */
+			action = "#";
+			orig = (int)strtol( rec.data + 1, &displine, 10 );
+			if( displine > rec.data + 1 )
+				sleep = orig;
 			if( sleep > 0 )
 				sleep *= 100; /* comment sleep is in seconds */
-
-			/* Skip to space */
-			displine = line;
-			while( displine[ 0 ] != ' ' && displine[ 0 ] != 0 ) {
-				displine++;
-			}
-			displine++;
-
-			/* We will go ahead and display it here, in bold, then
-			   null out displine so it will not display later */
-			wattron( text, A_REVERSE );
-			wprintw( text, "##==> %s", displine );
-			wattroff( text, A_REVERSE );
-			displine = NULL;
+			displine = memchr( rec.data, ' ', rec.len );
+			displine = displine ? displine + 1 : rec.data + rec.len;
 		}
 
-		/* suck out action for display */
-		sscanf( line, "%99s", action );
+		/* the records before the one we jumped to fill the screen
+		   at once, so it looks as it did then */
+		if( cur <= catchup && r > 0 ) {
+			sleep = 0;
+			goto display;
+		}
 
 		/* Modify sleep time according to speed, zero is fast as you can go, 1 == pause */
 		orig = sleep;
@@ -136,54 +307,30 @@ int main( int argc, char *argv[] ) {
 		if( speed == 0 )
 			sleep = -1;
 
-		/* handle insane speed */
-		/* if( speed == 9 )
-			sleep = 0; */
+		/* with nothing to wait for, update the screen only now and then */
+		if( sleep <= 0 && speed != 0 && r > 0 && ++batch < BATCH )
+			goto display;
+		batch = 0;
 
 		/* Setup sleeptime for getch() */
 		timeout( sleep );
 
 		/* Update status line */
-		mvwprintw( status, 1, 0,
-			"%7d/%7d/%2d%% Speed: %d (5=normal,0=pause) Cmd: %-6s (%d/%d)\n",
-			curr_pos, file_size, curr_pos * 100 / file_size,
-			speed, action, sleep, orig );
+		if( records >= 0 )
+			mvwprintw( status, 1, 0,
+				"%7lld/%7lld s line %ld/%ld Speed: %d (5=normal,0=pause) Cmd: %-6s (%d/%d)\n",
+				( now - start ) / 1000, ( end - start ) / 1000,
+				cur, records, speed, action, sleep, orig );
+		else
+			mvwprintw( status, 1, 0,
+				"%7lld/%7lld s/%2d%% Speed: %d (5=normal,0=pause) Cmd: %-6s (%d/%d)\n",
+				( now - start ) / 1000, ( end - start ) / 1000,
+				(int)( movie_tell( in ) * 100 / file_size ),
+				speed, action, sleep, orig );
 		wrefresh( status );
 
-		/* Disp if we found an offset to do */
-		if( displine != NULL ) {
-			/* handle converting ansi colors to curses attrs */
-			for( i = 0; i < strlen( displine ); i++ ) {
-				if( displine[ i ] == 0x1b ) {
-					/* this is super crappy ansi color decoding */
-					i++;
-					if( strncmp( &displine[ i ], "[3", 2 ) == 0 ) {
-						/* start a color */
-						sscanf( &displine[ i ], "[3%dm", &color );
-						wattron( text, COLOR_PAIR( color ) );
-					}else if( strncmp( &displine[ i ], "[9", 2 ) == 0 ) {
-						/* start a high color */
-						sscanf( &displine[ i ], "[9%dm", &color );
-						wattron( text, COLOR_PAIR( color ) );
-						wattron( text, A_BOLD );
-					}else if( strncmp( &displine[ i ], "[1", 2 ) == 0 ) {
-						wattron( text, A_BOLD );
-					}else if( strncmp( &displine[ i ], "[0", 2 ) == 0 ) {
-						/* end color, color will (should?) still be set from last color */
-						/* wattr_off( text, COLOR_PAIR( color ), NULL ); */
-						wattrset( text, A_NORMAL );
-					}
-					/* eat chars to the next m */
-					while( displine[ i ] != 'm' && displine != 0 )
-						i++;
-				}else{
-					waddch( text, (unsigned char)displine[ i ] );
-				}
-			}
-		}
-
 		/* check if we are at EOF and override timeout */
-		if( curr_pos == file_size ) {
+		if( r <= 0 ) {
 			wprintw( text, "\n**** END ***\n" );
 			timeout( -1 );
 		}
@@ -210,48 +357,32 @@ int main( int argc, char *argv[] ) {
 				speed--;
 				break;
 
-			case '1':
-				speed = 1;
-				break;
-			case '2':
-				speed = 2;
-				break;
-			case '3':
-				speed = 3;
-				break;
-			case '4':
-				speed = 4;
-				break;
-			case '5':
-				speed = 5;
-				break;
-			case '6':
-				speed = 6;
-				break;
-			case '7':
-				speed = 7;
-				break;
-			case '8':
-				speed = 8;
-				break;
-			case '9':
-				speed = 9;
-				break;
-			case '0':
-				speed = 0;
+			case '0': case '1': case '2': case '3': case '4':
+			case '5': case '6': case '7': case '8': case '9':
+				speed = key - '0';
 				break;
 
 			case 'r':
-				new_pos -= JUMP_SMALL;
+				new_time -= JUMP_SMALL;
 				break;
 			case 'R':
-				new_pos -= JUMP_BIG;
+				new_time -= JUMP_BIG;
 				break;
 			case 'f':
-				new_pos += JUMP_SMALL;
+				new_time += JUMP_SMALL;
 				break;
 			case 'F':
-				new_pos += JUMP_BIG;
+				new_time += JUMP_BIG;
+				break;
+
+			case '<':
+				target = cur - 1 > LINES - 2 ? cur - 1 - ( LINES - 2 ) : 0;
+				break;
+			case '>':
+				target = cur - 1 + ( LINES - 2 );
+				break;
+			case 'g':
+				target = 0;
 				break;
 
 			default:
@@ -266,33 +397,55 @@ int main( int argc, char *argv[] ) {
 			speed = 0;
 
 		/* Check if we are moving the seek */
-		if( new_pos != curr_pos ) {
-			wattron( text, A_BOLD );
-			if( new_pos > file_size )
-				new_pos = file_size;
-
-			if( new_pos < 0 )
-				new_pos = 0;
+		if( new_time != now || ( target >= 0 && ix_count ) ) {
+			if( end >= 0 && new_time > end )
+				new_time = end;
+
+			if( new_time < start )
+				new_time = start;
+
+			if( ix_count ) {
+				/* exactly there, with the screen as it was then */
+				if( target < 0 )
+					target = find_time( new_time );
+				if( target > records )
+					target = records;
+				goto_record( target > LINES - 2 ? target - ( LINES - 2 ) : 0 );
+				catchup = target;
+				werase( text );
+				wattrset( text, A_NORMAL );
+				attr = 0;
+				fg = bg = -1;
+				continue;
+			}
 
+			wattron( text, A_BOLD );
 			wprintw( text,
-				"\n=============\nMoving from %d to file offset %d\n",
-				curr_pos, new_pos );
+				"\n=============\nMoving from %lld to %lld seconds\n",
+				( now - start ) / 1000, ( new_time - start ) / 1000 );
 
-			/* calcs offsets because we may want to seek to
-			   0, which using SEEK_CUR won't let us do without
-			   some other error checking that I don't want to do */
-			fseek( in, new_pos, SEEK_SET );
+			/* find the first record not older than new_time */
+			if( movie_seek( in, new_time ) == 0 )
+				now = new_time;
 
-			/* read to next newline so we don't break up
-			   lines seeking around */
-			fgets( line, sizeof line, in );
-			new_pos = ftell( in );
-
-			/* Make a note of moving */
-			wprintw( text,
-				"Final offset after adjusting for newline: %d (%d)\n=============\n",
-				new_pos, new_pos - curr_pos );
+			wprintw( text, "=============\n" );
 			wattroff( text, A_BOLD );
+			continue;
+		}
+
+display:
+		/* Disp if we found an offset to do, now that its time came */
+		if( displine != NULL ) {
+			/* We will go ahead and display it here, in reverse */
+			wattron( text, A_REVERSE );
+			wprintw( text, "##==> " );
+			waddnstr( text, displine, rec.data + rec.len - displine );
+			waddch( text, '\n' );
+			wattroff( text, A_REVERSE );
+		} else if( rec.kind == MOVIE_LINE || rec.kind == MOVIE_PROMPT ) {
+			show( text, rec.data, rec.len );
+			if( rec.kind == MOVIE_LINE )
+				waddch( text, '\n' );
 		}
 	}
 
@@ -301,7 +454,8 @@ int main( int argc, char *argv[] ) {
 	delwin( status );
 	endwin();
 
-	fclose( in );
+	movie_close( in );
+	free( ix );
 
 	return( 0 );
 }
@@ -0,0 +1,528 @@
+/*
+ *  scrollback.c  --  the text received lately, kept compressed in memory,
+ *                    and #search to find lines in it
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/time.h>
+
+#ifdef USE_ZLIB
+# include <zlib.h>
+#endif
+
+#include "defines.h"
+#include "main.h"
+#include "utils.h"
+#include "tty.h"
+#include "scrollback.h"
+
+/*
+ * Lines are appended to the current block: for each one the millisecs
+ * since the block started (4 bytes), the connection it came from
+ * (1 byte, index in ids[]), the text as received and a '\0'.
+ * When the block holds SB_BLOCK bytes it is compressed, and the trigrams
+ * of its text (without escape sequences, in lowercase) are set in a
+ * bloom filter: #search decompresses only the blocks that might
+ * contain all the trigrams of what it looks for.
+ * The oldest blocks are dropped to stay within scrollback_size bytes.
+ */
+typedef struct sbblock {
+    long long time;		/* of the first line */
+    long first;			/* number of the first line */
+    int lines;
+    int len;			/* bytes of lines */
+    int zlen;			/* bytes in data, == len if not compressed */
+    char *data;
+    unsigned char bloom[SB_BLOOM / 8];
+} sbblock;
+
+#define SB_LINEHDR 5
+
+int scrollback_size = 0;	/* #setvar scrollback, 0 = none */
+
+static sbblock **blocks;	/* oldest first */
+static int nblocks, maxblocks;
+static long sb_bytes;		/* memory used by blocks */
+
+static char *cur;		/* the current block, not compressed */
+static int cur_len, cur_size, cur_lines;
+static long long cur_time;
+static long next_line;		/* number of the next line added */
+
+static char *ids[256];		/* connection ids */
+static int nids;
+
+static int replaying;		/* #search -e is sending lines back */
+
+/* the block last decompressed, and where its lines start */
+static sbblock *dec_b;
+static char *dec;
+static int dec_size, *dec_off, dec_offsize;
+
+#define MSECS(t) ((t).tv_sec * (long long)mSEC_PER_SEC + (t).tv_usec / uSEC_PER_mSEC)
+#define TRIGRAM(a, b, c) \
+    (((((unsigned)(a) << 16 | (unsigned)(b) << 8 | (unsigned)(c)) \
+       * 2654435761U & 0xffffffffU) >> 12) % SB_BLOOM)
+
+/*
+ * copy s to out without escape sequences, return the length
+ */
+static int sb_strip(const char *s, char *out)
+{
+    char *o = out;
+
+    while (*s) {
+	if (*s != '\033') {
+	    *o++ = *s++;
+	    continue;
+	}
+	if (*++s == '[') {
+	    /* parameters, then a final byte in @...~ */
+	    while (*++s && (*s < '@' || *s > '~'))
+		;
+	}
+	if (*s)
+	    s++;
+    }
+    *o = '\0';
+    return o - out;
+}
+
+static void sb_trigrams(sbblock *b, const char *s, int len)
+{
+    unsigned char x, y, z;
+    int i;
+
+    if (len < 3)
+	return;
+    x = tolower((unsigned char)s[0]);
+    y = tolower((unsigned char)s[1]);
+    for (i = 2; i < len; i++) {
+	z = tolower((unsigned char)s[i]);
+	b->bloom[TRIGRAM(x, y, z) / 8] |= 1 << (TRIGRAM(x, y, z) & 7);
+	x = y;
+	y = z;
+    }
+}
+
+static void sb_free(sbblock *b)
+{
+    if (b == dec_b)
+	dec_b = NULL;
+    sb_bytes -= sizeof(sbblock) + b->zlen;
+    free(b->data);
+    free(b);
+}
+
+/* drop the oldest blocks until we use at most size bytes */
+static void sb_trim(long size)
+{
+    int n = 0;
+
+    while (n < nblocks && sb_bytes > size)
+	sb_free(blocks[n++]);
+    if (n) {
+	nblocks -= n;
+	memmove(blocks, blocks + n, nblocks * sizeof(sbblock *));
+    }
+}
+
+/*
+ * compress the current block and index it
+ */
+static void sb_seal(void)
+{
+    sbblock *b, **p;
+    char *text = NULL, *s;
+    int i;
+#ifdef USE_ZLIB
+    uLongf zlen;
+#endif
+
+    if (!cur_lines)
+	return;
+    if (nblocks == maxblocks) {
+	if (!(p = (sbblock **)realloc(blocks, (maxblocks * 2 + 16) * sizeof(sbblock *)))) {
+	    errmsg("malloc");
+	    return;
+	}
+	blocks = p;
+	maxblocks = maxblocks * 2 + 16;
+    }
+    if (!(b = (sbblock *)calloc(1, sizeof(sbblock))) ||
+	!(text = (char *)malloc(cur_len))) {
+	errmsg("malloc");
+	if (b)
+	    free(b);
+	return;
+    }
+    for (s = cur; s < cur + cur_len; s += SB_LINEHDR + strlen(s + SB_LINEHDR) + 1) {
+	i = sb_strip(s + SB_LINEHDR, text);
+	sb_trigrams(b, text, i);
+    }
+    b->time = cur_time;
+    b->first = next_line - cur_lines;
+    b->lines = cur_lines;
+    b->len = b->zlen = cur_len;
+#ifdef USE_ZLIB
+    zlen = cur_len;
+    if (compress2((Bytef *)text, &zlen, (Bytef *)cur, cur_len, Z_BEST_SPEED) == Z_OK &&
+	zlen < (uLongf)cur_len) {
+	b->zlen = zlen;
+	if ((s = (char *)realloc(text, zlen)))
+	    text = s;
+    } else
+#endif
+    memcpy(text, cur, cur_len);
+    b->data = text;
+
+    blocks[nblocks++] = b;
+    sb_bytes += sizeof(sbblock) + b->zlen;
+    cur_len = cur_lines = 0;
+    sb_trim(scrollback_size);
+}
+
+static int sb_id(char *id)
+{
+    int i;
+
+    if (!id)
+	id = "";
+    for (i = 0; i < nids; i++)
+	if (!strcmp(ids[i], id))
+	    return i;
+    if (nids == 256 || !(ids[nids] = my_strdup(id)))
+	return 0;
+    return nids++;
+}
+
+/*
+ * add a line received from connection id
+ */
+void scrollback_add(char *id, char *line, int len)
+{
+    long long t;
+    unsigned long d;
+    char *p;
+    int i;
+
+    if (!scrollback_size || replaying)
+	return;
+    update_now();
+    t = MSECS(now);
+    if (cur_lines && (cur_len + SB_LINEHDR + len + 1 > SB_BLOCK ||
+		      t - cur_time > 0xffffffffLL || t < cur_time))
+	sb_seal();
+    if (cur_len + SB_LINEHDR + len + 1 > cur_size) {
+	i = MAX2(SB_BLOCK, cur_len + SB_LINEHDR + len + 1);
+	if (!(p = (char *)realloc(cur, i))) {
+	    errmsg("malloc");
+	    return;
+	}
+	cur = p;
+	sb_bytes += i - cur_size;
+	cur_size = i;
+    }
+    if (!cur_lines)
+	cur_time = t;
+
+    p = cur + cur_len;
+    for (d = t - cur_time, i = 0; i < 4; i++, d >>= 8)
+	p[i] = (char)(d & 0xff);
+    p[4] = (char)sb_id(id);
+    memcpy(p + SB_LINEHDR, line, len);
+    p[SB_LINEHDR + len] = '\0';
+    cur_len += SB_LINEHDR + len + 1;
+    cur_lines++;
+    next_line++;
+}
+
+void scrollback_resize(int size)
+{
+    scrollback_size = size;
+    if (size) {
+	sb_trim(size);
+	return;
+    }
+    sb_trim(-1);
+    free(blocks);
+    blocks = NULL;
+    nblocks = maxblocks = 0;
+    if (cur) {
+	free(cur);
+	sb_bytes -= cur_size;
+	cur = NULL;
+    }
+    cur_len = cur_size = cur_lines = 0;
+}
+
+/*
+ * the lines of b (uncompressed), with an index of where each starts.
+ * Return NULL if not possible.
+ */
+static char *sb_decode(sbblock *b)
+{
+    char *s;
+    int i;
+#ifdef USE_ZLIB
+    uLongf len;
+#endif
+
+    if (b == dec_b)
+	return dec;
+    dec_b = NULL;
+    if (b->len > dec_size) {
+	if (!(s = (char *)realloc(dec, b->len)))
+	    return NULL;
+	dec = s;
+	dec_size = b->len;
+    }
+    if (b->lines > dec_offsize) {
+	int *o = (int *)realloc(dec_off, b->lines * sizeof(int));
+	if (!o)
+	    return NULL;
+	dec_off = o;
+	dec_offsize = b->lines;
+    }
+#ifdef USE_ZLIB
+    len = b->len;
+    if (b->zlen < b->len) {
+	if (uncompress((Bytef *)dec, &len, (Bytef *)b->data, b->zlen) != Z_OK)
+	    return NULL;
+    } else
+#endif
+    memcpy(dec, b->data, b->len);
+    for (s = dec, i = 0; i < b->lines; i++, s += SB_LINEHDR + strlen(s + SB_LINEHDR) + 1)
+	dec_off[i] = s - dec;
+    dec_b = b;
+    return dec;
+}
+
+/*
+ * find line number n: return its header, or NULL if not kept any more.
+ * *time is set to the time of its block.
+ */
+static char *sb_line(long n, long long *time)
+{
+    int lo = 0, hi = nblocks, mid;
+
+    if (n >= next_line)
+	return NULL;
+    if (n >= next_line - cur_lines) {
+	char *s = cur;
+	for (n -= next_line - cur_lines; n; n--)
+	    s += SB_LINEHDR + strlen(s + SB_LINEHDR) + 1;
+	*time = cur_time;
+	return s;
+    }
+    if (!nblocks || n < blocks[0]->first)
+	return NULL;
+    while (hi - lo > 1) {
+	mid = (lo + hi) / 2;
+	if (blocks[mid]->first <= n)
+	    lo = mid;
+	else
+	    hi = mid;
+    }
+    if (!sb_decode(blocks[lo]))
+	return NULL;
+    *time = blocks[lo]->time;
+    return dec + dec_off[n - blocks[lo]->first];
+}
+
+static long long sb_time(char *h, long long base)
+{
+    return base + ((unsigned long)(unsigned char)h[0] |
+		   (unsigned long)(unsigned char)h[1] << 8 |
+		   (unsigned long)(unsigned char)h[2] << 16 |
+		   (unsigned long)(unsigned char)h[3] << 24);
+}
+
+/* does line (stripped) contain text? */
+static int sb_match(char *line, char *text, int len, int icase)
+{
+    char *p;
+
+    if (!icase)
+	return strstr(line, text) != NULL;
+    for (p = line; *p; p++)
+	if (tolower((unsigned char)*p) == tolower((unsigned char)*text) &&
+	    !strncasecmp(p, text, len))
+	    return 1;
+    return 0;
+}
+
+/*
+ * search the n lines starting at data + off[...], numbered from first,
+ * from the last one, adding the numbers of the matching ones to found[].
+ * Return how many are in found[].
+ */
+static int sb_scan(char *data, int *off, int n, long first,
+		   char *text, int len, int id, int icase,
+		   long *found, int nfound, int max, char *buf)
+{
+    char *h;
+
+    while (n-- > 0 && nfound < max) {
+	h = data + off[n];
+	if (id >= 0 && (unsigned char)h[4] != id)
+	    continue;
+	sb_strip(h + SB_LINEHDR, buf);
+	if (sb_match(buf, text, len, icase))
+	    found[nfound++] = first + n;
+    }
+    return nfound;
+}
+
+static void sb_show(long n, char mark)
+{
+    char *h, when[32];
+    long long t;
+    time_t secs = now.tv_sec;
+    struct tm tm;
+    int today;
+
+    if (!(h = sb_line(n, &t)))
+	return;
+    tm = *localtime(&secs);
+    today = tm.tm_year * 400 + tm.tm_yday;
+    t = sb_time(h, t);
+    secs = (time_t)(t / mSEC_PER_SEC);
+    tm = *localtime(&secs);
+    strftime(when, sizeof(when), tm.tm_year * 400 + tm.tm_yday == today ?
+	     "%H:%M:%S" : "%b %d %H:%M:%S", &tm);
+    if (nids > 1 && *ids[(unsigned char)h[4]])
+	tty_printf("%s%c ##%s> %s%s\n", when, mark, ids[(unsigned char)h[4]],
+		   h + SB_LINEHDR, tty_modenorm);
+    else
+	tty_printf("%s%c %s%s\n", when, mark, h + SB_LINEHDR, tty_modenorm);
+}
+
+static void sb_replay(long n)
+{
+    char *h, *buf;
+    long long t;
+    int len;
+
+    if (!(h = sb_line(n, &t)))
+	return;
+    len = strlen(h + SB_LINEHDR);
+    if (!(buf = (char *)malloc(len + 2))) {
+	errmsg("malloc");
+	return;
+    }
+    memcpy(buf, h + SB_LINEHDR, len);
+    buf[len] = '\n';
+    buf[len + 1] = '\0';
+    process_remote_input(buf, len + 1);
+    free(buf);
+}
+
+/*
+ * #search: show the last max lines containing text (from connection
+ * id only, if not NULL) with context lines around them, oldest first,
+ * or with emulate set process them again as if just received.
+ */
+void scrollback_search(char *text, char *id, int icase, int context,
+		       int max, int emulate)
+{
+    unsigned tri[BUFSIZE];
+    struct timeval t0, t1;
+    long *found, last;
+    char *buf = NULL, *s;
+    int *off = NULL;
+    int len = strlen(text), ntri = 0, nfound = 0, b, i, want = -1, skipped = 0;
+
+    if (!scrollback_size) {
+	PRINTF("#search: nothing kept, see #setvar scrollback\n");
+	return;
+    }
+    if (id) {
+	for (want = 0; want < nids && strcmp(ids[want], id); want++)
+	    ;
+	if (want == nids) {
+	    PRINTF("#search: nothing received from ##%s\n", id);
+	    return;
+	}
+    }
+    /* no line is longer than cur_size */
+    if (!(found = (long *)malloc(max * sizeof(long))) ||
+	!(buf = (char *)malloc(cur_size + 1)) ||
+	!(off = (int *)malloc((cur_lines + 1) * sizeof(int)))) {
+	errmsg("malloc");
+	if (found)
+	    free(found);
+	if (buf)
+	    free(buf);
+	return;
+    }
+    gettimeofday(&t0, NULL);
+
+    for (i = 2; i < len && ntri < BUFSIZE; i++)
+	tri[ntri++] = TRIGRAM(tolower((unsigned char)text[i - 2]),
+			      tolower((unsigned char)text[i - 1]),
+			      tolower((unsigned char)text[i]));
+
+    for (s = cur, i = 0; i < cur_lines; i++, s += SB_LINEHDR + strlen(s + SB_LINEHDR) + 1)
+	off[i] = s - cur;
+    nfound = sb_scan(cur, off, cur_lines, next_line - cur_lines,
+		     text, len, want, icase, found, 0, max, buf);
+    free(off);
+    for (b = nblocks - 1; b >= 0 && nfound < max; b--) {
+	for (i = 0; i < ntri; i++)
+	    if (!(blocks[b]->bloom[tri[i] / 8] & (1 << (tri[i] & 7))))
+		break;
+	if (i < ntri) {
+	    skipped++;
+	    continue;
+	}
+	if (!sb_decode(blocks[b]))
+	    continue;
+	nfound = sb_scan(dec, dec_off, blocks[b]->lines, blocks[b]->first,
+			 text, len, want, icase, found, nfound, max, buf);
+    }
+    gettimeofday(&t1, NULL);
+    free(buf);
+
+    if (opt_info || !nfound) {
+	PRINTF("#search: %d line%s%s found in %ld lines, %d of %d blocks skipped (%.1f ms)\n",
+	       nfound, nfound == 1 ? "" : "s", nfound == max ? " (or more)" : "",
+	       next_line - (nblocks ? blocks[0]->first : next_line - cur_lines),
+	       skipped, nblocks,
+	       (t1.tv_sec - t0.tv_sec) * 1000.0 + (t1.tv_usec - t0.tv_usec) / 1000.0);
+    }
+
+    /* found[] is newest first */
+    if (emulate) {
+	status(-1);	/* we're pretending we got something from the MUD */
+	replaying = 1;
+    }
+    for (last = -1, i = nfound - 1; i >= 0; i--) {
+	long from = MAX2(found[i] - context, last + 1), n;
+	if (context && last >= 0 && from > last + 1 && !emulate)
+	    tty_puts("--\n");
+	for (n = from; n <= found[i] + context && n < next_line; n++) {
+	    if (i > 0 && n > found[i] && n >= found[i - 1] - context)
+		break;	/* the next match shows it */
+	    if (emulate)
+		sb_replay(n);
+	    else
+		sb_show(n, n == found[i] || (i > 0 && n == found[i - 1]) ? ':' : '-');
+	    last = n;
+	}
+    }
+    replaying = 0;
+    free(found);
+}
@@ -0,0 +1,13 @@
+/* public things from scrollback.c */
+
+#ifndef _SCROLLBACK_H_
+#define _SCROLLBACK_H_
+
+extern int scrollback_size;
+
+void scrollback_add(char *id, char *line, int len);
+void scrollback_resize(int size);
+void scrollback_search(char *text, char *id, int icase, int context,
+		       int max, int emulate);
+
+#endif /* _SCROLLBACK_H_ */
@@ -19,6 +19,7 @@
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <netdb.h>
 #include <netinet/in.h>
@@ -27,6 +28,12 @@
 #ifndef TELOPT_NAWS
 #  define TELOPT_NAWS 31
 #endif
+#ifndef TELOPT_EOR
+#  define TELOPT_EOR 25
+#endif
+#ifndef EOR
+#  define EOR 239
+#endif
 #include <arpa/inet.h>
 #ifndef NEXT
 #  include <unistd.h>
@@ -44,6 +51,7 @@
 #include "edit.h"
 #include "beam.h"
 #include "log.h"
+#include "list.h"
 
 #ifdef TELOPTS
 # define TELOPTSTR(n) ((n) > NTELOPTS ? "unknown" : telopts[n])
@@ -66,6 +74,52 @@ byte conn_table[MAX_FDSCAN];	     /* fd -> index translation table */
 
 fd_set fdset;			/* set of descriptors to select() on */
 
+static varnode *queue_depth;	/* @queue_depth: commands waiting in the
+				 * send queue of main connection */
+static varnode *queue_out;	/* @queue_out: commands sent on main connection
+				 * and not yet acknowledged by a prompt */
+
+/* a file or shell command being sent by #send, a few lines at time */
+typedef struct sendstream {
+    struct sendstream *next;
+    char *name;			/* file name or shell command */
+    int fd;			/* connection to send lines to */
+    int in;			/* file or pipe to read from */
+    int pid;			/* shell command pid, 0 for files */
+    long line;			/* lines read so far */
+    long start, end;		/* range of lines to send, 0 = all */
+    long sent;			/* lines sent so far */
+    off_t size, done;		/* file size (0 if unknown) and bytes read */
+    char *buf;			/* data read but not yet sent */
+    int pos, len, max;
+    char eof;			/* nothing more to read */
+    char polled;		/* waiting in select() for the pipe */
+    vtime wait;			/* don't send or read before this time */
+} sendstream;
+
+static sendstream *streams;	/* active #send <file and #send !cmd */
+
+int send_rate = 0;		/* max lines per second sent by #send <file,
+				 * 0 = no limit */
+
+static varnode *send_lines;	/* @send_lines: lines sent by current #send */
+static varnode *send_percent;	/* @send_percent: percentage of file sent */
+
+static void tcp_write_now(int fd, char *data);
+
+/*
+ * create the permanent variables used by the send queue
+ * and by #send <file
+ */
+void tcp_bootstrap(void)
+{
+    if (!(queue_depth = add_permanent_varnode("queue_depth", 0))
+	|| !(queue_out = add_permanent_varnode("queue_out", 0))
+	|| !(send_lines = add_permanent_varnode("send_lines", 0))
+	|| !(send_percent = add_permanent_varnode("send_percent", 0)))
+	syserr("malloc");
+}
+
 /*
  * process suboptions.
  * so far, only terminal type is processed but future extensions are
@@ -297,6 +351,7 @@ int tcp_read(int fd, char *buffer, int maxsize)
     int i;
     static byte subopt[MAX_SUBOPT];
     static int subchars;
+    int prompts = 0;
     byte *p, *s, *linestart;
 
     char *ibuffer = buffer;
@@ -408,7 +463,12 @@ int tcp_read(int fd, char *buffer, int maxsize)
 	     case GA:
 		/* I should handle GA as end-of-prompt marker one day */
 		/* one day has come ;) - Max */
+		/* FALLTHROUGH */
+	     case EOR:
+		/* hosts that negotiated END-OF-RECORD send it instead */
 		prompt_set_iac((char*)p);
+		CONN_LIST(fd).flags |= PROMPTMARK;
+		prompts++;
 		state = old_state;
 		break;
 	     default:
@@ -442,6 +502,10 @@ int tcp_read(int fd, char *buffer, int maxsize)
 		tty_special_keys();
 		sendopt(DO, *s);
 		break;
+	     case TELOPT_EOR:
+		/* host will mark the end of prompts with IAC EOR */
+		sendopt(DO, *s);
+		break;
 	     default:
 		/* don't accept other options */
 		sendopt(DONT, *s);
@@ -532,6 +596,11 @@ int tcp_read(int fd, char *buffer, int maxsize)
     if (!(CONN_LIST(tcp_fd).flags & SPAWN)) {
         log_write(buffer, (char *)p - buffer, 0);
     }
+    log_conn_write(fd, buffer, (char *)p - buffer, 0);
+
+    /* each prompt acknowledges one command in the send queue */
+    while (prompts--)
+	tcp_sendq_ack(fd);
 
     return (char *)p - buffer;
 }
@@ -606,9 +675,148 @@ static int output_len = 0;	/* number of characters in output_buffer */
 static int output_socket = -1;	/* to which socket buffer should be sent*/
 
 /*
- * put data in the output buffer for transmission to the remote host
+ * update @queue_depth and @queue_out from the main connection
+ */
+static void sendq_update_vars(void)
+{
+    long depth = 0, out = 0;
+
+    if (tcp_main_fd != -1) {
+	depth = CONN_LIST(tcp_main_fd).sendq_len;
+	out = CONN_LIST(tcp_main_fd).sendq_out;
+    }
+    if (queue_depth->num != depth) {
+	queue_depth->num = depth;
+	STATUSLINE_VAR(0, queue_depth->index);
+    }
+    if (queue_out->num != out) {
+	queue_out->num = out;
+	STATUSLINE_VAR(0, queue_out->index);
+    }
+}
+
+/*
+ * send a string to the remote host, unless there are already
+ * too many commands waiting for a prompt: in that case
+ * put it in the send queue, to be sent when a prompt arrives
  */
 void tcp_write(int fd, char *data)
+{
+    connsess *c;
+    sendline *q;
+    int len;
+
+    if (fd == -1 || !(c = &CONN_LIST(fd))->sendq_max) {
+	tcp_write_now(fd, data);
+	return;
+    }
+    if (!c->sendq_head && c->sendq_out < c->sendq_max) {
+	c->sendq_out++;
+	tcp_write_now(fd, data);
+	sendq_update_vars();
+	return;
+    }
+
+    len = strlen(data);
+    if (!(q = (sendline *)malloc(sizeof(sendline) + len))) {
+	errmsg("malloc");
+	return;
+    }
+    q->next = NULL;
+    memcpy(q->line, data, len + 1);
+    if (c->sendq_tail)
+	c->sendq_tail->next = q;
+    else
+	c->sendq_head = q;
+    c->sendq_tail = q;
+    c->sendq_len++;
+    sendq_update_vars();
+}
+
+/*
+ * send the first command in the send queue of fd
+ */
+static void sendq_pop(int fd)
+{
+    connsess *c = &CONN_LIST(fd);
+    sendline *q = c->sendq_head;
+
+    if (!(c->sendq_head = q->next))
+	c->sendq_tail = NULL;
+    c->sendq_len--;
+    c->sendq_out++;
+    tcp_write_now(fd, q->line);
+    free(q);
+}
+
+/*
+ * a prompt arrived from fd: the oldest command in flight
+ * has been processed, so we can send another one
+ */
+void tcp_sendq_ack(int fd)
+{
+    connsess *c = &CONN_LIST(fd);
+
+    if (c->sendq_out > 0)
+	c->sendq_out--;
+    while (c->sendq_head && (!c->sendq_max || c->sendq_out < c->sendq_max))
+	sendq_pop(fd);
+    sendq_update_vars();
+}
+
+/*
+ * send all queued commands of fd immediately
+ */
+void tcp_sendq_flush(int fd)
+{
+    while (CONN_LIST(fd).sendq_head)
+	sendq_pop(fd);
+    sendq_update_vars();
+}
+
+/*
+ * discard all queued commands of fd
+ * and forget the ones waiting for a prompt
+ */
+void tcp_sendq_clear(int fd)
+{
+    connsess *c = &CONN_LIST(fd);
+    sendline *q;
+
+    while ((q = c->sendq_head)) {
+	c->sendq_head = q->next;
+	free(q);
+    }
+    c->sendq_tail = NULL;
+    c->sendq_len = c->sendq_out = 0;
+    sendq_update_vars();
+}
+
+/*
+ * show the send queue of all connections
+ */
+void tcp_sendq_show(void)
+{
+    int i, n = 0;
+
+    for (i=0; i<conn_max_index; i++) {
+	connsess *c = &CONN_INDEX(i);
+	if (!c->id || (!c->sendq_max && !c->sendq_len))
+	    continue;
+	if (!n++)
+	    PRINTF("#send queues:\n");
+	tty_printf("##%s\t %d waiting, %d sent, limit %d%s\n", c->id,
+		   c->sendq_len, c->sendq_out, c->sendq_max,
+		   c->sendq_max ? "" : " (off)");
+    }
+    if (!n)
+	PRINTF("#no send queues active.\n");
+}
+
+/*
+ * put data in the output buffer for transmission to the remote host
+ */
+static void tcp_write_now(int fd, char *data)
 {
     char *iacs, *out;
     int len, space, iacp;
@@ -621,6 +829,10 @@ void tcp_write(int fd, char *data)
 	    log_write(data, len, 1);
 	reprint_writeline(data);
     }
+    if (linemode & LM_NOECHO)
+	log_conn_write(fd, "", 0, 1);
+    else
+	log_conn_write(fd, data, len, 1);
 
     /* must be AFTER reprint_writeline() */
     if (CONN_LIST(tcp_fd).flags & SPAWN)
@@ -775,6 +987,7 @@ void tcp_set_main(int fd)
 	linemode = 0;
     status(-1);
     reprint_clear();
+    sendq_update_vars();
 }
 
 /*
@@ -854,6 +1067,7 @@ void tcp_open(char *id, char *initstring, char *host, int port)
  */
 void tcp_close(char *id)
 {
+    sendstream *st;
     int i, sfd;
 
     status(1);
@@ -876,8 +1090,10 @@ void tcp_close(char *id)
     close(sfd);
 
     abort_edit_fd(sfd);
+    flood_close(sfd);
 
     tty_printf("#connection on \"%s\" closed.\n", CONN_LIST(sfd).id);
+    log_conn_close(sfd);
 
     if (sfd == tcp_main_fd) { /* main connection closed */
 	if (tcp_count == 1) { /* was last connection */
@@ -917,10 +1133,16 @@ void tcp_close(char *id)
     CONN_LIST(sfd).port = 0;
     free(CONN_LIST(sfd).host); CONN_LIST(sfd).host = 0;
     free(CONN_LIST(sfd).id);   CONN_LIST(sfd).id = 0;
-    if (CONN_LIST(sfd).fragment) {
-	free(CONN_LIST(sfd).fragment);
-	CONN_LIST(sfd).fragment = 0;
+    if (CONN_LIST(sfd).partial) {
+	free(CONN_LIST(sfd).partial);
+	CONN_LIST(sfd).partial = 0;
     }
+    CONN_LIST(sfd).partial_len = CONN_LIST(sfd).partial_max = 0;
+    CONN_LIST(sfd).partial_time.tv_sec = 0;
+    CONN_LIST(sfd).partial_shown = 0;
+    tcp_sendq_clear(sfd);
+    CONN_LIST(sfd).sendq_max = 0;
+    tcp_stream_cancel(sfd);
 
     /* recalculate conn_max_index */
     i = conn_table[sfd];
@@ -936,6 +1158,9 @@ void tcp_close(char *id)
 	if (CONN_INDEX(i).id && tcp_max_fd < CONN_INDEX(i).fd)
 	    tcp_max_fd = CONN_INDEX(i).fd;
     }
+    for (st = streams; st; st = st->next)
+	if (st->polled && tcp_max_fd < st->in)
+	    tcp_max_fd = st->in;
 }
 
 /*
@@ -1043,3 +1268,355 @@ void tcp_spawn(char *id, char *cmd)
      */
 }
 
+
+/*
+ * Below are the functions to send a file or the output of a shell command
+ * without blocking: lines are read and sent from the main loop,
+ * at most send_rate lines per second (or STREAM_CHUNK lines per loop
+ * if send_rate is zero), and only when the send queue is empty.
+ */
+
+static sendstream *stream_new(int fd, char *name)
+{
+    sendstream *st;
+
+    if (!(st = (sendstream *)malloc(sizeof(sendstream))))
+	return NULL;
+    if (!(st->name = my_strdup(name))) {
+	free(st);
+	return NULL;
+    }
+    st->next = NULL;
+    st->fd = fd;
+    st->in = -1;
+    st->pid = 0;
+    st->line = st->sent = 0;
+    st->start = st->end = 0;
+    st->size = st->done = 0;
+    st->buf = NULL;
+    st->pos = st->len = st->max = 0;
+    st->eof = st->polled = 0;
+    st->wait.tv_sec = st->wait.tv_usec = 0;
+    return st;
+}
+
+static void stream_append(sendstream *st)
+{
+    sendstream **sp;
+
+    /* #sends to the same connection are sent one after the other */
+    for (sp = &streams; *sp; sp = &(*sp)->next)
+	;
+    *sp = st;
+}
+
+/*
+ * start sending a file (or the output of a shell command if is_cmd)
+ * to connection fd. return -1 on error.
+ */
+int tcp_stream_open(int fd, char *name, int is_cmd, long start, long end)
+{
+    sendstream *st;
+    struct stat sb;
+    int in, pid = 0, p[2];
+
+    if (is_cmd) {
+	if (pipe(p) < 0)
+	    return -1;
+	switch (pid = fork()) {
+	  case 0:
+	    /* child */
+	    close(p[0]);
+	    dup2(p[1], 1);
+	    close(p[1]);
+	    execl("/bin/sh", "sh", "-c", name, NULL);
+	    _exit(127);
+	  case -1:
+	    close(p[0]);
+	    close(p[1]);
+	    return -1;
+	}
+	close(p[1]);
+	in = p[0];
+	fcntl(in, F_SETFL, O_NONBLOCK);
+    } else if ((in = open(name, O_RDONLY)) < 0)
+	return -1;
+    fcntl(in, F_SETFD, FD_CLOEXEC);
+
+    if (!(st = stream_new(fd, name))) {
+	if (pid)
+	    kill(pid, SIGTERM);
+	close(in);
+	errno = ENOMEM;
+	return -1;
+    }
+    st->in = in;
+    st->pid = pid;
+    st->start = start;
+    st->end = end;
+    st->size = (!is_cmd && !fstat(in, &sb)) ? sb.st_size : 0;
+    stream_append(st);
+    return 0;
+}
+
+/*
+ * send len bytes of text to connection fd one line at a time,
+ * like a file read by #send. return -1 if out of memory.
+ */
+int tcp_stream_text(int fd, char *name, char *text, int len)
+{
+    sendstream *st;
+
+    if (!(st = stream_new(fd, name)))
+	return -1;
+    if (!(st->buf = (char *)malloc(len + 1))) {
+	free(st->name);
+	free(st);
+	return -1;
+    }
+    memcpy(st->buf, text, len);
+    st->len = st->size = st->done = len;
+    st->max = len + 1;
+    st->eof = 1;
+    stream_append(st);
+    return 0;
+}
+
+static void stream_update_vars(void)
+{
+    long sent = 0, percent = 0;
+
+    if (streams) {
+	sent = streams->sent;
+	percent = streams->size
+	    ? (long)(streams->done * 100 / streams->size) : -1;
+    }
+    if (send_lines->num != sent) {
+	send_lines->num = sent;
+	STATUSLINE_VAR(0, send_lines->index);
+    }
+    if (send_percent->num != percent) {
+	send_percent->num = percent;
+	STATUSLINE_VAR(0, send_percent->index);
+    }
+}
+
+static void stream_free(sendstream **sp)
+{
+    sendstream *st = *sp;
+
+    *sp = st->next;
+    if (st->pid)
+	kill(st->pid, SIGTERM); /* reaped by sig_chld_bottomhalf() */
+    if (st->polled)
+	FD_CLR(st->in, &fdset);
+    if (st->in != -1)
+	close(st->in);
+    free(st->name);
+    if (st->buf)
+	free(st->buf);
+    free(st);
+}
+
+/*
+ * read more data into st->buf. return 0 if nothing available now.
+ */
+static int stream_fill(sendstream *st)
+{
+    int n;
+
+    if (st->pos) {
+	memmove(st->buf, st->buf + st->pos, st->len -= st->pos);
+	st->pos = 0;
+    }
+    if (st->max - st->len < BUFSIZE) {
+	char *p = (char *)realloc(st->buf, st->max + BUFSIZE);
+	if (!p) {
+	    errmsg("malloc");
+	    st->eof = 1;
+	    return 0;
+	}
+	st->buf = p;
+	st->max += BUFSIZE;
+    }
+    /* leave room for a final '\0' */
+    while ((n = read(st->in, st->buf + st->len, st->max - st->len - 1)) < 0
+	   && errno == EINTR)
+	;
+    if (n > 0) {
+	st->len += n;
+	st->done += n;
+	return 1;
+    }
+    if (n == 0 || errno != EAGAIN) {
+	if (n < 0)
+	    errmsg("read from #send");
+	st->eof = 1;
+    }
+    return 0;
+}
+
+/*
+ * send at most budget lines of st. return 0 when st is finished.
+ */
+static int stream_send(sendstream *st, int budget)
+{
+    char *line, *nl;
+
+    while (budget > 0) {
+	if (st->start && st->line >= st->end)
+	    return 0;
+
+	line = st->buf + st->pos;
+	if (!(nl = memchr(line, '\n', st->len - st->pos))) {
+	    if (!st->eof && stream_fill(st))
+		continue;
+	    if (!st->eof) {
+		/* shell command is slow, wait in select() for its output */
+		st->polled = 1;
+		FD_SET(st->in, &fdset);
+		if (tcp_max_fd < st->in)
+		    tcp_max_fd = st->in;
+		return 1;
+	    }
+	    if (st->pos == st->len)
+		return 0;
+	    /* last line, without final newline */
+	    nl = st->buf + st->len;
+	    st->pos = st->len;
+	} else
+	    st->pos = nl - st->buf + 1;
+
+	*nl = '\0';
+	st->line++;
+
+	if (!st->start || st->line >= st->start) {
+	    if (opt_echo) {
+		PRINTF("[%s]\n", line);
+	    }
+	    tcp_write(st->fd, line);
+	    st->sent++;
+	    budget--;
+	}
+	if (CONN_LIST(st->fd).sendq_head)
+	    /* send queue is full, wait for the MUD to catch up */
+	    break;
+    }
+    return 1;
+}
+
+/*
+ * called from main loop: send some more lines from each #send <file
+ */
+void tcp_stream_run(void)
+{
+    sendstream **sp, *st, *p;
+    int budget;
+    long ms;
+
+    for (sp = &streams; (st = *sp); ) {
+	/* only the oldest #send to each connection is active */
+	for (p = streams; p != st && p->fd != st->fd; p = p->next)
+	    ;
+	if (p != st || st->polled || CONN_LIST(st->fd).sendq_head) {
+	    sp = &st->next;
+	    continue;
+	}
+	if (st->wait.tv_sec || send_rate) {
+	    update_now();
+	    if (cmp_vtime(&st->wait, &now) > 0) {
+		sp = &st->next;
+		continue;
+	    }
+	}
+	if (send_rate > 0) {
+	    /* catch up with lines that were due while we were busy */
+	    ms = st->wait.tv_sec ? diff_vtime(&now, &st->wait) : 0;
+	    budget = 1 + (int)(ms * send_rate / mSEC_PER_SEC);
+	    if (budget > STREAM_CHUNK)
+		budget = STREAM_CHUNK;
+	} else
+	    budget = STREAM_CHUNK;
+
+	st->wait.tv_sec = st->wait.tv_usec = 0;
+	if (!stream_send(st, budget)) {
+	    stream_free(sp);
+	    continue;
+	}
+	if (send_rate > 0 && !st->wait.tv_sec) {
+	    update_now();
+	    ms = mSEC_PER_SEC / send_rate;
+	    st->wait.tv_sec = now.tv_sec + ms / mSEC_PER_SEC;
+	    st->wait.tv_usec = now.tv_usec + (ms % mSEC_PER_SEC) * uSEC_PER_mSEC;
+	    if (st->wait.tv_usec >= uSEC_PER_SEC)
+		st->wait.tv_sec++, st->wait.tv_usec -= uSEC_PER_SEC;
+	}
+	sp = &st->next;
+    }
+    stream_update_vars();
+}
+
+/*
+ * called from main loop after select(): wake up the #send !cmd
+ * whose output became readable
+ */
+void tcp_stream_ready(fd_set *readfds)
+{
+    sendstream *st;
+
+    for (st = streams; st; st = st->next)
+	if (st->polled && FD_ISSET(st->in, readfds)) {
+	    FD_CLR(st->in, &fdset);
+	    st->polled = 0;
+	}
+}
+
+/*
+ * return milliseconds until tcp_stream_run() has something to do,
+ * 0 if it has something to do now, -1 if it is waiting for a prompt
+ * or for a shell command (or there is no #send <file at all)
+ */
+int tcp_stream_sleeptime(void)
+{
+    sendstream *st, *p;
+    long ms, min = -1;
+
+    for (st = streams; st; st = st->next) {
+	for (p = streams; p != st && p->fd != st->fd; p = p->next)
+	    ;
+	if (p != st || st->polled || CONN_LIST(st->fd).sendq_head)
+	    continue;
+	if (!st->wait.tv_sec)
+	    return 0;
+	update_now();
+	if ((ms = diff_vtime(&st->wait, &now)) <= 0)
+	    return 0;
+	if (min < 0 || ms < min)
+	    min = ms;
+    }
+    return (int)min;
+}
+
+/*
+ * stop all #send <file to connection fd. return how many were stopped
+ */
+int tcp_stream_cancel(int fd)
+{
+    sendstream **sp, *st;
+    int n = 0;
+
+    for (sp = &streams; (st = *sp); ) {
+	if (st->fd != fd) {
+	    sp = &st->next;
+	    continue;
+	}
+	if (opt_info) {
+	    PRINTF("#send: cancelled \"%s\" after %ld line%s.\n",
+		   st->name, st->sent, st->sent == 1 ? "" : "s");
+	}
+	stream_free(sp);
+	n++;
+    }
+    stream_update_vars();
+    return n;
+}
@@ -12,6 +12,8 @@ extern int tcp_attachcount;	/* number of spawned or attached commands */
 
 extern int conn_max_index;	/* 1 + highest used conn_list[] index */
 
+extern int send_rate;		/* max lines per second sent by #send <file */
+
 
 /* multiple connections control */
 
@@ -33,17 +35,38 @@ extern int conn_max_index;	/* 1 + highest used conn_list[] index */
 /* SPAWN:	spawned cmd, not a mud	*/
 /* IDEDITOR:	sent #request editor	*/
 /* IDPROMPT:	sent #request prompt	*/
+/* PROMPTMARK:	host sends IAC GA or IAC EOR after prompts */
 #define ACTIVE	 1
 #define SPAWN	 2
 #define IDEDITOR 4
 #define IDPROMPT 8
+#define PROMPTMARK 16
+
+/* a command waiting in a connection's send queue */
+typedef struct sendline {
+    struct sendline *next;
+    char line[1];		/* actually longer */
+} sendline;
 
 typedef struct {
     char *id;			/* session id */
     char *host;			/* address of remote host */
     int port;			/* port number of remote host */
     int fd;			/* fd number */
-    char *fragment;		/* for SPAWN connections: unprocessed text */
+    char *partial;		/* incomplete last line received, followed
+				 * by room to read more data after it */
+    int partial_len;		/* length of the incomplete line */
+    int partial_max;		/* allocated size of partial */
+    vtime partial_time;		/* when to stop waiting for the rest of it,
+				 * tv_sec == 0 if not waiting */
+    int partial_shown;		/* how much of it is on screen as the prompt */
+    sendline *sendq_head;	/* commands waiting for a prompt */
+    sendline *sendq_tail;
+    int sendq_len;		/* number of commands in the send queue */
+    int sendq_max;		/* max commands in flight, 0 = no limit */
+    int sendq_out;		/* commands sent and not yet acknowledged */
+    struct logstream *log;	/* #capture ##id and #movie ##id, or NULL */
+    struct floodstate *flood;	/* flood mode of this connection, or NULL */
     char flags;
     char state;
     char old_state;
@@ -75,5 +98,18 @@ void tcp_togglesnoop(char *id);
 void tcp_spawn(char *id, char *cmd);
 int  tcp_unIAC(char *data, int len);
 
+void tcp_bootstrap(void);
+void tcp_sendq_ack(int fd);
+void tcp_sendq_flush(int fd);
+void tcp_sendq_clear(int fd);
+void tcp_sendq_show(void);
+
+int  tcp_stream_open(int fd, char *name, int is_cmd, long start, long end);
+int  tcp_stream_text(int fd, char *name, char *text, int len);
+void tcp_stream_run(void);
+void tcp_stream_ready(fd_set *readfds);
+int  tcp_stream_sleeptime(void);
+int  tcp_stream_cancel(int fd);
+
 #endif /* _TCP_H_ */
 
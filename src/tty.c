@@ -99,7 +99,8 @@ static char kpadstart[] = "", kpadend[] = "", begoln[] = "\r",
 	modeuline[] = "\033[4m", modestandon[] = "", modestandoff[] = "",
         modenorm[] = "\033[m", modenormbackup[4],
 	cursor_left[] = "\033[D", cursor_right[] = "\033[C",
-        cursor_up[] = "\033[A", cursor_down[] = "\033[B";
+        cursor_up[] = "\033[A", cursor_down[] = "\033[B",
+	savecur[] = "\0337", restcur[] = "\0338";
 
 #define insertfinish (0)
 static int len_begoln = 1, len_leftcur = 3, len_upcur = 3, gotocost = 8;
@@ -119,7 +120,8 @@ static char kpadstart[CAPLEN], kpadend[CAPLEN],
         inschar[CAPLEN],
 	begoln[CAPLEN], clreoln[CAPLEN], clreoscr[CAPLEN],
 	cursor_left[CAPLEN], cursor_right[CAPLEN], cursor_up[CAPLEN],
-	cursor_down[CAPLEN];
+	cursor_down[CAPLEN], chgregion[CAPLEN], savecur[CAPLEN],
+	restcur[CAPLEN];
 
 /* attribute changers: */
 static char modebold[CAPLEN], modeblink[CAPLEN], modeinv[CAPLEN],
@@ -142,6 +144,8 @@ char *tty_modebold = modebold,       *tty_modeblink = modeblink,
      *tty_clreoscr = clreoscr;
 
 int tty_read_fd = 0;
+int tty_region = 0;	/* lines in the scroll region, 0 if whole screen */
+static int tty_paste = 0;	/* 1 if bracketed paste mode is on */
 static int wrapglitch = 0;
 
 #ifdef USE_LOCALE
@@ -205,6 +209,8 @@ void tty_start(void)
 #endif
 
     tty_puts(kpadstart);
+    if (tty_paste)
+	tty_puts("\033[?2004h");
     tty_flush();
 
 #ifdef USE_LOCALE
@@ -231,7 +237,18 @@ void tty_quit(void)
 #else /* not USE_SGTTY */
     ioctl(tty_read_fd, TCSETS, &ttybsave);
 #endif /* USE_SGTTY */
+    if (tty_region) {
+	/* give the whole screen back, split_reset() will set it up again */
+	int n = tty_region;
+	tty_gotoxy(0, n);
+	tty_puts(clreoscr);
+	tty_set_region(0);
+	tty_region = n;
+	tty_gotoxy(0, n);
+    }
     tty_puts(kpadend);
+    if (tty_paste)
+	tty_puts("\033[?2004l");
     tty_flush();
 #ifdef USE_LOCALE
     fcntl(tty_read_fd, F_SETFL, orig_read_fd_fl);
@@ -302,16 +319,21 @@ void tty_sig_winch_bottomhalf(void)
 
 	if (tcp_main_fd != -1)
 	    tcp_write_tty_size();
-	line0 += lines - olines;
 
-	tty_gotoxy(0, line0);
-	/* so we know where the cursor is */
+	if (split_rows)
+	    split_reset();
+	else {
+	    line0 += lines - olines;
+
+	    tty_gotoxy(0, line0);
+	    /* so we know where the cursor is */
 #ifdef BUG_ANSI
-	if (edattrbg)
-	    tty_printf("%s%s", edattrend, tty_clreoscr);
-	else
+	    if (edattrbg)
+		tty_printf("%s%s", edattrend, tty_clreoscr);
+	    else
 #endif
-	    tty_puts(tty_clreoscr);
+		tty_puts(tty_clreoscr);
+	}
 
 	olines = lines;
 	status(1);
@@ -359,6 +381,9 @@ void tty_bootstrap(void)
 	{ "kr", cursor_right, 0, 0 },
 	{ "ku", cursor_up, 0, 0 },
 	{ "kd", cursor_down, 0, 0 },
+	{ "cs", chgregion, 0, 0 },
+	{ "sc", savecur, 0, 0 },
+	{ "rc", restcur, 0, 0 },
 	{ "", NULL, 0, 0 }
     };
     struct tc_init_node *np;
@@ -466,10 +491,12 @@ void tty_add_initial_binds(void)
 	{ "C-d",	"\004",		del_char_right },
 	{ "C-e",	"\005",		end_of_line },
 	{ "C-f",	"\006",		next_char },
+	{ "C-g",	"\007",		cancel_search },
 	{ "C-k",	"\013",		kill_to_eol },
 	{ "C-l",	"\014",		redraw_line },
 	{ "C-n",	"\016",		next_line },
 	{ "C-p",	"\020",		prev_line },
+	{ "C-r",	"\022",		reverse_search },
 	{ "C-t",	"\024",		transpose_chars },
 	{ "C-w",	"\027",		to_history },
 	{ "C-z",	"\032",		suspend_powwow },
@@ -534,6 +561,58 @@ void tty_gotoxy(int col, int line)
 #endif
 }
 
+/*
+ * use the top n lines of the screen as scroll region,
+ * or the whole screen if n == 0. The cursor is moved to the top-left corner.
+ * Return 0 if the terminal cannot do it.
+ */
+int tty_set_region(int n)
+{
+#ifdef USE_VT100
+    if (n)
+	tty_printf("\033[1;%dr", n);
+    else
+	tty_puts("\033[r");
+#else
+    if (!*chgregion || !*savecur || !*restcur)
+	return 0;
+    tty_puts(tgoto(chgregion, (n ? n : lines) - 1, 0));
+#endif
+    tty_region = n;
+    return 1;
+}
+
+/*
+ * ask the terminal to enclose pasted text in PASTE_BEGIN ... PASTE_END
+ * (bracketed paste mode). Terminals that cannot do it ignore the request.
+ */
+void tty_set_paste(int on)
+{
+    if (on == tty_paste)
+	return;
+    tty_puts(on ? "\033[?2004h" : "\033[?2004l");
+    tty_paste = on;
+}
+
+/*
+ * remember the cursor position, to get back to it with tty_restore_cursor()
+ */
+void tty_save_cursor(void)
+{
+    tty_puts(savecur);
+}
+
+/*
+ * move the cursor back where tty_save_cursor() found it,
+ * then up by the given number of lines
+ */
+void tty_restore_cursor(int up)
+{
+    tty_puts(restcur);
+    while (up-- > 0)
+	tty_puts(upcur);
+}
+
 /*
  * optimized cursor movement
  * from (fromcol, fromline) to (tocol, toline)
@@ -771,6 +850,11 @@ void input_insert_follow_chars(char *str, int n)
 
     if (line_status != 0)
 	return;
+    if (split_rows && split_fit()) {
+	/* moved to make room for it, redraw it later */
+	line_status = 1;
+	return;
+    }
 
     do {
 	i_cost = n;
@@ -813,13 +897,47 @@ void input_insert_follow_chars(char *str, int n)
 #ifdef USE_LOCALE
 /* curses wide character support by Dain */
 
-void tty_puts(const char *s)
+/*
+ * Output bytes are latin1 chars, converted to the multibyte encoding
+ * of the current locale. If the encoding is stateless (UTF-8, ISO-8859-x,
+ * ...) the conversion of each byte never changes: compute it once,
+ * and copy runs of bytes that convert to themselves (i.e. ASCII) as they are.
+ */
+static struct {
+    signed char ready;		/* 1 = table is valid, -1 = stateful
+				 * encoding (use wcrtomb() on each char) */
+    unsigned char same[256];	/* 1 if the byte converts to itself */
+    unsigned char len[256];	/* length of the conversion of each byte */
+    char conv[256][MB_LEN_MAX];	/* the conversion of each byte */
+} tty_charmap;
+
+static void tty_charmap_init(void)
 {
-    while (*s)
-        tty_putc(*s++);
+    mbstate_t st;
+    size_t r;
+    int c;
+
+    if (wctomb(NULL, 0)) {
+	tty_charmap.ready = -1;
+	return;
+    }
+    for (c = 0; c < 256; c++) {
+	memzero(&st, sizeof st);
+	r = wcrtomb(tty_charmap.conv[c], (unsigned char)c, &st);
+	if (r == (size_t)-1) {
+	    /* character cannot be represented; use a question mark */
+	    memzero(&st, sizeof st);
+	    if ((r = wcrtomb(tty_charmap.conv[c], L'?', &st)) == (size_t)-1)
+		r = 0;
+	}
+	tty_charmap.len[c] = r;
+	tty_charmap.same[c] = r == 1 && tty_charmap.conv[c][0] == (char)c;
+    }
+    tty_charmap.ready = 1;
 }
 
-void tty_putc(char c)
+/* convert and buffer a single char with wcrtomb(), for stateful encodings */
+static void tty_putc_wc(char c)
 {
     size_t r;
     int ignore_error = 0;
@@ -845,123 +963,182 @@ again:
     tty_write_state.used += r;
 }
 
+/* convert and buffer len chars */
+static void tty_write_conv(const char *s, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)s, *end = p + len, *run;
+    size_t n;
+
+    if (!tty_charmap.ready)
+	tty_charmap_init();
+    if (tty_charmap.ready < 0) {
+	while (p < end)
+	    tty_putc_wc(*p++);
+	return;
+    }
+    while (p < end) {
+	for (run = p; p < end && tty_charmap.same[*p]; p++)
+	    ;
+	if (p > run)
+	    tty_raw_write((char *)run, p - run);
+	if (p < end) {
+	    n = tty_charmap.len[*p];
+	    if (tty_write_state.used + n > sizeof tty_write_state.data)
+		tty_flush();
+	    memcpy(tty_write_state.data + tty_write_state.used,
+		   tty_charmap.conv[*p++], n);
+	    tty_write_state.used += n;
+	}
+    }
+}
+
+void tty_puts(const char *s)
+{
+    tty_write_conv(s, strlen(s));
+}
+
+void tty_putsn(const char *s, int len)
+{
+    tty_write_conv(s, len);
+}
+
+void tty_putc(char c)
+{
+    if (tty_charmap.ready > 0 && tty_charmap.same[(unsigned char)c]) {
+	if (tty_write_state.used >= sizeof tty_write_state.data)
+	    tty_flush();
+	tty_write_state.data[tty_write_state.used++] = c;
+    } else
+	tty_write_conv(&c, 1);
+}
+
 int tty_printf(const char *format, ...)
 {
+    static char *big;		/* for long outputs, grown as needed */
+    static int bigsize;
     char buf[1024], *bufp = buf;
     va_list va;
     int res;
+#ifdef HAVE_USELOCALE
+    static locale_t c_locale;
+    locale_t old_locale = (locale_t)0;
+#else
+    char *old_locale;
+#endif
 
-    char *old_locale = strdup(setlocale(LC_ALL, NULL));
+    /* nothing to format */
+    if (!strchr(format, '%')) {
+	tty_puts(format);
+	return strlen(format);
+    }
 
+    /*
+     * format in the "C" locale: text is latin1,
+     * it would confuse printf() in multibyte locales.
+     */
+#ifdef HAVE_USELOCALE
+    if (c_locale || (c_locale = newlocale(LC_ALL_MASK, "C", (locale_t)0)))
+	old_locale = uselocale(c_locale);
+#else
+    old_locale = strdup(setlocale(LC_ALL, NULL));
     setlocale(LC_ALL, "C");
+#endif
 
     va_start(va, format);
     res = vsnprintf(buf, sizeof buf, format, va);
     va_end(va);
 
-    if (res >= sizeof buf) {
-	bufp = alloca(res + 1);
-	va_start(va, format);
-	vsprintf(bufp, format, va);
-        assert(strlen(bufp) == res);
-	va_end(va);
+    if (res >= (int)sizeof buf) {
+	if (res >= bigsize) {
+	    if ((bufp = (char *)realloc(big, res + 1)))
+		big = bufp, bigsize = res + 1;
+	}
+	if (res < bigsize) {
+	    bufp = big;
+	    va_start(va, format);
+	    vsnprintf(bufp, bigsize, format, va);
+	    va_end(va);
+	} else
+	    bufp = buf;	/* out of memory: print it truncated */
     }
 
+#ifdef HAVE_USELOCALE
+    if (old_locale)
+	uselocale(old_locale);
+#else
     setlocale(LC_ALL, old_locale);
     free(old_locale);
+#endif
 
-    tty_puts(bufp);
+    if (res >= 0)
+	tty_puts(bufp);
 
     return res;
 }
 
-static char tty_in_buf[MB_LEN_MAX + 1];
-static size_t tty_in_buf_used = 0;
+/*
+ * bytes read from the terminal and not yet converted. Pastes arrive
+ * in large blocks, so read them whole and convert in place.
+ */
+static char tty_in_buf[BUFSIZE];
+static size_t tty_in_pos = 0, tty_in_len = 0;
+static int tty_in_partial = 0;	/* buffer ends with an incomplete char */
 
 int tty_has_chars(void)
 {
-    return tty_in_buf_used != 0;
+    return tty_in_pos < tty_in_len && !tty_in_partial;
 }
 
-static int safe_mbtowc(wchar_t *pwc, char *s, size_t *n)
+int tty_read(char *buf, size_t count)
 {
     static mbstate_t ps;
-
+    int result = 0, did_read;
     size_t r;
-
-again:
-    r = mbrtowc(pwc, s, *n, &ps);
-    if (r == (size_t)-2) {
-        /* incomplete character */
-        *n = 0;
-        return -1;
-    }
-    if (r == (size_t)-1 && errno == EILSEQ) {
-        /* invalid character */
-        --*n;
-        memmove(s, s + 1, *n);
-        goto again;
-    }
-    if (r == 0 && n > 0 && s[0] == 0) {
-        *pwc = L'\0';
-        r = 1;
-    }
-    return r;
-}
-
-int tty_read(char *buf, size_t count)
-{
-    int result = 0;
-    int converted;
     wchar_t wc;
-    int did_read = 0, should_read = 0;
 
-    if (count && tty_in_buf_used) {
-	converted = safe_mbtowc(&wc, tty_in_buf, &tty_in_buf_used);
-	if (converted >= 0)
-	    goto another;
-    }
+    if (!count)
+	return 0;
 
-    while (count) {
-	should_read = sizeof tty_in_buf - tty_in_buf_used;
-	did_read = read(tty_read_fd, tty_in_buf + tty_in_buf_used,
-                        should_read);
+    if (tty_in_pos == tty_in_len || tty_in_partial) {
+	/* keep the incomplete char, if any, and read some more */
+	tty_in_len -= tty_in_pos;
+	memmove(tty_in_buf, tty_in_buf + tty_in_pos, tty_in_len);
+	tty_in_pos = 0;
 
-	if (did_read < 0 && errno == EINTR)
-	    continue;
+	while ((did_read = read(tty_read_fd, tty_in_buf + tty_in_len,
+				sizeof tty_in_buf - tty_in_len)) < 0
+	       && errno == EINTR)
+	    ;
 	if (did_read <= 0)
-	    break;
-
-	tty_in_buf_used += did_read;
+	    return 0;
+	tty_in_len += did_read;
+	tty_in_partial = 0;
+    }
 
-	converted = safe_mbtowc(&wc, tty_in_buf, &tty_in_buf_used);
-	if (converted < 0)
+    while (count && tty_in_pos < tty_in_len) {
+	r = mbrtowc(&wc, tty_in_buf + tty_in_pos, tty_in_len - tty_in_pos, &ps);
+	if (r == (size_t)-2) {
+	    /* incomplete character: wait for the rest of it */
+	    memzero(&ps, sizeof ps);
+	    tty_in_partial = 1;
 	    break;
-
-    another:
-	if (converted == 0)
-	    converted = 1;
+	}
+	if (r == (size_t)-1) {
+	    /* invalid character: skip a byte */
+	    memzero(&ps, sizeof ps);
+	    tty_in_pos++;
+	    continue;
+	}
+	if (r == 0)
+	    r = 1, wc = L'\0';
+	tty_in_pos += r;
 
 	if (!(wc & ~0xff)) {
 	    *buf++ = (unsigned char)wc;
 	    --count;
 	    ++result;
 	}
-
-	tty_in_buf_used -= converted;
-	memmove(tty_in_buf, tty_in_buf + converted, tty_in_buf_used);
-
-	if (count == 0)
-	    break;
-
-	converted = safe_mbtowc(&wc, tty_in_buf, &tty_in_buf_used);
-	if (converted >= 0 && tty_in_buf_used)
-	    goto another;
-
-	if (did_read < should_read)
-	    break;
     }
-
     return result;
 }
 
@@ -4,6 +4,7 @@
 #define _TTY_H_
 
 extern int tty_read_fd;
+extern int tty_region;
 
 extern char *tty_clreoln, *tty_clreoscr, *tty_begoln,
             *tty_modebold, *tty_modeblink, *tty_modeuline,
@@ -19,6 +20,10 @@ void tty_add_walk_binds(void);
 void tty_add_initial_binds(void);
 void tty_gotoxy(int col, int line);
 void tty_gotoxy_opt(int fromcol, int fromline, int tocol, int toline);
+int  tty_set_region(int n);
+void tty_set_paste(int on);
+void tty_save_cursor(void);
+void tty_restore_cursor(int up);
 
 void input_delete_nofollow_chars(int n);
 void input_overtype_follow(char c);
@@ -28,9 +33,11 @@ void input_moveto(int new_pos);
 #ifndef USE_LOCALE
 
 #define tty_puts(s)             fputs((s), stdout)
+#define tty_putsn(s, len)       fwrite((s), 1, (len), stdout)
 #define tty_putc(c)             fputc((unsigned char)(c), stdout)
 #define tty_printf(...)         printf(__VA_ARGS__)
 #define tty_read(buf, cnt)      read(tty_read_fd, (buf), (cnt))
+#define tty_has_chars()         0
 #define tty_gets(s, size)       fgets((s), (size), stdin)
 #define tty_flush()             fflush(stdout)
 #define tty_raw_write(s,size)   do { tty_flush(); write(1, (s), (size)); } while (0)
@@ -45,6 +52,7 @@ void input_moveto(int new_pos);
 #endif
 
 void tty_puts(const char *s);
+void tty_putsn(const char *s, int len);
 void tty_putc(char c);
 int  tty_printf(const char *format, ...) PRINTF_FUNCTION(1, 2);
 int  tty_read(char *buf, size_t count);
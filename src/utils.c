@@ -39,6 +39,10 @@
 #include "edit.h"
 #include "eval.h"
 #include "log.h"
+#include "tcp.h"
+#include "history.h"
+#include "logfile.h"
+#include "scrollback.h"
 
 #define SAVEFILEVER 6
 
@@ -338,8 +342,8 @@ static int match_mark_or_subst(basenode *bp, char *src)
 {
     char *pat = bp->pattern;
     char *npat=0, *npat2=0, *nsrc=0, *prm=0, *endprm=0, *tmp, c;
-    static char mpat[BUFSIZE];
-    int mbeg = bp->mbeg, mword = 0, p;
+    char *srcend;
+    int mbeg = bp->mbeg, mword = 0, mlen = 0, p;
 
     /* shortcut for #marks without wildcards */
     if (!bp->wild) {
@@ -352,6 +356,7 @@ static int match_mark_or_subst(basenode *bp, char *src)
     }
 
     bp->start = NULL;
+    srcend = src + strlen(src);
 
     if (ISMARKWILDCARD(*pat))
 	mbeg = - mbeg - 1;  /* pattern starts with '&' or '$' */
@@ -373,14 +378,11 @@ static int match_mark_or_subst(basenode *bp, char *src)
 	if (npat2 < npat) npat = npat2;
 	if (!*npat) npat = 0;
 
-	if (npat) {
-	    my_strncpy(mpat, pat, npat-pat);
-	    /* mpat[npat - pat] = 0; */
-	} else
-	    strcpy(mpat, pat);
+	/* the literal text up to next wildcard, matched in place */
+	mlen = npat ? npat - pat : strlen(pat);
 
-	if (*mpat) {
-	    nsrc = strstr(src, mpat);
+	if (mlen) {
+	    nsrc = memfind(src, srcend - src, pat, mlen);
 	    if (!nsrc)
 		return 0;
 	    if (mbeg > 0) {
@@ -395,9 +397,9 @@ static int match_mark_or_subst(basenode *bp, char *src)
 		else
 		    bp->start = nsrc;
 	    }
-	    bp->end = nsrc + strlen(mpat);
+	    bp->end = nsrc + mlen;
 	} else if (prm)           /* end of pattern space */
-	    bp->end = endprm = prm + strlen(prm);
+	    bp->end = endprm = srcend;
 	else
 	    bp->end = src;
 
@@ -432,7 +434,7 @@ static int match_mark_or_subst(basenode *bp, char *src)
 	}
 	if (prm)
 	    mbeg = mword = 0;  /* reset match flags */
-	src = nsrc + strlen(mpat);
+	src = nsrc + mlen;
 	pat = npat;
     }
     return 1;
@@ -591,52 +593,46 @@ ptr ptraddsubst_and_marks(ptr dst, ptr line)
 /*
  * write string to tty, word wrapping to next line if needed.
  * don't print a final \n
+ *
+ * Each row is scanned once, tallying the displayed characters
+ * (escape sequences take no room) and remembering the last space
+ * as break point, then written straight to the tty.
  */
 static void wrap_print(char *s)
 {
-    /* ls = last space in *s, lp = last space in *p */
-    char *ls, *lp, *p, c, follow = 1;
-    char buf[BUFSIZE]; /* ASSERT(cols<BUFSIZE) */
-
-    /* l = left, m = current offset */
-    int l, m;
+    /* row = start of current row, ls = just after last space in row */
+    char *row, *ls, c;
+    /* m = displayed chars in row, w = room in row */
+    int m, w;
     enum { NORM, ESCAPE, BRACKET } state;
 #ifdef BUG_ANSI
-    int ansibug = 0;
-#endif
+    int l = printstrlen(s), ansibug = 0;
 
-    l = printstrlen(s);
-#ifdef BUG_ANSI
     if (l > cols_1 && l < (int)strlen(s))
         ansibug = 1;
 #endif
 
-    while (l >= cols_1 - col0 && *s) {
-        p = buf; m = 0; state = NORM;
-        lp = ls = NULL;
+    for (;;) {
+        row = s; m = 0; state = NORM;
+        ls = NULL;
+        w = cols_1 - col0;
 
-        /* this scans over the remaining part of the line adding stuff to
-         * print to the buffer and tallying the length of displayed
-         * characters */
-        while (m < cols_1 - col0 && *s && *s != '\n') {
-            *p++ = c = *s++;
+        while (m < w && (c = *s) && c != '\n') {
+            s++;
             switch (state) {
                 case NORM:
-                    if (c == ' ') {
+                    if (c == ' ')
                         ls = s;
-                        lp = p;
-                    }
 
                     if (c == '\033') {
                         state = ESCAPE;
-                    }else if ((c & 0x80) || (c >= ' ' && c <= '~')) {
+                    } else if ((c & 0x80) || (c >= ' ' && c <= '~')) {
                         /* if char is hi (128+) or printable */
-                        m++, l--;
-                    }else if (c == '\r') {
-                        ls = lp = NULL;
+                        m++;
+                    } else if (c == '\r') {
+                        ls = NULL;
                         m = 0;
                     }
-
                     break;
 
                 case ESCAPE:
@@ -650,30 +646,33 @@ static void wrap_print(char *s)
             }
         }
 
-        /* Adjust offsets and stuff to last space */
-        if( ls != NULL && ls != s ) {
-            /* move s back to the last space */
-            s = ls;
-            /* null term buf[] at last space */
-            lp[ 0 ] = 0;
+        if (m < w) {
+            /* the rest of the line fits */
+            tty_putsn(row, s - row);
+            if (!*s)
+                break;
+            /* explicit newline: go on with a new row */
+            tty_putc(*s++);
+            col0 = 0;
+            continue;
         }
 
-        follow = *s;
-
-        *p = '\0';
-        tty_printf("%s%s", buf, follow ? "\n" : "");
-        if (follow)
-            col0 = 0;
+        /* row is full: break it at the last space, if any */
+        if (ls != NULL && ls != s)
+            s = ls;
+        tty_putsn(row, s - row);
+        if (!*s)
+            break;
+        tty_putc('\n');
+        col0 = 0;
+        if (*s == '\n')
+            s++;
     }
 
 #ifdef BUG_ANSI
     if (ansibug)
-        tty_printf("%s%s%s", follow ? s : "" ,
-                tty_modenorm, tty_clreoln);
-    else
+        tty_printf("%s%s", tty_modenorm, tty_clreoln);
 #endif
-        if (follow)
-            tty_puts(s);
 }
 
 /*
@@ -705,7 +704,7 @@ void smart_print(char *line, char newline)
 		tty_printf("%s%s%s", buf, tty_modenorm, tty_clreoln);
 	    else
 #endif
-		tty_printf("%s", buf);
+		tty_putsn(buf, ptrlen(ptrbuf));
 	}
     } while(0);
 
@@ -798,6 +797,7 @@ void suspend_powwow(int  signum)
         signal_start();
         tty_start();
         tty_sig_winch_bottomhalf();  /* in case size changed meanwhile */
+        split_reset();
     } else
 	tty_puts("\n#I don't think your shell has job control.\n");
     status(1);
@@ -935,6 +935,7 @@ void syserr(char *msg)
     tty_puts("#settings NOT saved to file.\n");
 #endif
 
+    logfile_flush();
     tty_quit();
     exit(1);
 }
@@ -988,7 +989,7 @@ int read_settings(void)
 {
     FILE *f;
     char *buf, *p, *cmd, old_nice = a_nice;
-    int failed = 1, n, savefilever = 0, left, len, limit_mem_hit = 0;
+    int failed = 1, n, i, savefilever = 0, left, len, limit_mem_hit = 0;
     varnode **first;
     ptr ptrbuf;
 
@@ -1029,14 +1030,14 @@ int read_settings(void)
     while (substitutions)
 	delete_substnode(&substitutions);
     for (n = 0; n < MAX_HASH; n++) {
-	while (named_vars[0][n])
-	    delete_varnode(&named_vars[0][n], 0);
-	first = &named_vars[1][n];
-	while (*first) {
-	    if (is_permanent_variable(*first))
-		first = &(*first)->next;
-	    else
-		delete_varnode(first, 1);
+	for (i = 0; i < 2; i++) {
+	    first = &named_vars[i][n];
+	    while (*first) {
+		if (is_permanent_variable(*first))
+		    first = &(*first)->next;
+		else
+		    delete_varnode(first, i);
+	    }
 	}
     }
 
@@ -1207,6 +1208,36 @@ int save_settings(void)
     if (failed > 0 && (i = log_getsize()))
 	failed = fprintf(f, "#setvar buffer=%d\n", i);
 
+    if (failed > 0 && log_file())
+	failed = fprintf(f, "#buffile %s\n", log_file());
+
+    if (failed > 0 && scrollback_size)
+	failed = fprintf(f, "#setvar scrollback=%d\n", scrollback_size);
+
+    if (failed > 0 && send_rate)
+	failed = fprintf(f, "#setvar sendrate=%d\n", send_rate);
+
+    if (failed > 0 && log_sync)
+	failed = fprintf(f, "#setvar logsync=%d\n", log_sync);
+
+    if (failed > 0 && log_size)
+	failed = fprintf(f, "#setvar logsize=%d\n", log_size);
+
+    if (failed > 0 && log_time)
+	failed = fprintf(f, "#setvar logtime=%d\n", log_time);
+
+    if (failed > 0 && log_zip)
+	failed = fprintf(f, "#setvar logzip=%d\n", log_zip);
+
+    if (failed > 0 && partial_timeout != PARTIAL_TIMEOUT)
+	failed = fprintf(f, "#setvar partial=%d\n", partial_timeout);
+
+    if (failed > 0 && max_line != MAX_LINE_LEN)
+	failed = fprintf(f, "#setvar maxline=%d\n", max_line);
+
+    if (failed > 0 && flood_limit)
+	failed = fprintf(f, "#setvar flood=%d\n", flood_limit);
+
     if (failed > 0) {
 	reverse_sortedlist((sortednode **)&sortedaliases);
 	for (alp = sortedaliases; alp && failed > 0; alp = alp->snext) {
@@ -1248,6 +1279,14 @@ int save_settings(void)
 	failed = fprintf(f, "#substitute %s%s=%s\n", sp->b.mbeg ? "^" : "",
 			     ptrdata(pp), sp->replacement);
     }
+    for (i = 1; i <= status_rows && failed > 0; i++) {
+	char *expr = statusline_get(i, &l);
+	if (expr)
+	    failed = fprintf(f, "#status %d%s%s=%s\n", i,
+			     l == NOATTRCODE ? "" : " ",
+			     l == NOATTRCODE ? "" : attr_name(l), expr);
+    }
+
     /* save value of global variables */
 
     for (flag = 0, i=0; i<NUMVAR && failed > 0; i++) {
@@ -1270,7 +1309,7 @@ int save_settings(void)
     if (failed > 0) {
 	reverse_sortedlist((sortednode **)&sortednamed_vars[0]);
 	for (flag = 0, vp = sortednamed_vars[0]; vp && failed > 0; vp = vp->snext) {
-	    if (vp->num) {
+	    if (vp->num && !is_permanent_variable(vp)) {
 		failed = fprintf(f, "%s@%s = %ld", flag ? ", " : "#(",
 				 vp->name, vp->num);
 		flag = 1;
@@ -1293,7 +1332,10 @@ int save_settings(void)
     }
 
     /* GH: fixed the history and word completions saves */
-    if (failed > 0 && opt_history) {
+    if (failed > 0 && history_file()) {
+	/* the history is already in its own file */
+	failed = fprintf(f, "#histfile %s\n", history_file());
+    } else if (failed > 0 && opt_history) {
 	l = (curline + 1) % MAX_HIST;
 	while (failed > 0 && l != curline) {
 	    if (hist[l] && *hist[l]) {
@@ -1308,11 +1350,8 @@ int save_settings(void)
 
     if (failed > 0 && opt_words) {
 	int cl = 4, len;
-	l = wordindex;
 	flag = 0;
-	while (words[l = words[l].next].word)
-	    ;
-	while (words[l = words[l].prev].word && failed > 0) {
+	for (l = word_last[WORD_TYPED]; l != -1 && failed > 0; l = words[l].prev) {
             pp = ptrmescape(pp, words[l].word, strlen(words[l].word), 0);
             len = ptrlen(pp) + 1;
             if (cl > 4 && cl + len >= 80) {
@@ -1381,10 +1420,17 @@ void update_now(void)
  */
 void exit_powwow(void)
 {
+    int i;
+
     log_flush();
-    if (capturefile) fclose(capturefile);
-    if (recordfile)  fclose(recordfile);
-    if (moviefile)   fclose(moviefile);
+    log_movie_end();
+    logfile_close(capturefile);
+    logfile_close(recordfile);
+    logfile_close(moviefile);
+    for (i = 0; i < conn_max_index; i++)
+	if (CONN_INDEX(i).id)
+	    log_conn_close(CONN_INDEX(i).fd);
+    logfile_done();
     (void)save_settings();
     show_stat();
     tty_quit();